@@ -42,6 +42,8 @@
 static void	up_client_class_init	(UpClientClass	*klass);
 static void	up_client_init		(UpClient	*client);
 static void	up_client_finalize	(GObject	*object);
+static void	up_client_initable_iface_init		(GInitableIface		*iface);
+static void	up_client_async_initable_iface_init	(GAsyncInitableIface	*iface);
 
 #define UP_CLIENT_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), UP_TYPE_CLIENT, UpClientPrivate))
 
@@ -53,6 +55,9 @@ static void	up_client_finalize	(GObject	*object);
 struct _UpClientPrivate
 {
 	UpClientGlue		*proxy;
+	gboolean		 no_enumerate_with_properties;
+	gboolean		 subscribed;
+	GHashTable		*pending_adds;	/* object path -> GCancellable */
 };
 
 enum {
@@ -73,7 +78,80 @@ enum {
 static guint signals [UP_CLIENT_LAST_SIGNAL] = { 0 };
 static gpointer up_client_object = NULL;
 
-G_DEFINE_TYPE (UpClient, up_client, G_TYPE_OBJECT)
+G_DEFINE_TYPE_WITH_CODE (UpClient, up_client, G_TYPE_OBJECT,
+			 G_IMPLEMENT_INTERFACE (G_TYPE_INITABLE,
+						up_client_initable_iface_init)
+			 G_IMPLEMENT_INTERFACE (G_TYPE_ASYNC_INITABLE,
+						up_client_async_initable_iface_init))
+
+/*
+ * up_client_set_device_properties:
+ *
+ * Sets up a device from properties the daemon already sent us.
+ */
+static gboolean
+up_client_set_device_properties (UpClient *client, UpDevice *device, const gchar *name,
+				 const gchar *object_path, GVariant *properties)
+{
+	if (client->priv->subscribed)
+		return up_device_set_object_path_subscribed_sync (device, name, object_path,
+								  properties, NULL, NULL);
+	return up_device_set_object_path_with_properties_sync (device, name, object_path,
+							       properties, NULL, NULL);
+}
+
+/*
+ * up_client_get_devices_with_properties:
+ *
+ * Gets the devices and all their properties in one call, rather than
+ * one call per device; returns %NULL if the daemon can't do that.
+ */
+static GPtrArray *
+up_client_get_devices_with_properties (UpClient *client)
+{
+	GError *error = NULL;
+	GVariant *devices = NULL;
+	GVariantIter iter;
+	GVariant *properties;
+	GPtrArray *array = NULL;
+	UpDevice *device;
+	const gchar *object_path;
+	gchar *name;
+
+	/* talk to the daemon by its unique name, so that creating each
+	 * device proxy doesn't have to look it up */
+	name = g_dbus_proxy_get_name_owner (G_DBUS_PROXY (client->priv->proxy));
+	if (name == NULL)
+		goto out;
+
+	if (!up_client_glue_call_enumerate_devices_with_properties_sync (client->priv->proxy,
+									 &devices,
+									 NULL,
+									 &error)) {
+		if (g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD))
+			client->priv->no_enumerate_with_properties = TRUE;
+		else
+			g_warning ("up_client_get_devices failed: %s", error->message);
+		g_error_free (error);
+		goto out;
+	}
+
+	array = g_ptr_array_new ();
+	g_variant_iter_init (&iter, devices);
+	while (g_variant_iter_next (&iter, "{&o@a{sv}}", &object_path, &properties)) {
+		device = up_device_new ();
+		if (up_client_set_device_properties (client, device, name, object_path, properties))
+			g_ptr_array_add (array, device);
+		else
+			g_object_unref (device);
+		g_variant_unref (properties);
+	}
+out:
+	if (devices != NULL)
+		g_variant_unref (devices);
+	g_free (name);
+	return array;
+}
 
 /**
  * up_client_get_devices:
@@ -95,6 +173,13 @@ up_client_get_devices (UpClient *client)
 
 	g_return_val_if_fail (UP_IS_CLIENT (client), NULL);
 
+	/* newer daemons give us everything in one go */
+	if (!client->priv->no_enumerate_with_properties) {
+		array = up_client_get_devices_with_properties (client);
+		if (array != NULL)
+			return array;
+	}
+
 	array = g_ptr_array_new ();
 
 	if (up_client_glue_call_enumerate_devices_sync (client->priv->proxy,
@@ -149,6 +234,317 @@ up_client_get_display_device (UpClient *client)
 	return device;
 }
 
+/*
+ * UpClientDevicesHelper:
+ */
+typedef struct {
+	UpClient		*client;
+	GSimpleAsyncResult	*res;
+	GCancellable		*cancellable;
+	GPtrArray		*array;
+	guint			 pending;
+} UpClientDevicesHelper;
+
+/*
+ * up_client_devices_helper_complete:
+ *
+ * Completes with the devices collected so far, or with @error if that
+ * is set, taking ownership of it, and frees @helper.
+ */
+static void
+up_client_devices_helper_complete (UpClientDevicesHelper *helper, GError *error)
+{
+	/* devices that failed to connect are skipped, but not all of them
+	 * because we were cancelled */
+	if (error == NULL)
+		g_cancellable_set_error_if_cancelled (helper->cancellable, &error);
+
+	if (error != NULL) {
+		g_ptr_array_foreach (helper->array, (GFunc) g_object_unref, NULL);
+		g_simple_async_result_take_error (helper->res, error);
+	} else {
+		g_simple_async_result_set_op_res_gpointer (helper->res,
+							   g_ptr_array_ref (helper->array),
+							   (GDestroyNotify) g_ptr_array_unref);
+	}
+	g_simple_async_result_complete (helper->res);
+
+	g_object_unref (helper->res);
+	g_object_unref (helper->client);
+	if (helper->cancellable != NULL)
+		g_object_unref (helper->cancellable);
+	g_ptr_array_unref (helper->array);
+	g_free (helper);
+}
+
+/*
+ * up_client_get_devices_device_cb:
+ */
+static void
+up_client_get_devices_device_cb (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+	UpClientDevicesHelper *helper = (UpClientDevicesHelper *) user_data;
+	UpDevice *device = UP_DEVICE (source);
+
+	/* like up_client_get_devices(), just skip the ones that failed */
+	if (!up_device_set_object_path_finish (device, result, NULL)) {
+		g_ptr_array_remove (helper->array, device);
+		g_object_unref (device);
+	}
+	if (--helper->pending == 0)
+		up_client_devices_helper_complete (helper, NULL);
+}
+
+/*
+ * up_client_enumerate_devices_cb:
+ */
+static void
+up_client_enumerate_devices_cb (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+	UpClientDevicesHelper *helper = (UpClientDevicesHelper *) user_data;
+	GError *error = NULL;
+	gchar **devices = NULL;
+	UpDevice *device;
+	guint i;
+
+	if (!up_client_glue_call_enumerate_devices_finish (UP_CLIENT_GLUE (source),
+							   &devices,
+							   result,
+							   &error)) {
+		up_client_devices_helper_complete (helper, error);
+		return;
+	}
+
+	/* no devices at all */
+	if (devices[0] == NULL) {
+		up_client_devices_helper_complete (helper, NULL);
+		goto out;
+	}
+
+	/* create all the device proxies at once, keeping the daemon's order */
+	for (i = 0; devices[i] != NULL; i++) {
+		device = up_device_new ();
+		g_ptr_array_add (helper->array, device);
+		helper->pending++;
+	}
+	for (i = 0; devices[i] != NULL; i++) {
+		up_device_set_object_path_async (g_ptr_array_index (helper->array, i),
+						 devices[i],
+						 helper->cancellable,
+						 up_client_get_devices_device_cb,
+						 helper);
+	}
+out:
+	g_strfreev (devices);
+}
+
+/*
+ * up_client_get_devices_fallback:
+ */
+static void
+up_client_get_devices_fallback (UpClientDevicesHelper *helper)
+{
+	up_client_glue_call_enumerate_devices (helper->client->priv->proxy,
+					       helper->cancellable,
+					       up_client_enumerate_devices_cb,
+					       helper);
+}
+
+/*
+ * up_client_enumerate_devices_with_properties_cb:
+ */
+static void
+up_client_enumerate_devices_with_properties_cb (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+	UpClientDevicesHelper *helper = (UpClientDevicesHelper *) user_data;
+	GError *error = NULL;
+	GVariant *devices = NULL;
+	GVariantIter iter;
+	GVariant *properties;
+	UpDevice *device;
+	const gchar *object_path;
+	gchar *name = NULL;
+
+	if (!up_client_glue_call_enumerate_devices_with_properties_finish (UP_CLIENT_GLUE (source),
+									   &devices,
+									   result,
+									   &error)) {
+		if (g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD)) {
+			helper->client->priv->no_enumerate_with_properties = TRUE;
+			g_error_free (error);
+			up_client_get_devices_fallback (helper);
+			return;
+		}
+		up_client_devices_helper_complete (helper, error);
+		return;
+	}
+
+	/* the daemon may have gone away since */
+	name = g_dbus_proxy_get_name_owner (G_DBUS_PROXY (source));
+	if (name == NULL) {
+		up_client_get_devices_fallback (helper);
+		goto out;
+	}
+
+	/* none of this goes to the bus */
+	g_variant_iter_init (&iter, devices);
+	while (g_variant_iter_next (&iter, "{&o@a{sv}}", &object_path, &properties)) {
+		device = up_device_new ();
+		if (up_client_set_device_properties (helper->client, device, name, object_path, properties))
+			g_ptr_array_add (helper->array, device);
+		else
+			g_object_unref (device);
+		g_variant_unref (properties);
+	}
+	up_client_devices_helper_complete (helper, NULL);
+out:
+	g_variant_unref (devices);
+	g_free (name);
+}
+
+/**
+ * up_client_get_devices_async:
+ * @client: a #UpClient instance.
+ * @cancellable: a #GCancellable or %NULL
+ * @callback: the function to run on completion
+ * @user_data: the data to pass to @callback
+ *
+ * Gets a copy of the device objects without blocking.
+ * Call up_client_get_devices_finish() from @callback to get the result.
+ *
+ * Since: 0.99.3
+ **/
+void
+up_client_get_devices_async (UpClient *client, GCancellable *cancellable,
+			     GAsyncReadyCallback callback, gpointer user_data)
+{
+	UpClientDevicesHelper *helper;
+
+	g_return_if_fail (UP_IS_CLIENT (client));
+	g_return_if_fail (client->priv->proxy != NULL);
+
+	helper = g_new0 (UpClientDevicesHelper, 1);
+	helper->client = g_object_ref (client);
+	helper->res = g_simple_async_result_new (G_OBJECT (client), callback, user_data,
+						 up_client_get_devices_async);
+	if (cancellable != NULL)
+		helper->cancellable = g_object_ref (cancellable);
+	helper->array = g_ptr_array_new ();
+
+	/* newer daemons give us everything in one go */
+	if (client->priv->no_enumerate_with_properties) {
+		up_client_get_devices_fallback (helper);
+		return;
+	}
+	up_client_glue_call_enumerate_devices_with_properties (client->priv->proxy,
+							       cancellable,
+							       up_client_enumerate_devices_with_properties_cb,
+							       helper);
+}
+
+/**
+ * up_client_get_devices_finish:
+ * @client: a #UpClient instance.
+ * @res: the #GAsyncResult passed to the callback
+ * @error: a #GError, or %NULL.
+ *
+ * Gets the result of up_client_get_devices_async().
+ *
+ * Return value: (element-type UpDevice) (transfer full): an array of #UpDevice objects, free with g_ptr_array_unref(),
+ *               or %NULL if @error is set
+ *
+ * Since: 0.99.3
+ **/
+GPtrArray *
+up_client_get_devices_finish (UpClient *client, GAsyncResult *res, GError **error)
+{
+	GSimpleAsyncResult *simple;
+
+	g_return_val_if_fail (UP_IS_CLIENT (client), NULL);
+	g_return_val_if_fail (g_simple_async_result_is_valid (res, G_OBJECT (client),
+							      up_client_get_devices_async), NULL);
+
+	simple = G_SIMPLE_ASYNC_RESULT (res);
+	if (g_simple_async_result_propagate_error (simple, error))
+		return NULL;
+	return g_ptr_array_ref (g_simple_async_result_get_op_res_gpointer (simple));
+}
+
+/*
+ * up_client_get_display_device_cb:
+ */
+static void
+up_client_get_display_device_cb (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+	GSimpleAsyncResult *res = G_SIMPLE_ASYNC_RESULT (user_data);
+	GError *error = NULL;
+
+	if (up_device_set_object_path_finish (UP_DEVICE (source), result, &error)) {
+		g_simple_async_result_set_op_res_gpointer (res, g_object_ref (source),
+							   g_object_unref);
+	} else {
+		g_simple_async_result_take_error (res, error);
+	}
+	g_simple_async_result_complete (res);
+	g_object_unref (source);
+	g_object_unref (res);
+}
+
+/**
+ * up_client_get_display_device_async:
+ * @client: a #UpClient instance.
+ * @cancellable: a #GCancellable or %NULL
+ * @callback: the function to run on completion
+ * @user_data: the data to pass to @callback
+ *
+ * Gets the composite display device without blocking.
+ * Call up_client_get_display_device_finish() from @callback to get the result.
+ *
+ * Since: 0.99.3
+ **/
+void
+up_client_get_display_device_async (UpClient *client, GCancellable *cancellable,
+				    GAsyncReadyCallback callback, gpointer user_data)
+{
+	GSimpleAsyncResult *res;
+	UpDevice *device;
+
+	g_return_if_fail (UP_IS_CLIENT (client));
+
+	res = g_simple_async_result_new (G_OBJECT (client), callback, user_data,
+					 up_client_get_display_device_async);
+	device = up_device_new ();
+	up_device_set_object_path_async (device, "/org/freedesktop/UPower/devices/DisplayDevice",
+					 cancellable, up_client_get_display_device_cb, res);
+}
+
+/**
+ * up_client_get_display_device_finish:
+ * @client: a #UpClient instance.
+ * @res: the #GAsyncResult passed to the callback
+ * @error: a #GError, or %NULL.
+ *
+ * Gets the result of up_client_get_display_device_async().
+ *
+ * Return value: (transfer full): a #UpDevice object, or %NULL if @error is set
+ *
+ * Since: 0.99.3
+ **/
+UpDevice *
+up_client_get_display_device_finish (UpClient *client, GAsyncResult *res, GError **error)
+{
+	GSimpleAsyncResult *simple;
+
+	g_return_val_if_fail (UP_IS_CLIENT (client), NULL);
+	g_return_val_if_fail (g_simple_async_result_is_valid (res, G_OBJECT (client),
+							      up_client_get_display_device_async), NULL);
+
+	simple = G_SIMPLE_ASYNC_RESULT (res);
+	if (g_simple_async_result_propagate_error (simple, error))
+		return NULL;
+	return g_object_ref (g_simple_async_result_get_op_res_gpointer (simple));
+}
+
 /**
  * up_client_get_critical_action:
  * @client: a #UpClient instance.
@@ -174,6 +570,64 @@ up_client_get_critical_action (UpClient *client)
 	return action;
 }
 
+/**
+ * up_client_subscribe_sync:
+ * @client: a #UpClient instance.
+ * @filters: a #GVariant of type a(ssd), each a property name, a filter kind
+ *	     of "any", "delta" or "crossing", and a threshold
+ * @cancellable: a #GCancellable or %NULL
+ * @error: a #GError, or %NULL.
+ *
+ * Asks the daemon to tell this client only about the property changes
+ * that match @filters, e.g. <literal>("Percentage", "delta", 5.0)</literal>
+ * for every five percent.
+ *
+ * The devices got from up_client_get_devices(), up_client_get_devices_async()
+ * or #UpClient::device-added from then on no longer listen to the
+ * PropertiesChanged broadcast for every change, and are only updated
+ * when one of @filters matches. Devices got before keep listening to
+ * the broadcast.
+ *
+ * Return value: #TRUE for success, else #FALSE and @error is used
+ *
+ * Since: 0.99.3
+ **/
+gboolean
+up_client_subscribe_sync (UpClient *client, GVariant *filters, GCancellable *cancellable, GError **error)
+{
+	g_return_val_if_fail (UP_IS_CLIENT (client), FALSE);
+	g_return_val_if_fail (g_variant_is_of_type (filters, G_VARIANT_TYPE ("a(ssd)")), FALSE);
+
+	if (!up_client_glue_call_subscribe_sync (client->priv->proxy, filters, cancellable, error))
+		return FALSE;
+	client->priv->subscribed = TRUE;
+	return TRUE;
+}
+
+/**
+ * up_client_unsubscribe_sync:
+ * @client: a #UpClient instance.
+ * @cancellable: a #GCancellable or %NULL
+ * @error: a #GError, or %NULL.
+ *
+ * Stops the changes asked for with up_client_subscribe_sync(). Devices
+ * got while subscribed are then no longer updated, so get them again.
+ *
+ * Return value: #TRUE for success, else #FALSE and @error is used
+ *
+ * Since: 0.99.3
+ **/
+gboolean
+up_client_unsubscribe_sync (UpClient *client, GCancellable *cancellable, GError **error)
+{
+	g_return_val_if_fail (UP_IS_CLIENT (client), FALSE);
+
+	if (!up_client_glue_call_unsubscribe_sync (client->priv->proxy, cancellable, error))
+		return FALSE;
+	client->priv->subscribed = FALSE;
+	return TRUE;
+}
+
 /**
  * up_client_get_daemon_version:
  * @client: a #UpClient instance.
@@ -242,26 +696,128 @@ up_client_get_on_battery (UpClient *client)
 	return up_client_glue_get_on_battery (client->priv->proxy);
 }
 
+/*
+ * UpClientAddHelper:
+ */
+typedef struct {
+	UpClient		*client;
+	gchar			*name;
+	gchar			*object_path;
+	GCancellable		*cancellable;
+} UpClientAddHelper;
+
+/*
+ * up_client_add_helper_complete:
+ * @device: the new device, or %NULL if it could not be set up
+ *
+ * Emits ::device-added unless DeviceRemoved for the same path arrived
+ * while the device was being set up, and frees @helper.
+ */
+static void
+up_client_add_helper_complete (UpClientAddHelper *helper, UpDevice *device)
+{
+	if (!g_cancellable_is_cancelled (helper->cancellable)) {
+		g_hash_table_remove (helper->client->priv->pending_adds, helper->object_path);
+		if (device != NULL)
+			g_signal_emit (helper->client, signals [UP_CLIENT_DEVICE_ADDED], 0, device);
+	}
+
+	g_object_unref (helper->client);
+	g_object_unref (helper->cancellable);
+	g_free (helper->name);
+	g_free (helper->object_path);
+	g_free (helper);
+}
+
+/*
+ * up_client_add_cb:
+ */
+static void
+up_client_add_cb (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+	UpClientAddHelper *helper = (UpClientAddHelper *) user_data;
+	UpDevice *device = UP_DEVICE (source);
+
+	if (up_device_set_object_path_finish (device, result, NULL))
+		up_client_add_helper_complete (helper, device);
+	else
+		up_client_add_helper_complete (helper, NULL);
+	g_object_unref (device);
+}
+
+/*
+ * up_client_add_properties_cb:
+ */
+static void
+up_client_add_properties_cb (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+	UpClientAddHelper *helper = (UpClientAddHelper *) user_data;
+	UpDevice *device;
+	GVariant *reply;
+	GVariant *properties;
+
+	reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), result, NULL);
+	if (reply == NULL) {
+		up_client_add_helper_complete (helper, NULL);
+		return;
+	}
+
+	device = up_device_new ();
+	g_variant_get (reply, "(@a{sv})", &properties);
+	if (up_device_set_object_path_subscribed_sync (device, helper->name, helper->object_path,
+						       properties, NULL, NULL))
+		up_client_add_helper_complete (helper, device);
+	else
+		up_client_add_helper_complete (helper, NULL);
+	g_object_unref (device);
+	g_variant_unref (properties);
+	g_variant_unref (reply);
+}
+
 /*
  * up_client_add:
  */
 static void
 up_client_add (UpClient *client, const gchar *object_path)
 {
-	UpDevice *device = NULL;
-	gboolean ret;
+	UpClientAddHelper *helper;
+	GCancellable *cancellable;
 
-	/* create new device */
-	device = up_device_new ();
-	ret = up_device_set_object_path_sync (device, object_path, NULL, NULL);
-	if (!ret)
-		goto out;
+	/* a device that is added again before we finished with it */
+	cancellable = g_hash_table_lookup (client->priv->pending_adds, object_path);
+	if (cancellable != NULL)
+		g_cancellable_cancel (cancellable);
 
-	/* add to array */
-	g_signal_emit (client, signals [UP_CLIENT_DEVICE_ADDED], 0, device);
-out:
-	if (device != NULL)
-		g_object_unref (device);
+	helper = g_new0 (UpClientAddHelper, 1);
+	helper->client = g_object_ref (client);
+	helper->object_path = g_strdup (object_path);
+	helper->cancellable = g_cancellable_new ();
+	g_hash_table_replace (client->priv->pending_adds,
+			      g_strdup (object_path),
+			      g_object_ref (helper->cancellable));
+
+	/* a subscribed device has to be given its properties, so that it
+	 * doesn't listen to the broadcast */
+	helper->name = g_dbus_proxy_get_name_owner (G_DBUS_PROXY (client->priv->proxy));
+	if (client->priv->subscribed && helper->name != NULL) {
+		g_dbus_connection_call (g_dbus_proxy_get_connection (G_DBUS_PROXY (client->priv->proxy)),
+					helper->name,
+					object_path,
+					"org.freedesktop.DBus.Properties",
+					"GetAll",
+					g_variant_new ("(s)", "org.freedesktop.UPower.Device"),
+					G_VARIANT_TYPE ("(a{sv})"),
+					G_DBUS_CALL_FLAGS_NONE,
+					-1,
+					helper->cancellable,
+					up_client_add_properties_cb,
+					helper);
+		return;
+	}
+
+	/* create new device, without blocking the signal handler */
+	up_device_set_object_path_async (up_device_new (), object_path, helper->cancellable,
+					 up_client_add_cb, helper);
 }
 
 /*
@@ -292,6 +848,15 @@ up_device_added_cb (UpClientGlue *proxy, const gchar *object_path, UpClient *cli
 static void
 up_device_removed_cb (UpClientGlue *proxy, const gchar *object_path, UpClient *client)
 {
+	GCancellable *cancellable;
+
+	/* nobody was told about it yet, so don't tell them at all */
+	cancellable = g_hash_table_lookup (client->priv->pending_adds, object_path);
+	if (cancellable != NULL) {
+		g_cancellable_cancel (cancellable);
+		g_hash_table_remove (client->priv->pending_adds, object_path);
+		return;
+	}
 	g_signal_emit (client, signals [UP_CLIENT_DEVICE_REMOVED], 0, object_path);
 }
 
@@ -437,22 +1002,20 @@ up_client_class_init (UpClientClass *klass)
 static void
 up_client_init (UpClient *client)
 {
-	GError *error = NULL;
-
 	client->priv = UP_CLIENT_GET_PRIVATE (client);
+	client->priv->pending_adds = g_hash_table_new_full (g_str_hash, g_str_equal,
+							    g_free, g_object_unref);
+}
 
-	/* connect to main interface */
-	client->priv->proxy = up_client_glue_proxy_new_for_bus_sync (G_BUS_TYPE_SYSTEM,
-								     G_DBUS_PROXY_FLAGS_NONE,
-								     "org.freedesktop.UPower",
-								     "/org/freedesktop/UPower",
-								     NULL,
-								     &error);
-	if (client->priv->proxy == NULL) {
-		g_warning ("Couldn't connect to proxy: %s", error->message);
-		g_error_free (error);
-		return;
-	}
+/*
+ * up_client_set_proxy:
+ *
+ * Takes ownership of @proxy.
+ */
+static void
+up_client_set_proxy (UpClient *client, UpClientGlue *proxy)
+{
+	client->priv->proxy = proxy;
 
 	/* all callbacks */
 	g_signal_connect (client->priv->proxy, "device-added",
@@ -463,6 +1026,116 @@ up_client_init (UpClient *client)
 			  G_CALLBACK (up_client_notify_cb), client);
 }
 
+/*
+ * up_client_initable_init:
+ */
+static gboolean
+up_client_initable_init (GInitable *initable, GCancellable *cancellable, GError **error)
+{
+	UpClient *client = UP_CLIENT (initable);
+	UpClientGlue *proxy;
+
+	if (client->priv->proxy != NULL)
+		return TRUE;
+
+	/* connect to main interface */
+	proxy = up_client_glue_proxy_new_for_bus_sync (G_BUS_TYPE_SYSTEM,
+						       G_DBUS_PROXY_FLAGS_NONE,
+						       "org.freedesktop.UPower",
+						       "/org/freedesktop/UPower",
+						       cancellable,
+						       error);
+	if (proxy == NULL)
+		return FALSE;
+	up_client_set_proxy (client, proxy);
+	return TRUE;
+}
+
+/*
+ * up_client_initable_iface_init:
+ */
+static void
+up_client_initable_iface_init (GInitableIface *iface)
+{
+	iface->init = up_client_initable_init;
+}
+
+/*
+ * up_client_proxy_new_cb:
+ */
+static void
+up_client_proxy_new_cb (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+	GSimpleAsyncResult *res = G_SIMPLE_ASYNC_RESULT (user_data);
+	UpClientGlue *proxy;
+	UpClient *client;
+	GError *error = NULL;
+
+	proxy = up_client_glue_proxy_new_for_bus_finish (result, &error);
+	if (proxy == NULL) {
+		g_simple_async_result_take_error (res, error);
+		goto out;
+	}
+
+	/* a sync init may have beaten us to it */
+	client = UP_CLIENT (g_async_result_get_source_object (G_ASYNC_RESULT (res)));
+	if (client->priv->proxy == NULL)
+		up_client_set_proxy (client, proxy);
+	else
+		g_object_unref (proxy);
+	g_object_unref (client);
+out:
+	g_simple_async_result_complete (res);
+	g_object_unref (res);
+}
+
+/*
+ * up_client_async_initable_init_async:
+ */
+static void
+up_client_async_initable_init_async (GAsyncInitable *initable, gint io_priority, GCancellable *cancellable,
+				     GAsyncReadyCallback callback, gpointer user_data)
+{
+	UpClient *client = UP_CLIENT (initable);
+	GSimpleAsyncResult *res;
+
+	res = g_simple_async_result_new (G_OBJECT (client), callback, user_data,
+					 up_client_async_initable_init_async);
+	if (client->priv->proxy != NULL) {
+		g_simple_async_result_complete_in_idle (res);
+		g_object_unref (res);
+		return;
+	}
+
+	/* connect to main interface */
+	up_client_glue_proxy_new_for_bus (G_BUS_TYPE_SYSTEM,
+					  G_DBUS_PROXY_FLAGS_NONE,
+					  "org.freedesktop.UPower",
+					  "/org/freedesktop/UPower",
+					  cancellable,
+					  up_client_proxy_new_cb,
+					  res);
+}
+
+/*
+ * up_client_async_initable_init_finish:
+ */
+static gboolean
+up_client_async_initable_init_finish (GAsyncInitable *initable, GAsyncResult *res, GError **error)
+{
+	return !g_simple_async_result_propagate_error (G_SIMPLE_ASYNC_RESULT (res), error);
+}
+
+/*
+ * up_client_async_initable_iface_init:
+ */
+static void
+up_client_async_initable_iface_init (GAsyncInitableIface *iface)
+{
+	iface->init_async = up_client_async_initable_init_async;
+	iface->init_finish = up_client_async_initable_init_finish;
+}
+
 /*
  * up_client_finalize:
  */
@@ -477,6 +1150,7 @@ up_client_finalize (GObject *object)
 
 	if (client->priv->proxy != NULL)
 		g_object_unref (client->priv->proxy);
+	g_hash_table_unref (client->priv->pending_adds);
 
 	G_OBJECT_CLASS (up_client_parent_class)->finalize (object);
 }
@@ -493,12 +1167,100 @@ up_client_finalize (GObject *object)
 UpClient *
 up_client_new (void)
 {
+	GError *error = NULL;
+
 	if (up_client_object != NULL) {
 		g_object_ref (up_client_object);
 	} else {
 		up_client_object = g_object_new (UP_TYPE_CLIENT, NULL);
 		g_object_add_weak_pointer (up_client_object, &up_client_object);
+		if (!g_initable_init (G_INITABLE (up_client_object), NULL, &error)) {
+			g_warning ("Couldn't connect to proxy: %s", error->message);
+			g_error_free (error);
+		}
 	}
 	return UP_CLIENT (up_client_object);
 }
 
+/*
+ * up_client_new_cb:
+ */
+static void
+up_client_new_cb (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+	GSimpleAsyncResult *res = G_SIMPLE_ASYNC_RESULT (user_data);
+	GObject *client;
+	GError *error = NULL;
+
+	client = g_async_initable_new_finish (G_ASYNC_INITABLE (source), result, &error);
+	if (client == NULL) {
+		g_simple_async_result_take_error (res, error);
+		goto out;
+	}
+
+	/* keep to one instance, even if up_client_new() was called meanwhile */
+	if (up_client_object != NULL) {
+		g_object_unref (client);
+		client = g_object_ref (up_client_object);
+	} else {
+		up_client_object = client;
+		g_object_add_weak_pointer (up_client_object, &up_client_object);
+	}
+	g_simple_async_result_set_op_res_gpointer (res, client, g_object_unref);
+out:
+	g_simple_async_result_complete (res);
+	g_object_unref (res);
+}
+
+/**
+ * up_client_new_async:
+ * @cancellable: a #GCancellable or %NULL
+ * @callback: the function to run on completion
+ * @user_data: the data to pass to @callback
+ *
+ * Creates a new #UpClient object without blocking on the daemon.
+ * Call up_client_new_finish() from @callback to get the result.
+ *
+ * Since: 0.99.3
+ **/
+void
+up_client_new_async (GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+	GSimpleAsyncResult *res;
+
+	res = g_simple_async_result_new (NULL, callback, user_data, up_client_new_async);
+	if (up_client_object != NULL) {
+		g_simple_async_result_set_op_res_gpointer (res, g_object_ref (up_client_object),
+							   g_object_unref);
+		g_simple_async_result_complete_in_idle (res);
+		g_object_unref (res);
+		return;
+	}
+	g_async_initable_new_async (UP_TYPE_CLIENT, G_PRIORITY_DEFAULT, cancellable,
+				    up_client_new_cb, res, NULL);
+}
+
+/**
+ * up_client_new_finish:
+ * @res: the #GAsyncResult passed to the callback
+ * @error: a #GError, or %NULL.
+ *
+ * Gets the result of up_client_new_async().
+ *
+ * Return value: (transfer full): a #UpClient object, or %NULL if @error is set
+ *
+ * Since: 0.99.3
+ **/
+UpClient *
+up_client_new_finish (GAsyncResult *res, GError **error)
+{
+	GSimpleAsyncResult *simple;
+
+	g_return_val_if_fail (g_simple_async_result_is_valid (res, NULL, up_client_new_async), NULL);
+
+	simple = G_SIMPLE_ASYNC_RESULT (res);
+	if (g_simple_async_result_propagate_error (simple, error))
+		return NULL;
+	return g_object_ref (g_simple_async_result_get_op_res_gpointer (simple));
+}
+
@@ -73,9 +73,37 @@ typedef struct
 GType		 up_client_get_type			(void);
 UpClient	*up_client_new				(void);
 
+/* async versions */
+void		 up_client_new_async			(GCancellable		*cancellable,
+							 GAsyncReadyCallback	 callback,
+							 gpointer		 user_data);
+UpClient	*up_client_new_finish			(GAsyncResult		*res,
+							 GError			**error);
+void		 up_client_get_devices_async		(UpClient		*client,
+							 GCancellable		*cancellable,
+							 GAsyncReadyCallback	 callback,
+							 gpointer		 user_data);
+GPtrArray	*up_client_get_devices_finish		(UpClient		*client,
+							 GAsyncResult		*res,
+							 GError			**error);
+void		 up_client_get_display_device_async	(UpClient		*client,
+							 GCancellable		*cancellable,
+							 GAsyncReadyCallback	 callback,
+							 gpointer		 user_data);
+UpDevice	*up_client_get_display_device_finish	(UpClient		*client,
+							 GAsyncResult		*res,
+							 GError			**error);
+
 /* sync versions */
 UpDevice *	 up_client_get_display_device		(UpClient *client);
 char *		 up_client_get_critical_action		(UpClient *client);
+gboolean	 up_client_subscribe_sync		(UpClient		*client,
+							 GVariant		*filters,
+							 GCancellable		*cancellable,
+							 GError			**error);
+gboolean	 up_client_unsubscribe_sync		(UpClient		*client,
+							 GCancellable		*cancellable,
+							 GError			**error);
 
 /* accessors */
 GPtrArray	*up_client_get_devices			(UpClient		*client);
@@ -59,6 +59,14 @@ struct _UpDevicePrivate
 	/* For use when a UpDevice isn't backed by a D-Bus object
 	 * by the UPower daemon */
 	GHashTable		*offline_props;
+
+	/* the daemon is too old to have GetHistoryPacked */
+	gboolean		 no_history_packed;
+
+	/* PropertiesChanged or SubscribedPropertiesChanged subscription
+	 * for a proxy that was given its properties, as GDBusProxy then
+	 * doesn't listen itself */
+	guint			 properties_changed_id;
 };
 
 enum {
@@ -108,24 +116,151 @@ up_device_changed_cb (UpDeviceGlue *proxy, GParamSpec *pspec, UpDevice *device)
 		g_object_notify (G_OBJECT (device), pspec->name);
 }
 
-/**
- * up_device_set_object_path_sync:
- * @device: a #UpDevice instance.
- * @object_path: The UPower object path.
- * @cancellable: a #GCancellable or %NULL
- * @error: a #GError, or %NULL.
+/*
+ * up_device_update_properties:
  *
- * Sets the object path of the object and fills up initial properties.
+ * Updates the proxy cache and notifies just like GDBusProxy would have
+ * done had it loaded the properties itself.
+ */
+static void
+up_device_update_properties (UpDevice *device, GVariant *changed, const gchar **invalidated)
+{
+	GDBusProxy *proxy = G_DBUS_PROXY (device->priv->proxy_device);
+	GVariantIter iter;
+	const gchar *key;
+	GVariant *value;
+	guint i;
+
+	g_variant_iter_init (&iter, changed);
+	while (g_variant_iter_next (&iter, "{&sv}", &key, &value)) {
+		g_dbus_proxy_set_cached_property (proxy, key, value);
+		g_variant_unref (value);
+	}
+	for (i = 0; invalidated[i] != NULL; i++)
+		g_dbus_proxy_set_cached_property (proxy, invalidated[i], NULL);
+
+	/* the glue turns this into notify on the right properties */
+	g_signal_emit_by_name (proxy, "g-properties-changed", changed, invalidated);
+}
+
+/*
+ * up_device_properties_changed_cb:
+ */
+static void
+up_device_properties_changed_cb (GDBusConnection *connection, const gchar *sender_name,
+				 const gchar *object_path, const gchar *interface_name,
+				 const gchar *signal_name, GVariant *parameters, gpointer user_data)
+{
+	UpDevice *device = UP_DEVICE (user_data);
+	GVariant *changed;
+	const gchar **invalidated;
+
+	if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(sa{sv}as)")))
+		return;
+
+	g_variant_get (parameters, "(&s@a{sv}^a&s)", NULL, &changed, &invalidated);
+	up_device_update_properties (device, changed, invalidated);
+	g_variant_unref (changed);
+	g_free (invalidated);
+}
+
+/*
+ * up_device_subscribed_properties_changed_cb:
  *
- * Return value: #TRUE for success, else #FALSE and @error is used
+ * The daemon sends these for all the objects, from its own path.
+ */
+static void
+up_device_subscribed_properties_changed_cb (GDBusConnection *connection, const gchar *sender_name,
+					    const gchar *object_path, const gchar *interface_name,
+					    const gchar *signal_name, GVariant *parameters, gpointer user_data)
+{
+	UpDevice *device = UP_DEVICE (user_data);
+	const gchar *invalidated[] = { NULL };
+	const gchar *changed_path;
+	GVariant *changed;
+
+	if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(oa{sv})")))
+		return;
+
+	g_variant_get (parameters, "(&o@a{sv})", &changed_path, &changed);
+	if (g_strcmp0 (changed_path, up_device_get_object_path (device)) == 0)
+		up_device_update_properties (device, changed, invalidated);
+	g_variant_unref (changed);
+}
+
+/*
+ * up_device_set_proxy:
+ * @properties: the properties of the device, or %NULL if @proxy_device
+ *		loaded them itself
+ * @subscribed: if @properties is set, only listen to the changes sent
+ *		to this client after a Subscribe
  *
- * Since: 0.9.0
- **/
-gboolean
-up_device_set_object_path_sync (UpDevice *device, const gchar *object_path, GCancellable *cancellable, GError **error)
+ * Takes ownership of @proxy_device.
+ */
+static void
+up_device_set_proxy (UpDevice *device, UpDeviceGlue *proxy_device, GVariant *properties, gboolean subscribed)
+{
+	GDBusProxy *proxy = G_DBUS_PROXY (proxy_device);
+	GVariantIter iter;
+	const gchar *key;
+	GVariant *value;
+
+	g_clear_pointer (&device->priv->offline_props, g_hash_table_unref);
+
+	/* fill in what the daemon already told us, and keep it up to date */
+	if (properties != NULL) {
+		g_variant_iter_init (&iter, properties);
+		while (g_variant_iter_next (&iter, "{&sv}", &key, &value)) {
+			g_dbus_proxy_set_cached_property (proxy, key, value);
+			g_variant_unref (value);
+		}
+	}
+	if (properties != NULL && subscribed) {
+		device->priv->properties_changed_id =
+			g_dbus_connection_signal_subscribe (g_dbus_proxy_get_connection (proxy),
+							    g_dbus_proxy_get_name (proxy),
+							    "org.freedesktop.UPower",
+							    "SubscribedPropertiesChanged",
+							    "/org/freedesktop/UPower",
+							    NULL,
+							    G_DBUS_SIGNAL_FLAGS_NONE,
+							    up_device_subscribed_properties_changed_cb,
+							    device,
+							    NULL);
+	} else if (properties != NULL) {
+		device->priv->properties_changed_id =
+			g_dbus_connection_signal_subscribe (g_dbus_proxy_get_connection (proxy),
+							    g_dbus_proxy_get_name (proxy),
+							    "org.freedesktop.DBus.Properties",
+							    "PropertiesChanged",
+							    g_dbus_proxy_get_object_path (proxy),
+							    g_dbus_proxy_get_interface_name (proxy),
+							    G_DBUS_SIGNAL_FLAGS_NONE,
+							    up_device_properties_changed_cb,
+							    device,
+							    NULL);
+	}
+
+	/* listen to Changed */
+	g_signal_connect (proxy_device, "notify",
+			  G_CALLBACK (up_device_changed_cb), device);
+
+	/* yay */
+	device->priv->proxy_device = proxy_device;
+}
+
+/*
+ * up_device_set_object_path_internal:
+ * @properties: the properties of the device, or %NULL to get them
+ */
+static gboolean
+up_device_set_object_path_internal (UpDevice *device, const gchar *name, const gchar *object_path,
+				    GVariant *properties, gboolean subscribed,
+				    GCancellable *cancellable, GError **error)
 {
 	UpDeviceGlue *proxy_device;
 	gboolean ret = TRUE;
+	GDBusProxyFlags flags = G_DBUS_PROXY_FLAGS_NONE;
 
 	g_return_val_if_fail (UP_IS_DEVICE (device), FALSE);
 	g_return_val_if_fail (object_path != NULL, FALSE);
@@ -141,28 +276,191 @@ up_device_set_object_path_sync (UpDevice *device, const gchar *object_path, GCan
 		goto out;
 	}
 
-	g_clear_pointer (&device->priv->offline_props, g_hash_table_unref);
-
 	/* connect to the correct path for all the other methods */
+	if (properties != NULL)
+		flags |= G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES;
 	proxy_device = up_device_glue_proxy_new_for_bus_sync (G_BUS_TYPE_SYSTEM,
-							      G_DBUS_PROXY_FLAGS_NONE,
-							      "org.freedesktop.UPower",
+							      flags,
+							      name,
 							      object_path,
 							      cancellable,
 							      error);
 	if (proxy_device == NULL)
 		return FALSE;
 
-	/* listen to Changed */
-	g_signal_connect (proxy_device, "notify",
-			  G_CALLBACK (up_device_changed_cb), device);
-
-	/* yay */
-	device->priv->proxy_device = proxy_device;
+	up_device_set_proxy (device, proxy_device, properties, subscribed);
 out:
 	return ret;
 }
 
+/**
+ * up_device_set_object_path_sync:
+ * @device: a #UpDevice instance.
+ * @object_path: The UPower object path.
+ * @cancellable: a #GCancellable or %NULL
+ * @error: a #GError, or %NULL.
+ *
+ * Sets the object path of the object and fills up initial properties.
+ *
+ * Return value: #TRUE for success, else #FALSE and @error is used
+ *
+ * Since: 0.9.0
+ **/
+gboolean
+up_device_set_object_path_sync (UpDevice *device, const gchar *object_path, GCancellable *cancellable, GError **error)
+{
+	return up_device_set_object_path_internal (device, "org.freedesktop.UPower", object_path,
+						   NULL, FALSE, cancellable, error);
+}
+
+/**
+ * up_device_set_object_path_with_properties_sync:
+ * @device: a #UpDevice instance.
+ * @name: the unique name of the daemon on the bus
+ * @object_path: The UPower object path.
+ * @properties: a #GVariant of type a{sv} with all the device properties
+ * @cancellable: a #GCancellable or %NULL
+ * @error: a #GError, or %NULL.
+ *
+ * Sets the object path of the object, taking the initial properties
+ * from @properties, as returned by EnumerateDevicesWithProperties,
+ * rather than asking the daemon for them.
+ *
+ * Return value: #TRUE for success, else #FALSE and @error is used
+ *
+ * Since: 0.99.3
+ **/
+gboolean
+up_device_set_object_path_with_properties_sync (UpDevice *device, const gchar *name, const gchar *object_path,
+						GVariant *properties, GCancellable *cancellable, GError **error)
+{
+	g_return_val_if_fail (name != NULL, FALSE);
+	g_return_val_if_fail (properties != NULL, FALSE);
+	return up_device_set_object_path_internal (device, name, object_path,
+						   properties, FALSE, cancellable, error);
+}
+
+/**
+ * up_device_set_object_path_subscribed_sync: (skip)
+ *
+ * Like up_device_set_object_path_with_properties_sync(), but the device
+ * is only kept up to date by the SubscribedPropertiesChanged signals
+ * sent to this client, not by the broadcast PropertiesChanged.
+ */
+gboolean
+up_device_set_object_path_subscribed_sync (UpDevice *device, const gchar *name, const gchar *object_path,
+					   GVariant *properties, GCancellable *cancellable, GError **error)
+{
+	g_return_val_if_fail (name != NULL, FALSE);
+	g_return_val_if_fail (properties != NULL, FALSE);
+	return up_device_set_object_path_internal (device, name, object_path,
+						   properties, TRUE, cancellable, error);
+}
+
+/*
+ * up_device_set_object_path_cb:
+ */
+static void
+up_device_set_object_path_cb (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+	GSimpleAsyncResult *res = G_SIMPLE_ASYNC_RESULT (user_data);
+	UpDeviceGlue *proxy_device;
+	UpDevice *device;
+	GError *error = NULL;
+
+	proxy_device = up_device_glue_proxy_new_for_bus_finish (result, &error);
+	if (proxy_device == NULL) {
+		g_simple_async_result_take_error (res, error);
+		goto out;
+	}
+
+	/* somebody else got there first */
+	device = UP_DEVICE (g_async_result_get_source_object (G_ASYNC_RESULT (res)));
+	if (device->priv->proxy_device != NULL) {
+		g_simple_async_result_set_error (res, 1, 0, "Object path already set");
+		g_object_unref (proxy_device);
+	} else {
+		up_device_set_proxy (device, proxy_device, NULL, FALSE);
+	}
+	g_object_unref (device);
+out:
+	g_simple_async_result_complete (res);
+	g_object_unref (res);
+}
+
+/**
+ * up_device_set_object_path_async:
+ * @device: a #UpDevice instance.
+ * @object_path: The UPower object path.
+ * @cancellable: a #GCancellable or %NULL
+ * @callback: the function to run on completion
+ * @user_data: the data to pass to @callback
+ *
+ * Sets the object path of the object and fills up initial properties
+ * without blocking.
+ * Call up_device_set_object_path_finish() from @callback to get the result.
+ *
+ * Since: 0.99.3
+ **/
+void
+up_device_set_object_path_async (UpDevice *device, const gchar *object_path, GCancellable *cancellable,
+				 GAsyncReadyCallback callback, gpointer user_data)
+{
+	GSimpleAsyncResult *res;
+
+	g_return_if_fail (UP_IS_DEVICE (device));
+	g_return_if_fail (object_path != NULL);
+
+	res = g_simple_async_result_new (G_OBJECT (device), callback, user_data,
+					 up_device_set_object_path_async);
+
+	if (device->priv->proxy_device != NULL) {
+		g_simple_async_result_set_error (res, 1, 0, "Object path already set");
+		goto out;
+	}
+
+	/* check valid */
+	if (!g_variant_is_object_path (object_path)) {
+		g_simple_async_result_set_error (res, 1, 0,
+						 "Object path invalid: %s", object_path);
+		goto out;
+	}
+
+	up_device_glue_proxy_new_for_bus (G_BUS_TYPE_SYSTEM,
+					  G_DBUS_PROXY_FLAGS_NONE,
+					  "org.freedesktop.UPower",
+					  object_path,
+					  cancellable,
+					  up_device_set_object_path_cb,
+					  res);
+	return;
+out:
+	g_simple_async_result_complete_in_idle (res);
+	g_object_unref (res);
+}
+
+/**
+ * up_device_set_object_path_finish:
+ * @device: a #UpDevice instance.
+ * @res: the #GAsyncResult passed to the callback
+ * @error: a #GError, or %NULL.
+ *
+ * Gets the result of up_device_set_object_path_async().
+ *
+ * Return value: #TRUE for success, else #FALSE and @error is used
+ *
+ * Since: 0.99.3
+ **/
+gboolean
+up_device_set_object_path_finish (UpDevice *device, GAsyncResult *res, GError **error)
+{
+	g_return_val_if_fail (UP_IS_DEVICE (device), FALSE);
+	g_return_val_if_fail (g_simple_async_result_is_valid (res, G_OBJECT (device),
+							      up_device_set_object_path_async), FALSE);
+
+	return !g_simple_async_result_propagate_error (G_SIMPLE_ASYNC_RESULT (res), error);
+}
+
 /**
  * up_device_get_object_path:
  * @device: a #UpDevice instance.
@@ -401,6 +699,236 @@ up_device_refresh_sync (UpDevice *device, GCancellable *cancellable, GError **er
 	return up_device_glue_call_refresh_sync (device->priv->proxy_device, cancellable, error);
 }
 
+/*
+ * up_device_refresh_cb:
+ */
+static void
+up_device_refresh_cb (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+	GSimpleAsyncResult *res = G_SIMPLE_ASYNC_RESULT (user_data);
+	GError *error = NULL;
+
+	if (!up_device_glue_call_refresh_finish (UP_DEVICE_GLUE (source), result, &error))
+		g_simple_async_result_take_error (res, error);
+	g_simple_async_result_complete (res);
+	g_object_unref (res);
+}
+
+/**
+ * up_device_refresh_async:
+ * @device: a #UpDevice instance.
+ * @cancellable: a #GCancellable or %NULL
+ * @callback: the function to run on completion
+ * @user_data: the data to pass to @callback
+ *
+ * Refreshes properties on the device without blocking.
+ * Call up_device_refresh_finish() from @callback to get the result.
+ *
+ * Since: 0.99.3
+ **/
+void
+up_device_refresh_async (UpDevice *device, GCancellable *cancellable,
+			 GAsyncReadyCallback callback, gpointer user_data)
+{
+	GSimpleAsyncResult *res;
+
+	g_return_if_fail (UP_IS_DEVICE (device));
+	g_return_if_fail (device->priv->proxy_device != NULL);
+
+	res = g_simple_async_result_new (G_OBJECT (device), callback, user_data,
+					 up_device_refresh_async);
+	up_device_glue_call_refresh (device->priv->proxy_device, cancellable,
+				     up_device_refresh_cb, res);
+}
+
+/**
+ * up_device_refresh_finish:
+ * @device: a #UpDevice instance.
+ * @res: the #GAsyncResult passed to the callback
+ * @error: a #GError, or %NULL.
+ *
+ * Gets the result of up_device_refresh_async().
+ *
+ * Return value: #TRUE for success, else #FALSE and @error is used
+ *
+ * Since: 0.99.3
+ **/
+gboolean
+up_device_refresh_finish (UpDevice *device, GAsyncResult *res, GError **error)
+{
+	g_return_val_if_fail (UP_IS_DEVICE (device), FALSE);
+	g_return_val_if_fail (g_simple_async_result_is_valid (res, G_OBJECT (device),
+							      up_device_refresh_async), FALSE);
+
+	return !g_simple_async_result_propagate_error (G_SIMPLE_ASYNC_RESULT (res), error);
+}
+
+/*
+ * up_device_history_from_packed:
+ *
+ * Converts the three flat arrays returned by GetHistoryPacked.
+ */
+static GPtrArray *
+up_device_history_from_packed (GVariant *gv_times, GVariant *gv_values, GVariant *gv_states, GError **error)
+{
+	const guint32 *times;
+	const gdouble *values;
+	const guint32 *states;
+	gsize len;
+	gsize len_values;
+	gsize len_states;
+	guint i;
+	GPtrArray *array;
+	UpHistoryItem *obj;
+
+	times = g_variant_get_fixed_array (gv_times, &len, sizeof (guint32));
+	values = g_variant_get_fixed_array (gv_values, &len_values, sizeof (gdouble));
+	states = g_variant_get_fixed_array (gv_states, &len_states, sizeof (guint32));
+	if (len_values != len || len_states != len) {
+		g_set_error_literal (error, 1, 0, "history arrays differ in length");
+		return NULL;
+	}
+
+	/* convert */
+	array = g_ptr_array_new_full (len, (GDestroyNotify) g_object_unref);
+	for (i = 0; i < len; i++) {
+		obj = up_history_item_new ();
+		up_history_item_set_time (obj, times[i]);
+		up_history_item_set_value (obj, values[i]);
+		up_history_item_set_state (obj, states[i]);
+		g_ptr_array_add (array, obj);
+	}
+	return array;
+}
+
+/*
+ * up_device_history_from_variant:
+ *
+ * Converts the a(udu) returned by GetHistory.
+ */
+static GPtrArray *
+up_device_history_from_variant (GVariant *gva, GError **error)
+{
+	guint i;
+	GPtrArray *array = NULL;
+	gsize len;
+	GVariantIter *iter;
+
+	iter = g_variant_iter_new (gva);
+	len = g_variant_iter_n_children (iter);
+
+	/* no data */
+	if (len == 0) {
+		g_set_error_literal (error, 1, 0, "no data");
+		goto out;
+	}
+
+	/* convert */
+	array = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+	for (i = 0; i < len; i++) {
+		UpHistoryItem *obj;
+		GVariant *v;
+		gdouble value;
+		guint32 time, state;
+
+		v = g_variant_iter_next_value (iter);
+		g_variant_get (v, "(udu)",
+			       &time, &value, &state);
+		g_variant_unref (v);
+
+		obj = up_history_item_new ();
+		up_history_item_set_time (obj, time);
+		up_history_item_set_value (obj, value);
+		up_history_item_set_state (obj, state);
+
+		g_ptr_array_add (array, obj);
+	}
+out:
+	g_variant_iter_free (iter);
+	return array;
+}
+
+/*
+ * up_device_stats_from_variant:
+ *
+ * Converts the a(dd) returned by GetStatistics.
+ */
+static GPtrArray *
+up_device_stats_from_variant (GVariant *gva, GError **error)
+{
+	guint i;
+	GPtrArray *array = NULL;
+	gsize len;
+	GVariantIter *iter;
+
+	iter = g_variant_iter_new (gva);
+	len = g_variant_iter_n_children (iter);
+
+	/* no data */
+	if (len == 0) {
+		g_set_error_literal (error, 1, 0, "no data");
+		goto out;
+	}
+
+	/* convert */
+	array = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+	for (i = 0; i < len; i++) {
+		UpStatsItem *obj;
+		GVariant *v;
+		gdouble value, accuracy;
+
+		v = g_variant_iter_next_value (iter);
+		g_variant_get (v, "(dd)",
+			       &value, &accuracy);
+		g_variant_unref (v);
+
+		obj = up_stats_item_new ();
+		up_stats_item_set_value (obj, value);
+		up_stats_item_set_accuracy (obj, accuracy);
+
+		g_ptr_array_add (array, obj);
+	}
+out:
+	g_variant_iter_free (iter);
+	return array;
+}
+
+/*
+ * up_device_get_history_packed_sync:
+ *
+ * Gets the history as three flat arrays, which is much cheaper to
+ * unpack than one structure per point.
+ */
+static GPtrArray *
+up_device_get_history_packed_sync (UpDevice *device, const gchar *type, guint timespec, guint resolution, GCancellable *cancellable, GError **error)
+{
+	GVariant *gv_times = NULL;
+	GVariant *gv_values = NULL;
+	GVariant *gv_states = NULL;
+	GPtrArray *array = NULL;
+
+	if (!up_device_glue_call_get_history_packed_sync (device->priv->proxy_device,
+							  type,
+							  timespec,
+							  resolution,
+							  &gv_times,
+							  &gv_values,
+							  &gv_states,
+							  cancellable,
+							  error))
+		goto out;
+
+	array = up_device_history_from_packed (gv_times, gv_values, gv_states, error);
+out:
+	if (gv_times != NULL)
+		g_variant_unref (gv_times);
+	if (gv_values != NULL)
+		g_variant_unref (gv_values);
+	if (gv_states != NULL)
+		g_variant_unref (gv_states);
+	return array;
+}
+
 /**
  * up_device_get_history_sync:
  * @device: a #UpDevice instance.
@@ -422,16 +950,35 @@ GPtrArray *
 up_device_get_history_sync (UpDevice *device, const gchar *type, guint timespec, guint resolution, GCancellable *cancellable, GError **error)
 {
 	GError *error_local = NULL;
-	GVariant *gva;
-	guint i;
+	GVariant *gva = NULL;
 	GPtrArray *array = NULL;
 	gboolean ret;
-	gsize len;
-	GVariantIter *iter;
 
 	g_return_val_if_fail (UP_IS_DEVICE (device), NULL);
 	g_return_val_if_fail (device->priv->proxy_device != NULL, NULL);
 
+	/* use the packed arrays if the daemon has them */
+	if (!device->priv->no_history_packed) {
+		array = up_device_get_history_packed_sync (device, type, timespec, resolution,
+							   cancellable, &error_local);
+		if (array != NULL && array->len == 0) {
+			g_set_error_literal (error, 1, 0, "no data");
+			g_ptr_array_unref (array);
+			return NULL;
+		}
+		if (array != NULL)
+			return array;
+		if (!g_error_matches (error_local, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD)) {
+			g_set_error (error, 1, 0, "GetHistoryPacked(%s,%i) on %s failed: %s", type, timespec,
+				     up_device_get_object_path (device), error_local->message);
+			g_error_free (error_local);
+			return NULL;
+		}
+		g_debug ("falling back to GetHistory: %s", error_local->message);
+		device->priv->no_history_packed = TRUE;
+		g_clear_error (&error_local);
+	}
+
 	/* get compound data */
 	ret = up_device_glue_call_get_history_sync (device->priv->proxy_device,
 						    type,
@@ -447,42 +994,237 @@ up_device_get_history_sync (UpDevice *device, const gchar *type, guint timespec,
 		goto out;
 	}
 
-	iter = g_variant_iter_new (gva);
-	len = g_variant_iter_n_children (iter);
+	array = up_device_history_from_variant (gva, error);
+out:
+	if (gva != NULL)
+		g_variant_unref (gva);
+	return array;
+}
 
-	/* no data */
-	if (len == 0) {
-		g_set_error_literal (error, 1, 0, "no data");
-		g_variant_iter_free (iter);
-		goto out;
+/*
+ * UpDeviceQueryHelper:
+ *
+ * What an async history or statistics query needs to build its error
+ * messages and, for history, to retry with GetHistory.
+ */
+typedef struct {
+	UpDevice		*device;
+	GSimpleAsyncResult	*res;
+	GCancellable		*cancellable;
+	gchar			*type;
+	guint			 timespec;
+	guint			 resolution;
+} UpDeviceQueryHelper;
+
+/*
+ * up_device_query_helper_new:
+ */
+static UpDeviceQueryHelper *
+up_device_query_helper_new (UpDevice *device, const gchar *type, GCancellable *cancellable,
+			    GAsyncReadyCallback callback, gpointer user_data, gpointer source_tag)
+{
+	UpDeviceQueryHelper *helper;
+
+	helper = g_new0 (UpDeviceQueryHelper, 1);
+	helper->device = g_object_ref (device);
+	helper->res = g_simple_async_result_new (G_OBJECT (device), callback, user_data, source_tag);
+	if (cancellable != NULL)
+		helper->cancellable = g_object_ref (cancellable);
+	helper->type = g_strdup (type);
+	return helper;
+}
+
+/*
+ * up_device_query_helper_complete:
+ *
+ * Completes the query with either @array or @error, taking ownership
+ * of both, and frees @helper.
+ */
+static void
+up_device_query_helper_complete (UpDeviceQueryHelper *helper, GPtrArray *array, GError *error)
+{
+	if (array != NULL) {
+		g_simple_async_result_set_op_res_gpointer (helper->res, array,
+							   (GDestroyNotify) g_ptr_array_unref);
+	} else {
+		g_simple_async_result_take_error (helper->res, error);
 	}
+	g_simple_async_result_complete (helper->res);
+
+	g_object_unref (helper->res);
+	g_object_unref (helper->device);
+	if (helper->cancellable != NULL)
+		g_object_unref (helper->cancellable);
+	g_free (helper->type);
+	g_free (helper);
+}
 
-	/* convert */
-	array = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
-	for (i = 0; i < len; i++) {
-		UpHistoryItem *obj;
-		GVariant *v;
-		gdouble value;
-		guint32 time, state;
+/*
+ * up_device_query_helper_finish:
+ */
+static GPtrArray *
+up_device_query_helper_finish (UpDevice *device, GAsyncResult *res, gpointer source_tag, GError **error)
+{
+	GSimpleAsyncResult *simple;
 
-		v = g_variant_iter_next_value (iter);
-		g_variant_get (v, "(udu)",
-			       &time, &value, &state);
-		g_variant_unref (v);
+	g_return_val_if_fail (UP_IS_DEVICE (device), NULL);
+	g_return_val_if_fail (g_simple_async_result_is_valid (res, G_OBJECT (device), source_tag), NULL);
 
-		obj = up_history_item_new ();
-		up_history_item_set_time (obj, time);
-		up_history_item_set_value (obj, value);
-		up_history_item_set_state (obj, state);
+	simple = G_SIMPLE_ASYNC_RESULT (res);
+	if (g_simple_async_result_propagate_error (simple, error))
+		return NULL;
+	return g_ptr_array_ref (g_simple_async_result_get_op_res_gpointer (simple));
+}
 
-		g_ptr_array_add (array, obj);
-	}
-	g_variant_iter_free (iter);
+/*
+ * up_device_get_history_cb:
+ */
+static void
+up_device_get_history_cb (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+	UpDeviceQueryHelper *helper = (UpDeviceQueryHelper *) user_data;
+	GError *error = NULL;
+	GError *error_local = NULL;
+	GVariant *gva = NULL;
+	GPtrArray *array = NULL;
 
+	if (!up_device_glue_call_get_history_finish (UP_DEVICE_GLUE (source), &gva, result, &error_local)) {
+		error = g_error_new (1, 0, "GetHistory(%s,%i) on %s failed: %s",
+				     helper->type, helper->timespec,
+				     up_device_get_object_path (helper->device), error_local->message);
+		g_error_free (error_local);
+		goto out;
+	}
+	array = up_device_history_from_variant (gva, &error);
 out:
 	if (gva != NULL)
 		g_variant_unref (gva);
-	return array;
+	up_device_query_helper_complete (helper, array, error);
+}
+
+/*
+ * up_device_get_history_packed_cb:
+ */
+static void
+up_device_get_history_packed_cb (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+	UpDeviceQueryHelper *helper = (UpDeviceQueryHelper *) user_data;
+	GError *error = NULL;
+	GError *error_local = NULL;
+	GVariant *gv_times = NULL;
+	GVariant *gv_values = NULL;
+	GVariant *gv_states = NULL;
+	GPtrArray *array = NULL;
+
+	if (!up_device_glue_call_get_history_packed_finish (UP_DEVICE_GLUE (source),
+							    &gv_times,
+							    &gv_values,
+							    &gv_states,
+							    result,
+							    &error_local)) {
+		if (g_error_matches (error_local, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD)) {
+			g_debug ("falling back to GetHistory: %s", error_local->message);
+			helper->device->priv->no_history_packed = TRUE;
+			g_error_free (error_local);
+			up_device_glue_call_get_history (UP_DEVICE_GLUE (source),
+							 helper->type,
+							 helper->timespec,
+							 helper->resolution,
+							 helper->cancellable,
+							 up_device_get_history_cb,
+							 helper);
+			return;
+		}
+		error = g_error_new (1, 0, "GetHistoryPacked(%s,%i) on %s failed: %s",
+				     helper->type, helper->timespec,
+				     up_device_get_object_path (helper->device), error_local->message);
+		g_error_free (error_local);
+		goto out;
+	}
+
+	array = up_device_history_from_packed (gv_times, gv_values, gv_states, &error);
+	if (array != NULL && array->len == 0) {
+		g_ptr_array_unref (array);
+		array = NULL;
+		error = g_error_new_literal (1, 0, "no data");
+	}
+out:
+	if (gv_times != NULL)
+		g_variant_unref (gv_times);
+	if (gv_values != NULL)
+		g_variant_unref (gv_values);
+	if (gv_states != NULL)
+		g_variant_unref (gv_states);
+	up_device_query_helper_complete (helper, array, error);
+}
+
+/**
+ * up_device_get_history_async:
+ * @device: a #UpDevice instance.
+ * @type: The type of history, known values are "rate" and "charge".
+ * @timespec: the amount of time to look back into time.
+ * @resolution: the resolution of data.
+ * @cancellable: a #GCancellable or %NULL
+ * @callback: the function to run on completion
+ * @user_data: the data to pass to @callback
+ *
+ * Gets the device history without blocking. Several of these can be
+ * outstanding at once, for instance one per device.
+ * Call up_device_get_history_finish() from @callback to get the result.
+ *
+ * Since: 0.99.3
+ **/
+void
+up_device_get_history_async (UpDevice *device, const gchar *type, guint timespec, guint resolution,
+			     GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+	UpDeviceQueryHelper *helper;
+
+	g_return_if_fail (UP_IS_DEVICE (device));
+	g_return_if_fail (device->priv->proxy_device != NULL);
+
+	helper = up_device_query_helper_new (device, type, cancellable, callback, user_data,
+					     up_device_get_history_async);
+	helper->timespec = timespec;
+	helper->resolution = resolution;
+
+	/* use the packed arrays if the daemon has them */
+	if (!device->priv->no_history_packed) {
+		up_device_glue_call_get_history_packed (device->priv->proxy_device,
+							type,
+							timespec,
+							resolution,
+							cancellable,
+							up_device_get_history_packed_cb,
+							helper);
+		return;
+	}
+	up_device_glue_call_get_history (device->priv->proxy_device,
+					 type,
+					 timespec,
+					 resolution,
+					 cancellable,
+					 up_device_get_history_cb,
+					 helper);
+}
+
+/**
+ * up_device_get_history_finish:
+ * @device: a #UpDevice instance.
+ * @res: the #GAsyncResult passed to the callback
+ * @error: a #GError, or %NULL.
+ *
+ * Gets the result of up_device_get_history_async().
+ *
+ * Return value: (element-type UpHistoryItem) (transfer full): an array of #UpHistoryItem's, with the most
+ *               recent one being first; %NULL if @error is set
+ *
+ * Since: 0.99.3
+ **/
+GPtrArray *
+up_device_get_history_finish (UpDevice *device, GAsyncResult *res, GError **error)
+{
+	return up_device_query_helper_finish (device, res, up_device_get_history_async, error);
 }
 
 /**
@@ -502,12 +1244,9 @@ GPtrArray *
 up_device_get_statistics_sync (UpDevice *device, const gchar *type, GCancellable *cancellable, GError **error)
 {
 	GError *error_local = NULL;
-	GVariant *gva;
-	guint i;
+	GVariant *gva = NULL;
 	GPtrArray *array = NULL;
 	gboolean ret;
-	gsize len;
-	GVariantIter *iter;
 
 	g_return_val_if_fail (UP_IS_DEVICE (device), NULL);
 	g_return_val_if_fail (device->priv->proxy_device != NULL, NULL);
@@ -525,40 +1264,85 @@ up_device_get_statistics_sync (UpDevice *device, const gchar *type, GCancellable
 		goto out;
 	}
 
-	iter = g_variant_iter_new (gva);
-	len = g_variant_iter_n_children (iter);
-
-	/* no data */
-	if (len == 0) {
-		g_set_error_literal (error, 1, 0, "no data");
-		g_variant_iter_free (iter);
-		goto out;
-	}
-
-	/* convert */
-	array = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
-	for (i = 0; i < len; i++) {
-		UpStatsItem *obj;
-		GVariant *v;
-		gdouble value, accuracy;
-
-		v = g_variant_iter_next_value (iter);
-		g_variant_get (v, "(dd)",
-			       &value, &accuracy);
-		g_variant_unref (v);
+	array = up_device_stats_from_variant (gva, error);
+out:
+	if (gva != NULL)
+		g_variant_unref (gva);
+	return array;
+}
 
-		obj = up_stats_item_new ();
-		up_stats_item_set_value (obj, value);
-		up_stats_item_set_accuracy (obj, accuracy);
+/*
+ * up_device_get_statistics_cb:
+ */
+static void
+up_device_get_statistics_cb (GObject *source, GAsyncResult *result, gpointer user_data)
+{
+	UpDeviceQueryHelper *helper = (UpDeviceQueryHelper *) user_data;
+	GError *error = NULL;
+	GError *error_local = NULL;
+	GVariant *gva = NULL;
+	GPtrArray *array = NULL;
 
-		g_ptr_array_add (array, obj);
+	if (!up_device_glue_call_get_statistics_finish (UP_DEVICE_GLUE (source), &gva, result, &error_local)) {
+		error = g_error_new (1, 0, "GetStatistics(%s) on %s failed: %s", helper->type,
+				     up_device_get_object_path (helper->device), error_local->message);
+		g_error_free (error_local);
+		goto out;
 	}
-	g_variant_iter_free (iter);
-
+	array = up_device_stats_from_variant (gva, &error);
 out:
 	if (gva != NULL)
 		g_variant_unref (gva);
-	return array;
+	up_device_query_helper_complete (helper, array, error);
+}
+
+/**
+ * up_device_get_statistics_async:
+ * @device: a #UpDevice instance.
+ * @type: the type of statistics.
+ * @cancellable: a #GCancellable or %NULL
+ * @callback: the function to run on completion
+ * @user_data: the data to pass to @callback
+ *
+ * Gets the device current statistics without blocking.
+ * Call up_device_get_statistics_finish() from @callback to get the result.
+ *
+ * Since: 0.99.3
+ **/
+void
+up_device_get_statistics_async (UpDevice *device, const gchar *type, GCancellable *cancellable,
+				GAsyncReadyCallback callback, gpointer user_data)
+{
+	UpDeviceQueryHelper *helper;
+
+	g_return_if_fail (UP_IS_DEVICE (device));
+	g_return_if_fail (device->priv->proxy_device != NULL);
+
+	helper = up_device_query_helper_new (device, type, cancellable, callback, user_data,
+					     up_device_get_statistics_async);
+	up_device_glue_call_get_statistics (device->priv->proxy_device,
+					    type,
+					    cancellable,
+					    up_device_get_statistics_cb,
+					    helper);
+}
+
+/**
+ * up_device_get_statistics_finish:
+ * @device: a #UpDevice instance.
+ * @res: the #GAsyncResult passed to the callback
+ * @error: a #GError, or %NULL.
+ *
+ * Gets the result of up_device_get_statistics_async().
+ *
+ * Return value: (element-type UpStatsItem) (transfer full): an array of #UpStatsItem's, else #NULL and @error is used
+ *
+ * Since: 0.99.3
+ **/
+GPtrArray *
+up_device_get_statistics_finish (UpDevice *device, GAsyncResult *res, GError **error)
+{
+	return up_device_query_helper_finish (device, res, up_device_get_statistics_async, error);
 }
 
 /*
@@ -1194,6 +1978,10 @@ up_device_finalize (GObject *object)
 
 	device = UP_DEVICE (object);
 
+	if (device->priv->properties_changed_id != 0) {
+		g_dbus_connection_signal_unsubscribe (g_dbus_proxy_get_connection (G_DBUS_PROXY (device->priv->proxy_device)),
+						      device->priv->properties_changed_id);
+	}
 	if (device->priv->proxy_device != NULL)
 		g_object_unref (device->priv->proxy_device);
 
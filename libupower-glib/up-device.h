@@ -78,6 +78,12 @@ gboolean	 up_device_set_object_path_sync		(UpDevice		*device,
 							 const gchar		*object_path,
 							 GCancellable		*cancellable,
 							 GError			**error);
+gboolean	 up_device_set_object_path_with_properties_sync (UpDevice	*device,
+							 const gchar		*name,
+							 const gchar		*object_path,
+							 GVariant		*properties,
+							 GCancellable		*cancellable,
+							 GError			**error);
 GPtrArray	*up_device_get_history_sync		(UpDevice		*device,
 							 const gchar		*type,
 							 guint			 timespec,
@@ -89,9 +95,54 @@ GPtrArray	*up_device_get_statistics_sync		(UpDevice		*device,
 							 GCancellable		*cancellable,
 							 GError			**error);
 
+/* async versions */
+void		 up_device_refresh_async		(UpDevice		*device,
+							 GCancellable		*cancellable,
+							 GAsyncReadyCallback	 callback,
+							 gpointer		 user_data);
+gboolean	 up_device_refresh_finish		(UpDevice		*device,
+							 GAsyncResult		*res,
+							 GError			**error);
+void		 up_device_set_object_path_async	(UpDevice		*device,
+							 const gchar		*object_path,
+							 GCancellable		*cancellable,
+							 GAsyncReadyCallback	 callback,
+							 gpointer		 user_data);
+gboolean	 up_device_set_object_path_finish	(UpDevice		*device,
+							 GAsyncResult		*res,
+							 GError			**error);
+void		 up_device_get_history_async		(UpDevice		*device,
+							 const gchar		*type,
+							 guint			 timespec,
+							 guint			 resolution,
+							 GCancellable		*cancellable,
+							 GAsyncReadyCallback	 callback,
+							 gpointer		 user_data);
+GPtrArray	*up_device_get_history_finish		(UpDevice		*device,
+							 GAsyncResult		*res,
+							 GError			**error);
+void		 up_device_get_statistics_async		(UpDevice		*device,
+							 const gchar		*type,
+							 GCancellable		*cancellable,
+							 GAsyncReadyCallback	 callback,
+							 gpointer		 user_data);
+GPtrArray	*up_device_get_statistics_finish	(UpDevice		*device,
+							 GAsyncResult		*res,
+							 GError			**error);
+
 /* accessors */
 const gchar	*up_device_get_object_path		(UpDevice		*device);
 
+#ifdef UP_COMPILATION
+/* private, for UpClient */
+gboolean	 up_device_set_object_path_subscribed_sync (UpDevice	*device,
+							 const gchar		*name,
+							 const gchar		*object_path,
+							 GVariant		*properties,
+							 GCancellable		*cancellable,
+							 GError			**error);
+#endif
+
 G_END_DECLS
 
 #endif /* __UP_DEVICE_H */
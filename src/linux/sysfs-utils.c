@@ -149,3 +149,304 @@ sysfs_file_exists (const char *dir, const char *attribute)
 
 	return result;
 }
+
+#define SYSFS_ATTRS_BUFFER_SIZE		256
+#define SYSFS_ATTRS_UEVENT_SIZE		4096	/* the most sysfs gives us */
+#define SYSFS_ATTRS_UEVENT_MAX_KEYS	64
+
+struct SysfsAttrs {
+	char		*dir;
+	GHashTable	*fds;	/* attribute name -> fd + 1, or 0 for missing */
+	GRecMutex	 lock;
+
+	/* values parsed from the uevent file, between snapshot_begin()
+	 * and snapshot_end() */
+	gboolean	 in_snapshot;
+	char		 uevent[SYSFS_ATTRS_UEVENT_SIZE];
+	guint		 uevent_len;
+	const char	*uevent_keys[SYSFS_ATTRS_UEVENT_MAX_KEYS];
+	const char	*uevent_values[SYSFS_ATTRS_UEVENT_MAX_KEYS];
+};
+
+/**
+ * sysfs_attrs_new:
+ *
+ * Creates a cache of open attribute files for the sysfs directory @dir,
+ * so that polling a device only costs one pread() per attribute.
+ **/
+SysfsAttrs *
+sysfs_attrs_new (const char *dir)
+{
+	SysfsAttrs *attrs;
+
+	attrs = g_new0 (SysfsAttrs, 1);
+	attrs->dir = g_strdup (dir);
+	attrs->fds = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	g_rec_mutex_init (&attrs->lock);
+	return attrs;
+}
+
+static gboolean
+sysfs_attrs_close_cb (gpointer key, gpointer value, gpointer user_data)
+{
+	gboolean missing_only = GPOINTER_TO_INT (user_data);
+	int fd = GPOINTER_TO_INT (value) - 1;
+
+	if (fd < 0)
+		return TRUE;
+	if (missing_only)
+		return FALSE;
+	close (fd);
+	return TRUE;
+}
+
+/**
+ * sysfs_attrs_invalidate:
+ * @missing_only: only forget about the attributes that did not exist
+ *
+ * Closes the cached files, for instance when the device went away, or
+ * forgets the missing ones when the kernel told us the device changed,
+ * as attributes can appear when a battery is inserted.
+ **/
+void
+sysfs_attrs_invalidate (SysfsAttrs *attrs, gboolean missing_only)
+{
+	if (attrs == NULL)
+		return;
+	g_rec_mutex_lock (&attrs->lock);
+	g_hash_table_foreach_remove (attrs->fds, sysfs_attrs_close_cb,
+				     GINT_TO_POINTER (missing_only));
+	g_rec_mutex_unlock (&attrs->lock);
+}
+
+/**
+ * sysfs_attrs_free:
+ **/
+void
+sysfs_attrs_free (SysfsAttrs *attrs)
+{
+	if (attrs == NULL)
+		return;
+	sysfs_attrs_invalidate (attrs, FALSE);
+	g_hash_table_destroy (attrs->fds);
+	g_rec_mutex_clear (&attrs->lock);
+	g_free (attrs->dir);
+	g_free (attrs);
+}
+
+/**
+ * sysfs_attrs_get_fd:
+ *
+ * Must be called with the lock held.
+ *
+ * Return value: the cached fd, opening it if required, or -1 if missing
+ **/
+static int
+sysfs_attrs_get_fd (SysfsAttrs *attrs, const char *attribute)
+{
+	gpointer value;
+	char *filename;
+	int fd;
+
+	if (g_hash_table_lookup_extended (attrs->fds, attribute, NULL, &value))
+		return GPOINTER_TO_INT (value) - 1;
+
+	filename = g_build_filename (attrs->dir, attribute, NULL);
+	fd = open (filename, O_RDONLY | O_CLOEXEC);
+	g_free (filename);
+
+	/* only remember it is missing if it really is */
+	if (fd < 0 && errno != ENOENT)
+		return -1;
+	g_hash_table_insert (attrs->fds, g_strdup (attribute), GINT_TO_POINTER (fd + 1));
+	return fd;
+}
+
+/**
+ * sysfs_attrs_snapshot_lookup:
+ *
+ * Must be called with the lock held.
+ *
+ * Return value: the value from the uevent snapshot, or %NULL
+ **/
+static const char *
+sysfs_attrs_snapshot_lookup (SysfsAttrs *attrs, const char *attribute)
+{
+	guint i;
+
+	if (!attrs->in_snapshot)
+		return NULL;
+	for (i = 0; i < attrs->uevent_len; i++) {
+		if (g_ascii_strcasecmp (attrs->uevent_keys[i], attribute) == 0)
+			return attrs->uevent_values[i];
+	}
+	return NULL;
+}
+
+/**
+ * sysfs_attrs_snapshot_begin:
+ * @prefix: the prefix of the uevent keys, e.g. "POWER_SUPPLY_"
+ *
+ * Reads the uevent file of the device once, so that the attributes it
+ * contains are all taken from that single read until
+ * sysfs_attrs_snapshot_end() is called. For ACPI batteries, that means
+ * the embedded controller gets asked only once. Attributes missing from
+ * the uevent file are still read from their own files.
+ *
+ * Other threads using @attrs wait for the snapshot to end.
+ **/
+void
+sysfs_attrs_snapshot_begin (SysfsAttrs *attrs, const char *prefix)
+{
+	gsize prefix_len = strlen (prefix);
+	ssize_t size;
+	char *line;
+	char *next;
+	char *value;
+	int fd;
+
+	g_rec_mutex_lock (&attrs->lock);
+	attrs->in_snapshot = TRUE;
+	attrs->uevent_len = 0;
+
+	fd = sysfs_attrs_get_fd (attrs, "uevent");
+	if (fd < 0)
+		return;
+	size = pread (fd, attrs->uevent, sizeof (attrs->uevent) - 1, 0);
+	if (size < 0)
+		return;
+	attrs->uevent[size] = '\0';
+
+	/* split KEY=value lines in place */
+	for (line = attrs->uevent; line != NULL && *line != '\0'; line = next) {
+		next = strchr (line, '\n');
+		if (next != NULL)
+			*next++ = '\0';
+		if (strncmp (line, prefix, prefix_len) != 0)
+			continue;
+		value = strchr (line, '=');
+		if (value == NULL)
+			continue;
+		*value++ = '\0';
+		if (attrs->uevent_len == SYSFS_ATTRS_UEVENT_MAX_KEYS)
+			break;
+		attrs->uevent_keys[attrs->uevent_len] = line + prefix_len;
+		attrs->uevent_values[attrs->uevent_len] = value;
+		attrs->uevent_len++;
+	}
+}
+
+/**
+ * sysfs_attrs_snapshot_end:
+ **/
+void
+sysfs_attrs_snapshot_end (SysfsAttrs *attrs)
+{
+	attrs->in_snapshot = FALSE;
+	attrs->uevent_len = 0;
+	g_rec_mutex_unlock (&attrs->lock);
+}
+
+/**
+ * sysfs_attrs_read:
+ *
+ * Reads the attribute into @buf, which is always NUL terminated.
+ *
+ * Return value: %TRUE if the attribute could be read
+ **/
+static gboolean
+sysfs_attrs_read (SysfsAttrs *attrs, const char *attribute, char *buf, gsize len)
+{
+	gboolean ret = FALSE;
+	const char *value;
+	ssize_t size;
+	int fd;
+
+	g_rec_mutex_lock (&attrs->lock);
+	value = sysfs_attrs_snapshot_lookup (attrs, attribute);
+	if (value != NULL) {
+		g_strlcpy (buf, value, len);
+		ret = TRUE;
+		goto out;
+	}
+	fd = sysfs_attrs_get_fd (attrs, attribute);
+	if (fd < 0)
+		goto out;
+
+	/* sysfs regenerates the value for every read at offset 0 */
+	size = pread (fd, buf, len - 1, 0);
+	if (size < 0) {
+		/* the attribute may have gone away, try again next time */
+		close (fd);
+		g_hash_table_remove (attrs->fds, attribute);
+		goto out;
+	}
+	buf[size] = '\0';
+	ret = TRUE;
+out:
+	g_rec_mutex_unlock (&attrs->lock);
+	return ret;
+}
+
+double
+sysfs_attrs_get_double_with_error (SysfsAttrs *attrs, const char *attribute)
+{
+	char buf[SYSFS_ATTRS_BUFFER_SIZE];
+
+	if (!sysfs_attrs_read (attrs, attribute, buf, sizeof (buf)))
+		return -1.0;
+	return g_ascii_strtod (buf, NULL);
+}
+
+double
+sysfs_attrs_get_double (SysfsAttrs *attrs, const char *attribute)
+{
+	char buf[SYSFS_ATTRS_BUFFER_SIZE];
+
+	if (!sysfs_attrs_read (attrs, attribute, buf, sizeof (buf)))
+		return 0.0;
+	return g_ascii_strtod (buf, NULL);
+}
+
+char *
+sysfs_attrs_get_string (SysfsAttrs *attrs, const char *attribute)
+{
+	char buf[SYSFS_ATTRS_BUFFER_SIZE];
+
+	if (!sysfs_attrs_read (attrs, attribute, buf, sizeof (buf)))
+		return g_strdup ("");
+	return g_strdup (buf);
+}
+
+int
+sysfs_attrs_get_int (SysfsAttrs *attrs, const char *attribute)
+{
+	char buf[SYSFS_ATTRS_BUFFER_SIZE];
+
+	if (!sysfs_attrs_read (attrs, attribute, buf, sizeof (buf)))
+		return 0;
+	return atoi (buf);
+}
+
+gboolean
+sysfs_attrs_get_bool (SysfsAttrs *attrs, const char *attribute)
+{
+	char buf[SYSFS_ATTRS_BUFFER_SIZE];
+
+	if (!sysfs_attrs_read (attrs, attribute, buf, sizeof (buf)))
+		return FALSE;
+	g_strdelimit (buf, "\n", '\0');
+	return (g_strcmp0 (buf, "1") == 0);
+}
+
+gboolean
+sysfs_attrs_file_exists (SysfsAttrs *attrs, const char *attribute)
+{
+	gboolean ret;
+
+	g_rec_mutex_lock (&attrs->lock);
+	ret = sysfs_attrs_snapshot_lookup (attrs, attribute) != NULL ||
+	      sysfs_attrs_get_fd (attrs, attribute) >= 0;
+	g_rec_mutex_unlock (&attrs->lock);
+	return ret;
+}
@@ -30,4 +30,18 @@ gboolean  sysfs_get_bool      (const char *dir, const char *attribute);
 gboolean  sysfs_file_exists   (const char *dir, const char *attribute);
 double    sysfs_get_double_with_error (const char *dir, const char *attribute);
 
+typedef struct SysfsAttrs SysfsAttrs;
+
+SysfsAttrs *sysfs_attrs_new        (const char *dir);
+void      sysfs_attrs_free         (SysfsAttrs *attrs);
+void      sysfs_attrs_invalidate   (SysfsAttrs *attrs, gboolean missing_only);
+void      sysfs_attrs_snapshot_begin (SysfsAttrs *attrs, const char *prefix);
+void      sysfs_attrs_snapshot_end (SysfsAttrs *attrs);
+double    sysfs_attrs_get_double   (SysfsAttrs *attrs, const char *attribute);
+char     *sysfs_attrs_get_string   (SysfsAttrs *attrs, const char *attribute);
+int       sysfs_attrs_get_int      (SysfsAttrs *attrs, const char *attribute);
+gboolean  sysfs_attrs_get_bool     (SysfsAttrs *attrs, const char *attribute);
+gboolean  sysfs_attrs_file_exists  (SysfsAttrs *attrs, const char *attribute);
+double    sysfs_attrs_get_double_with_error (SysfsAttrs *attrs, const char *attribute);
+
 #endif /* __SYSFS_UTILS_H__ */
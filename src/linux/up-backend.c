@@ -183,6 +183,19 @@ out:
 	return device;
 }
 
+/**
+ * up_backend_device_refreshed_cb:
+ **/
+static void
+up_backend_device_refreshed_cb (UpDevice *device, gboolean ret, gpointer user_data)
+{
+	if (!ret)
+		g_debug ("no changes on %s", up_device_get_object_path (device));
+
+	/* let the poll scheduler know the driver sends events */
+	up_daemon_poll_uevent (G_OBJECT (device));
+}
+
 /**
  * up_backend_device_changed:
  **/
@@ -191,7 +204,6 @@ up_backend_device_changed (UpBackend *backend, GUdevDevice *native)
 {
 	GObject *object;
 	UpDevice *device;
-	gboolean ret;
 
 	/* first, check the device and add it if it doesn't exist */
 	object = up_device_list_lookup (backend->priv->device_list, G_OBJECT (native));
@@ -201,13 +213,13 @@ up_backend_device_changed (UpBackend *backend, GUdevDevice *native)
 		goto out;
 	}
 
-	/* need to refresh device */
+	/* need to refresh device, in the same queue as the polls so that
+	 * an older read can't be applied over this one */
 	device = UP_DEVICE (object);
-	ret = up_device_refresh_internal (device);
-	if (!ret) {
-		g_debug ("no changes on %s", up_device_get_object_path (device));
-		goto out;
-	}
+	if (UP_IS_DEVICE_SUPPLY (device))
+		up_device_supply_native_changed (UP_DEVICE_SUPPLY (device));
+	up_daemon_poll_uevent_queued (object);
+	up_device_refresh_async (device, up_backend_device_refreshed_cb, NULL);
 out:
 	if (object != NULL)
 		g_object_unref (object);
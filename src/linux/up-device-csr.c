@@ -210,23 +210,29 @@ out:
 	return ret;
 }
 
+typedef struct {
+	gboolean		 ok;
+	gint			 raw_value;
+} UpDeviceCsrValues;
+
 /**
- * up_device_csr_refresh:
+ * up_device_csr_refresh_read:
  *
- * Return %TRUE on success, %FALSE if we failed to refresh or no data
+ * Asks the receiver for the charge over USB, which can take up to the
+ * transfer timeout. This is run in a refresh thread when polling.
  **/
-static gboolean
-up_device_csr_refresh (UpDevice *device)
+static gpointer
+up_device_csr_refresh_read (UpDevice *device)
 {
-	gboolean ret = FALSE;
-	GTimeVal timeval;
 	UpDeviceCsr *csr = UP_DEVICE_CSR (device);
+	UpDeviceCsrValues *values;
 	libusb_device_handle *handle = NULL;
 	guint8 buf[80];
 	guint addr;
-	gdouble percentage;
 	gint retval;
 
+	values = g_new0 (UpDeviceCsrValues, 1);
+
 	/* ensure we still have a device */
 	if (csr->priv->device == NULL) {
 		g_warning ("no device!");
@@ -266,7 +272,33 @@ up_device_csr_refresh (UpDevice *device)
 	}
 
 	/* get battery status */
-	csr->priv->raw_value = buf[CSR_P5] & 0x07;
+	values->raw_value = buf[CSR_P5] & 0x07;
+	values->ok = TRUE;
+out:
+	if (handle != NULL)
+		libusb_close (handle);
+	return values;
+}
+
+/**
+ * up_device_csr_refresh_apply:
+ *
+ * Return %TRUE on success, %FALSE if we failed to refresh or no data
+ **/
+static gboolean
+up_device_csr_refresh_apply (UpDevice *device, gpointer user_data)
+{
+	gboolean ret = FALSE;
+	GTimeVal timeval;
+	UpDeviceCsr *csr = UP_DEVICE_CSR (device);
+	UpDeviceCsrValues *values = user_data;
+	gdouble percentage;
+
+	if (!values->ok)
+		goto out;
+
+	/* get battery status */
+	csr->priv->raw_value = values->raw_value;
 	g_debug ("charge level: %d", csr->priv->raw_value);
 	if (csr->priv->raw_value != 0) {
 		percentage = (100.0 / 7.0) * csr->priv->raw_value;
@@ -281,11 +313,21 @@ up_device_csr_refresh (UpDevice *device)
 	/* success */
 	ret = TRUE;
 out:
-	if (handle != NULL)
-		libusb_close (handle);
+	g_free (values);
 	return ret;
 }
 
+/**
+ * up_device_csr_refresh:
+ *
+ * Return %TRUE on success, %FALSE if we failed to refresh or no data
+ **/
+static gboolean
+up_device_csr_refresh (UpDevice *device)
+{
+	return up_device_csr_refresh_apply (device, up_device_csr_refresh_read (device));
+}
+
 /**
  * up_device_csr_init:
  **/
@@ -334,6 +376,8 @@ up_device_csr_class_init (UpDeviceCsrClass *klass)
 	object_class->finalize = up_device_csr_finalize;
 	device_class->coldplug = up_device_csr_coldplug;
 	device_class->refresh = up_device_csr_refresh;
+	device_class->refresh_read = up_device_csr_refresh_read;
+	device_class->refresh_apply = up_device_csr_refresh_apply;
 
 	g_type_class_add_private (klass, sizeof (UpDeviceCsrPrivate));
 }
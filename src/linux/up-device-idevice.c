@@ -145,22 +145,27 @@ out:
 	return FALSE;
 }
 
+typedef struct {
+	gboolean		 ok;
+	guint64			 percentage;
+	guint8			 charging;
+} UpDeviceIdeviceValues;
+
 /**
- * up_device_idevice_refresh:
+ * up_device_idevice_refresh_read:
  *
- * Return %TRUE on success, %FALSE if we failed to refresh or no data
+ * Asks lockdownd on the device for the battery status, which goes over
+ * USB. This is run in a refresh thread when polling.
  **/
-static gboolean
-up_device_idevice_refresh (UpDevice *device)
+static gpointer
+up_device_idevice_refresh_read (UpDevice *device)
 {
-	GTimeVal timeval;
 	UpDeviceIdevice *idevice = UP_DEVICE_IDEVICE (device);
+	UpDeviceIdeviceValues *values;
 	lockdownd_client_t client = NULL;
 	plist_t dict, node;
-	guint64 percentage;
-	guint8 charging;
-	UpDeviceState state;
-	gboolean retval = FALSE;
+
+	values = g_new0 (UpDeviceIdeviceValues, 1);
 
 	/* Open a lockdown port, or re-use the one we have */
 	if (idevice->priv->client == NULL) {
@@ -175,20 +180,46 @@ up_device_idevice_refresh (UpDevice *device)
 
 	/* get battery status */
 	node = plist_dict_get_item (dict, "BatteryCurrentCapacity");
-	plist_get_uint_val (node, &percentage);
-
-	g_object_set (device, "percentage", (double) percentage, NULL);
-	g_debug ("percentage=%"G_GUINT64_FORMAT, percentage);
+	plist_get_uint_val (node, &values->percentage);
 
 	/* get charging status */
 	node = plist_dict_get_item (dict, "BatteryIsCharging");
-	plist_get_bool_val (node, &charging);
+	plist_get_bool_val (node, &values->charging);
+
+	plist_free (dict);
+	values->ok = TRUE;
+out:
+	/* Only free it if we opened it */
+	if (idevice->priv->client == NULL && client != NULL)
+		lockdownd_client_free (client);
+
+	return values;
+}
+
+/**
+ * up_device_idevice_refresh_apply:
+ *
+ * Return %TRUE on success, %FALSE if we failed to refresh or no data
+ **/
+static gboolean
+up_device_idevice_refresh_apply (UpDevice *device, gpointer user_data)
+{
+	GTimeVal timeval;
+	UpDeviceIdeviceValues *values = user_data;
+	UpDeviceState state;
+	gboolean retval = FALSE;
+
+	if (!values->ok)
+		goto out;
 
-	if (percentage == 100)
+	g_object_set (device, "percentage", (double) values->percentage, NULL);
+	g_debug ("percentage=%"G_GUINT64_FORMAT, values->percentage);
+
+	if (values->percentage == 100)
 		state = UP_DEVICE_STATE_FULLY_CHARGED;
-	else if (percentage == 0)
+	else if (values->percentage == 0)
 		state = UP_DEVICE_STATE_EMPTY;
-	else if (charging)
+	else if (values->charging)
 		state = UP_DEVICE_STATE_CHARGING;
 	else
 		state = UP_DEVICE_STATE_DISCHARGING; /* upower doesn't have a "not charging" state */
@@ -198,22 +229,27 @@ up_device_idevice_refresh (UpDevice *device)
 		      NULL);
 	g_debug ("state=%s", up_device_state_to_string (state));
 
-	plist_free (dict);
-
 	/* reset time */
 	g_get_current_time (&timeval);
 	g_object_set (device, "update-time", (guint64) timeval.tv_sec, NULL);
 
 	retval = TRUE;
-
 out:
-	/* Only free it if we opened it */
-	if (idevice->priv->client == NULL && client != NULL)
-		lockdownd_client_free (client);
-
+	g_free (values);
 	return retval;
 }
 
+/**
+ * up_device_idevice_refresh:
+ *
+ * Return %TRUE on success, %FALSE if we failed to refresh or no data
+ **/
+static gboolean
+up_device_idevice_refresh (UpDevice *device)
+{
+	return up_device_idevice_refresh_apply (device, up_device_idevice_refresh_read (device));
+}
+
 /**
  * up_device_idevice_init:
  **/
@@ -257,6 +293,8 @@ up_device_idevice_class_init (UpDeviceIdeviceClass *klass)
 	object_class->finalize = up_device_idevice_finalize;
 	device_class->coldplug = up_device_idevice_coldplug;
 	device_class->refresh = up_device_idevice_refresh;
+	device_class->refresh_read = up_device_idevice_refresh_read;
+	device_class->refresh_apply = up_device_idevice_refresh_apply;
 
 	g_type_class_add_private (klass, sizeof (UpDeviceIdevicePrivate));
 }
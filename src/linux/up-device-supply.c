@@ -43,17 +43,32 @@
 #define UP_DEVICE_SUPPLY_UNKNOWN_RETRIES	5
 #define UP_DEVICE_SUPPLY_CHARGED_THRESHOLD	90.0f	/* % */
 
-#define UP_DEVICE_SUPPLY_COLDPLUG_UNITS_CHARGE		TRUE
-#define UP_DEVICE_SUPPLY_COLDPLUG_UNITS_ENERGY		FALSE
-
 /* number of old energy values to keep cached */
 #define UP_DEVICE_SUPPLY_ENERGY_OLD_LENGTH		4
 
+/* which attributes a battery has, worked out once rather than probing
+ * for them on every refresh */
+typedef struct {
+	gint			 generation;	/* -1 if never resolved */
+	gboolean		 has_present;
+	gboolean		 has_capacity;
+	gboolean		 has_temp;
+	const gchar		*energy;	/* energy_now, energy_avg, charge_now, ... */
+	const gchar		*energy_full;
+	const gchar		*energy_full_design;
+	const gchar		*rate;		/* power_now or current_now */
+	const gchar		*voltage;	/* voltage_now or voltage_avg */
+	gboolean		 energy_is_charge;
+	gboolean		 full_is_charge;
+	gboolean		 rate_is_current;
+	gdouble			 voltage_design;
+	gboolean		 voltage_design_guessed;
+} UpDeviceSupplyPlan;
+
 struct UpDeviceSupplyPrivate
 {
 	guint			 poll_timer_id;
 	gboolean		 has_coldplug_values;
-	gboolean		 coldplug_units;
 	gdouble			*energy_old;
 	GTimeVal		*energy_old_timespec;
 	guint			 energy_old_first;
@@ -62,8 +77,33 @@ struct UpDeviceSupplyPrivate
 	gboolean		 disable_battery_poll; /* from configuration */
 	gboolean		 is_power_supply;
 	gboolean		 shown_invalid_voltage_warning;
+	UpDeviceKind		 type;
+	SysfsAttrs		*attrs;
+	UpDeviceSupplyPlan	 plan;
+	gint			 plan_generation;
 };
 
+/* what the refresh read from sysfs, converted to W, Wh and V */
+typedef struct {
+	gboolean		 is_present;
+	gboolean		 online;
+	gboolean		 has_static;
+	gchar			*technology;
+	gchar			*manufacturer;
+	gchar			*model_name;
+	gchar			*serial_number;
+	gboolean		 voltage_design_guessed;
+	UpDeviceState		 state;
+	gdouble			 energy;
+	gdouble			 energy_full;
+	gdouble			 energy_full_design;
+	gdouble			 energy_rate;
+	gdouble			 voltage;
+	gboolean		 has_capacity;
+	gdouble			 capacity;
+	gdouble			 temp;
+} UpDeviceSupplyValues;
+
 G_DEFINE_TYPE (UpDeviceSupply, up_device_supply, UP_TYPE_DEVICE)
 #define UP_DEVICE_SUPPLY_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), UP_TYPE_DEVICE_SUPPLY, UpDeviceSupplyPrivate))
 
@@ -75,11 +115,10 @@ static gboolean		 up_device_supply_refresh	 	(UpDevice *device);
  * Return %TRUE on success, %FALSE if we failed to refresh or no data
  **/
 static gboolean
-up_device_supply_refresh_line_power (UpDeviceSupply *supply)
+up_device_supply_refresh_line_power (UpDeviceSupply		*supply,
+				     UpDeviceSupplyValues	*values)
 {
 	UpDevice *device = UP_DEVICE (supply);
-	GUdevDevice *native;
-	const gchar *native_path;
 
 	/* is providing power to computer? */
 	g_object_set (device,
@@ -87,9 +126,7 @@ up_device_supply_refresh_line_power (UpDeviceSupply *supply)
 		      NULL);
 
 	/* get new AC value */
-	native = G_UDEV_DEVICE (up_device_get_native (device));
-	native_path = g_udev_device_get_sysfs_path (native);
-	g_object_set (device, "online", sysfs_get_int (native_path, "online"), NULL);
+	g_object_set (device, "online", values->online, NULL);
 
 	return TRUE;
 }
@@ -104,7 +141,10 @@ up_device_supply_reset_values (UpDeviceSupply *supply)
 	guint i;
 
 	supply->priv->has_coldplug_values = FALSE;
-	supply->priv->coldplug_units = UP_DEVICE_SUPPLY_COLDPLUG_UNITS_ENERGY;
+	g_atomic_int_inc (&supply->priv->plan_generation);
+
+	/* the battery may have been swapped */
+	sysfs_attrs_invalidate (supply->priv->attrs, FALSE);
 	supply->priv->rate_old = 0;
 
 	for (i = 0; i < UP_DEVICE_SUPPLY_ENERGY_OLD_LENGTH; ++i) {
@@ -319,12 +359,12 @@ up_device_supply_convert_device_technology (const gchar *type)
  * up_device_supply_get_string:
  **/
 static gchar *
-up_device_supply_get_string (const gchar *native_path, const gchar *key)
+up_device_supply_get_string (SysfsAttrs *attrs, const gchar *key)
 {
 	gchar *value;
 
 	/* get value, and strip to remove spaces */
-	value = g_strstrip (sysfs_get_string (native_path, key));
+	value = g_strstrip (sysfs_attrs_get_string (attrs, key));
 
 	/* no value */
 	if (value == NULL)
@@ -342,58 +382,52 @@ out:
 
 /**
  * up_device_supply_get_design_voltage:
+ *
+ * Return value: the voltage, or 0 if we could not find any
  **/
 static gdouble
-up_device_supply_get_design_voltage (UpDeviceSupply *device, const gchar *native_path)
+up_device_supply_get_design_voltage (SysfsAttrs *attrs)
 {
 	gdouble voltage;
 	gchar *device_type = NULL;
 
 	/* design maximum */
-	voltage = sysfs_get_double (native_path, "voltage_max_design") / 1000000.0;
+	voltage = sysfs_attrs_get_double (attrs, "voltage_max_design") / 1000000.0;
 	if (voltage > 1.00f) {
 		g_debug ("using max design voltage");
 		goto out;
 	}
 
 	/* design minimum */
-	voltage = sysfs_get_double (native_path, "voltage_min_design") / 1000000.0;
+	voltage = sysfs_attrs_get_double (attrs, "voltage_min_design") / 1000000.0;
 	if (voltage > 1.00f) {
 		g_debug ("using min design voltage");
 		goto out;
 	}
 
 	/* current voltage */
-	voltage = sysfs_get_double (native_path, "voltage_present") / 1000000.0;
+	voltage = sysfs_attrs_get_double (attrs, "voltage_present") / 1000000.0;
 	if (voltage > 1.00f) {
 		g_debug ("using present voltage");
 		goto out;
 	}
 
 	/* current voltage, alternate form */
-	voltage = sysfs_get_double (native_path, "voltage_now") / 1000000.0;
+	voltage = sysfs_attrs_get_double (attrs, "voltage_now") / 1000000.0;
 	if (voltage > 1.00f) {
 		g_debug ("using present voltage (alternate)");
 		goto out;
 	}
 
 	/* is this a USB device? */
-	device_type = up_device_supply_get_string (native_path, "type");
+	device_type = up_device_supply_get_string (attrs, "type");
 	if (device_type != NULL && g_ascii_strcasecmp (device_type, "USB") == 0) {
 		g_debug ("USB device, so assuming 5v");
 		voltage = 5.0f;
 		goto out;
 	}
 
-	/* no valid value found; display a warning the first time for each
-	 * device */
-	if (!device->priv->shown_invalid_voltage_warning) {
-		device->priv->shown_invalid_voltage_warning = TRUE;
-		g_warning ("no valid voltage value found for device %s, assuming 10V", native_path);
-	}
-	/* completely guess, to avoid getting zero values */
-	g_debug ("no voltage values for device %s, using 10V as approximation", native_path);
-	voltage = 10.0f;
+	voltage = 0.0f;
 out:
 	g_free (device_type);
 	return voltage;
@@ -431,27 +465,13 @@ up_device_supply_make_safe_string (gchar *text)
 	text[idx] = '\0';
 }
 
-static gboolean
-up_device_supply_units_changed (UpDeviceSupply *supply, const gchar *native_path)
-{
-	if (supply->priv->coldplug_units == UP_DEVICE_SUPPLY_COLDPLUG_UNITS_CHARGE)
-		if (sysfs_file_exists (native_path, "charge_now") ||
-		    sysfs_file_exists (native_path, "charge_avg"))
-			return FALSE;
-	if (supply->priv->coldplug_units == UP_DEVICE_SUPPLY_COLDPLUG_UNITS_ENERGY)
-		if (sysfs_file_exists (native_path, "energy_now") ||
-		    sysfs_file_exists (native_path, "energy_avg"))
-			return FALSE;
-	return TRUE;
-}
-
 static UpDeviceState
-up_device_supply_get_state (const gchar *native_path)
+up_device_supply_get_state (SysfsAttrs *attrs)
 {
 	UpDeviceState state;
 	gchar *status;
 
-	status = up_device_supply_get_string (native_path, "status");
+	status = up_device_supply_get_string (attrs, "status");
 	if (status == NULL ||
 	    g_ascii_strcasecmp (status, "unknown") == 0 ||
 	    *status == '\0') {
@@ -476,24 +496,168 @@ up_device_supply_get_state (const gchar *native_path)
 	return state;
 }
 
+/**
+ * up_device_supply_first_attr:
+ *
+ * Return value: the first of the %NULL terminated @names that exists, or %NULL
+ **/
+static const gchar *
+up_device_supply_first_attr (SysfsAttrs *attrs, const gchar * const *names)
+{
+	guint i;
+
+	for (i = 0; names[i] != NULL; i++) {
+		if (sysfs_attrs_file_exists (attrs, names[i]))
+			return names[i];
+	}
+	return NULL;
+}
+
+/**
+ * up_device_supply_resolve_plan:
+ *
+ * Works out which of the alternative attributes the battery has, and in
+ * which units, so that refreshing only reads what is there.
+ **/
+static void
+up_device_supply_resolve_plan (UpDeviceSupplyPlan *plan, SysfsAttrs *attrs)
+{
+	static const gchar * const energy_names[] = { "energy_now", "energy_avg",
+						      "charge_now", "charge_avg", NULL };
+	static const gchar * const rate_names[] = { "power_now", "current_now", NULL };
+	static const gchar * const voltage_names[] = { "voltage_now", "voltage_avg", NULL };
+
+	plan->has_present = sysfs_attrs_file_exists (attrs, "present");
+	plan->has_capacity = sysfs_attrs_file_exists (attrs, "capacity");
+	plan->has_temp = sysfs_attrs_file_exists (attrs, "temp");
+
+	plan->energy = up_device_supply_first_attr (attrs, energy_names);
+	plan->energy_is_charge = plan->energy != NULL &&
+				 g_str_has_prefix (plan->energy, "charge_");
+
+	if (sysfs_attrs_file_exists (attrs, "energy_full")) {
+		plan->energy_full = "energy_full";
+		plan->energy_full_design = "energy_full_design";
+		plan->full_is_charge = FALSE;
+	} else {
+		plan->energy_full = "charge_full";
+		plan->energy_full_design = "charge_full_design";
+		plan->full_is_charge = TRUE;
+	}
+
+	/* If charge_full exists, then current_now is always reported in uA.
+	 * In the legacy case, where energy only units exist, and power_now
+	 * isn't present current_now is power in uW. */
+	plan->rate = up_device_supply_first_attr (attrs, rate_names);
+	plan->rate_is_current = g_strcmp0 (plan->rate, "current_now") == 0 &&
+				(sysfs_attrs_file_exists (attrs, "charge_full") ||
+				 sysfs_attrs_file_exists (attrs, "charge_full_design"));
+
+	plan->voltage = up_device_supply_first_attr (attrs, voltage_names);
+
+	/* used to convert A to W later */
+	plan->voltage_design = up_device_supply_get_design_voltage (attrs);
+	plan->voltage_design_guessed = (plan->voltage_design < 1.00f);
+	if (plan->voltage_design_guessed)
+		plan->voltage_design = 10.0f;
+
+	g_debug ("read plan: energy from %s, rate from %s, voltage from %s",
+		 plan->energy, plan->rate, plan->voltage);
+}
+
+/**
+ * up_device_supply_read_battery:
+ *
+ * Reads everything up_device_supply_refresh_battery() needs. This may be
+ * run in a refresh thread, so must not touch the device object.
+ **/
+static void
+up_device_supply_read_battery (UpDeviceSupply		*supply,
+			       SysfsAttrs		*attrs,
+			       UpDeviceSupplyValues	*values)
+{
+	UpDeviceSupplyPlan *plan = &supply->priv->plan;
+	gboolean was_charge = plan->energy_is_charge;
+	gboolean need_static = !supply->priv->has_coldplug_values;
+	gint generation;
+
+	/* only probe the attributes again when the kernel told us something
+	 * changed, as a battery being inserted can add some */
+	generation = g_atomic_int_get (&supply->priv->plan_generation);
+	if (plan->generation != generation) {
+		gboolean resolved = (plan->generation >= 0);
+
+		up_device_supply_resolve_plan (plan, attrs);
+		plan->generation = generation;
+		if (resolved && was_charge != plan->energy_is_charge)
+			need_static = TRUE;
+	}
+
+	/* have we just been removed? */
+	if (plan->has_present) {
+		values->is_present = sysfs_attrs_get_bool (attrs, "present");
+	} else {
+		/* when no present property exists, handle as present */
+		values->is_present = TRUE;
+	}
+	if (!values->is_present)
+		return;
+
+	/* these don't change at runtime, so only read them at coldplug,
+	 * or when the units changed */
+	if (need_static) {
+		values->has_static = TRUE;
+		values->technology = up_device_supply_get_string (attrs, "technology");
+		values->manufacturer = up_device_supply_get_string (attrs, "manufacturer");
+		values->model_name = up_device_supply_get_string (attrs, "model_name");
+		values->serial_number = up_device_supply_get_string (attrs, "serial_number");
+		values->energy_full = sysfs_attrs_get_double (attrs, plan->energy_full) / 1000000.0;
+		values->energy_full_design = sysfs_attrs_get_double (attrs, plan->energy_full_design) / 1000000.0;
+		if (plan->full_is_charge) {
+			values->energy_full *= plan->voltage_design;
+			values->energy_full_design *= plan->voltage_design;
+		}
+	}
+
+	values->voltage_design_guessed = plan->voltage_design_guessed;
+	values->state = up_device_supply_get_state (attrs);
+
+	if (plan->energy != NULL) {
+		values->energy = sysfs_attrs_get_double (attrs, plan->energy) / 1000000.0;
+		if (plan->energy_is_charge)
+			values->energy *= plan->voltage_design;
+	}
+	if (plan->rate != NULL) {
+		values->energy_rate = fabs (sysfs_attrs_get_double (attrs, plan->rate) / 1000000.0);
+		if (plan->rate_is_current)
+			values->energy_rate *= plan->voltage_design;
+	}
+	if (plan->voltage != NULL)
+		values->voltage = sysfs_attrs_get_double (attrs, plan->voltage) / 1000000.0;
+
+	values->has_capacity = plan->has_capacity;
+	if (values->has_capacity)
+		values->capacity = sysfs_attrs_get_double (attrs, "capacity");
+	if (plan->has_temp)
+		values->temp = sysfs_attrs_get_double (attrs, "temp") / 10.0;
+}
+
 /**
  * up_device_supply_refresh_battery:
  *
  * Return %TRUE on success, %FALSE if we failed to refresh or no data
  **/
 static gboolean
-up_device_supply_refresh_battery (UpDeviceSupply *supply,
-				  UpDeviceState  *out_state)
+up_device_supply_refresh_battery (UpDeviceSupply	*supply,
+				  UpDeviceSupplyValues	*values,
+				  UpDeviceState		*out_state)
 {
-	gchar *technology_native = NULL;
 	gboolean ret = TRUE;
-	gdouble voltage_design;
 	UpDeviceState old_state;
 	UpDeviceState state;
 	UpDevice *device = UP_DEVICE (supply);
 	const gchar *native_path;
 	GUdevDevice *native;
-	gboolean is_present;
 	gdouble energy;
 	gdouble energy_full;
 	gdouble energy_full_design;
@@ -503,10 +667,6 @@ up_device_supply_refresh_battery (UpDeviceSupply *supply,
 	gdouble voltage;
 	gint64 time_to_empty;
 	gint64 time_to_full;
-	gdouble temp;
-	gchar *manufacturer = NULL;
-	gchar *model_name = NULL;
-	gchar *serial_number = NULL;
 	UpDaemon *daemon;
 	gboolean ac_online = FALSE;
 	gboolean has_ac = FALSE;
@@ -518,70 +678,51 @@ up_device_supply_refresh_battery (UpDeviceSupply *supply,
 	native_path = g_udev_device_get_sysfs_path (native);
 
 	/* have we just been removed? */
-	if (sysfs_file_exists (native_path, "present")) {
-		is_present = sysfs_get_bool (native_path, "present");
-	} else {
-		/* when no present property exists, handle as present */
-		is_present = TRUE;
-	}
-	g_object_set (device, "is-present", is_present, NULL);
-	if (!is_present) {
+	g_object_set (device, "is-present", values->is_present, NULL);
+	if (!values->is_present) {
 		up_device_supply_reset_values (supply);
 		g_object_get (device, "state", out_state, NULL);
 		goto out;
 	}
 
 	/* get the current charge */
-	energy = sysfs_get_double (native_path, "energy_now") / 1000000.0;
-	if (energy < 0.01)
-		energy = sysfs_get_double (native_path, "energy_avg") / 1000000.0;
+	energy = values->energy;
 
-	/* used to convert A to W later */
-	voltage_design = up_device_supply_get_design_voltage (supply, native_path);
+	/* no valid design voltage found; display a warning the first time
+	 * for each device */
+	if (values->voltage_design_guessed &&
+	    !supply->priv->shown_invalid_voltage_warning) {
+		supply->priv->shown_invalid_voltage_warning = TRUE;
+		g_warning ("no valid voltage value found for device %s, assuming 10V", native_path);
+	}
 
-	/* initial values */
-	if (!supply->priv->has_coldplug_values ||
-	    up_device_supply_units_changed (supply, native_path)) {
+	/* initial values, or the units changed */
+	if (values->has_static) {
 
 		g_object_set (device,
 			      "power-supply", supply->priv->is_power_supply,
 			      NULL);
 
 		/* the ACPI spec is bad at defining battery type constants */
-		technology_native = up_device_supply_get_string (native_path, "technology");
-		g_object_set (device, "technology", up_device_supply_convert_device_technology (technology_native), NULL);
-
-		/* get values which may be blank */
-		manufacturer = up_device_supply_get_string (native_path, "manufacturer");
-		model_name = up_device_supply_get_string (native_path, "model_name");
-		serial_number = up_device_supply_get_string (native_path, "serial_number");
+		g_object_set (device, "technology", up_device_supply_convert_device_technology (values->technology), NULL);
 
 		/* some vendors fill this with binary garbage */
-		up_device_supply_make_safe_string (manufacturer);
-		up_device_supply_make_safe_string (model_name);
-		up_device_supply_make_safe_string (serial_number);
+		up_device_supply_make_safe_string (values->manufacturer);
+		up_device_supply_make_safe_string (values->model_name);
+		up_device_supply_make_safe_string (values->serial_number);
 
 		g_object_set (device,
-			      "vendor", manufacturer,
-			      "model", model_name,
-			      "serial", serial_number,
+			      "vendor", values->manufacturer,
+			      "model", values->model_name,
+			      "serial", values->serial_number,
 			      "is-rechargeable", TRUE, /* assume true for laptops */
 			      "has-history", TRUE,
 			      "has-statistics", TRUE,
 			      NULL);
 
 		/* these don't change at runtime */
-		energy_full = sysfs_get_double (native_path, "energy_full") / 1000000.0;
-		energy_full_design = sysfs_get_double (native_path, "energy_full_design") / 1000000.0;
-
-		/* convert charge to energy */
-		if (energy_full < 0.01) {
-			energy_full = sysfs_get_double (native_path, "charge_full") / 1000000.0;
-			energy_full_design = sysfs_get_double (native_path, "charge_full_design") / 1000000.0;
-			energy_full *= voltage_design;
-			energy_full_design *= voltage_design;
-			supply->priv->coldplug_units = UP_DEVICE_SUPPLY_COLDPLUG_UNITS_CHARGE;
-		}
+		energy_full = values->energy_full;
+		energy_full_design = values->energy_full_design;
 
 		/* the last full should not be bigger than the design */
 		if (energy_full > energy_full_design)
@@ -615,7 +756,7 @@ up_device_supply_refresh_battery (UpDeviceSupply *supply,
 			      NULL);
 	}
 
-	state = up_device_supply_get_state (native_path);
+	state = values->state;
 	*out_state = state;
 
 	/* reset unknown counter */
@@ -624,30 +765,8 @@ up_device_supply_refresh_battery (UpDeviceSupply *supply,
 		supply->priv->unknown_retries = 0;
 	}
 
-	/* this is the new value in uW */
-	energy_rate = fabs (sysfs_get_double (native_path, "power_now") / 1000000.0);
-	if (energy_rate < 0.01) {
-		gdouble charge_full;
-
-		/* convert charge to energy */
-		if (energy < 0.01) {
-			energy = sysfs_get_double (native_path, "charge_now") / 1000000.0;
-			if (energy < 0.01)
-				energy = sysfs_get_double (native_path, "charge_avg") / 1000000.0;
-			energy *= voltage_design;
-		}
-
-		charge_full = sysfs_get_double (native_path, "charge_full") / 1000000.0;
-		if (charge_full < 0.01)
-			charge_full = sysfs_get_double (native_path, "charge_full_design") / 1000000.0;
-
-		/* If charge_full exists, then current_now is always reported in uA.
-		 * In the legacy case, where energy only units exist, and power_now isn't present
-		 * current_now is power in uW. */
-		energy_rate = fabs (sysfs_get_double (native_path, "current_now") / 1000000.0);
-		if (charge_full != 0)
-			energy_rate *= voltage_design;
-	}
+	/* already converted to W */
+	energy_rate = values->energy_rate;
 
 	/* some batteries don't update last_full attribute */
 	if (energy > energy_full) {
@@ -656,9 +775,7 @@ up_device_supply_refresh_battery (UpDeviceSupply *supply,
 	}
 
 	/* present voltage */
-	voltage = sysfs_get_double (native_path, "voltage_now") / 1000000.0;
-	if (voltage < 0.01)
-		voltage = sysfs_get_double (native_path, "voltage_avg") / 1000000.0;
+	voltage = values->voltage;
 
 	/* ACPI gives out the special 'Ones' value for rate when it's unable
 	 * to calculate the true rate. We should set the rate zero, and wait
@@ -675,8 +792,8 @@ up_device_supply_refresh_battery (UpDeviceSupply *supply,
 		energy_rate = up_device_supply_calculate_rate (supply, energy);
 
 	/* get a precise percentage */
-        if (sysfs_file_exists (native_path, "capacity")) {
-		percentage = sysfs_get_double (native_path, "capacity");
+        if (values->has_capacity) {
+		percentage = values->capacity;
 		if (percentage < 0.0f)
 			percentage = 0.0f;
 		if (percentage > 100.0f)
@@ -771,9 +888,6 @@ up_device_supply_refresh_battery (UpDeviceSupply *supply,
 	if (time_to_full > (20 * 60 * 60)) /* 20 hours for charging */
 		time_to_full = 0;
 
-	/* get temperature */
-	temp = sysfs_get_double(native_path, "temp") / 10.0;
-
 	/* check if the energy value has changed and, if that's the case,
 	 * store the new values in the buffer. */
 	if (up_device_supply_push_new_energy (supply, energy))
@@ -800,49 +914,60 @@ up_device_supply_refresh_battery (UpDeviceSupply *supply,
 		      "voltage", voltage,
 		      "time-to-empty", time_to_empty,
 		      "time-to-full", time_to_full,
-		      "temperature", temp,
+		      "temperature", values->temp,
 		      NULL);
 
 out:
-	g_free (technology_native);
-	g_free (manufacturer);
-	g_free (model_name);
-	g_free (serial_number);
 	return ret;
 }
 
+/**
+ * up_device_supply_read_device:
+ *
+ * Reads everything up_device_supply_refresh_device() needs. This may be
+ * run in a refresh thread, so must not touch the device object.
+ **/
+static void
+up_device_supply_read_device (UpDeviceSupply		*supply,
+			      SysfsAttrs		*attrs,
+			      UpDeviceSupplyValues	*values)
+{
+	/* get values which may be blank */
+	if (!supply->priv->has_coldplug_values) {
+		values->has_static = TRUE;
+		values->model_name = up_device_supply_get_string (attrs, "model_name");
+	}
+
+	/* get a precise percentage */
+	values->capacity = sysfs_attrs_get_double_with_error (attrs, "capacity");
+	values->has_capacity = (values->capacity >= 0.0);
+	if (values->has_capacity)
+		values->state = up_device_supply_get_state (attrs);
+}
+
 /**
  * up_device_supply_refresh_device:
  *
  * Return %TRUE on success, %FALSE if we failed to refresh or no data
  **/
 static gboolean
-up_device_supply_refresh_device (UpDeviceSupply *supply,
-				 UpDeviceState  *out_state)
+up_device_supply_refresh_device (UpDeviceSupply		*supply,
+				 UpDeviceSupplyValues	*values,
+				 UpDeviceState		*out_state)
 {
 	gboolean ret = TRUE;
 	UpDeviceState state;
 	UpDevice *device = UP_DEVICE (supply);
-	const gchar *native_path;
-	GUdevDevice *native;
 	gdouble percentage = 0.0f;
 
-	native = G_UDEV_DEVICE (up_device_get_native (device));
-	native_path = g_udev_device_get_sysfs_path (native);
-
 	/* initial values */
-	if (!supply->priv->has_coldplug_values) {
-		gchar *model_name;
-
-		/* get values which may be blank */
-		model_name = up_device_supply_get_string (native_path, "model_name");
-
+	if (!supply->priv->has_coldplug_values && values->has_static) {
 		/* some vendors fill this with binary garbage */
-		up_device_supply_make_safe_string (model_name);
+		up_device_supply_make_safe_string (values->model_name);
 
 		g_object_set (device,
 			      "is-present", TRUE,
-			      "model", model_name,
+			      "model", values->model_name,
 			      "is-rechargeable", TRUE,
 			      "has-history", TRUE,
 			      "has-statistics", TRUE,
@@ -851,13 +976,11 @@ up_device_supply_refresh_device (UpDeviceSupply *supply,
 
 		/* we only coldplug once, as these values will never change */
 		supply->priv->has_coldplug_values = TRUE;
-
-		g_free (model_name);
 	}
 
 	/* get a precise percentage */
-	percentage = sysfs_get_double_with_error (native_path, "capacity");
-	if (percentage < 0.0) {
+	percentage = values->capacity;
+	if (!values->has_capacity) {
 		/* Probably talking to the device over Bluetooth */
 		state = UP_DEVICE_STATE_UNKNOWN;
 		g_object_set (device, "state", state, NULL);
@@ -865,7 +988,7 @@ up_device_supply_refresh_device (UpDeviceSupply *supply,
 		return FALSE;
 	}
 
-	state = up_device_supply_get_state (native_path);
+	state = values->state;
 
 	/* Override whatever the device might have told us
 	 * because a number of them are always discharging */
@@ -897,7 +1020,10 @@ up_device_supply_poll_unknown_battery (UpDevice *device)
 		 up_device_get_object_path (device), UP_DEVICE_SUPPLY_UNKNOWN_TIMEOUT);
 
 	supply->priv->poll_timer_id = 0;
-	up_device_supply_refresh (device);
+
+	/* in the same queue as the polls, so a thread reading the battery
+	 * can't apply its older values over ours */
+	up_device_refresh_async (device, NULL, NULL);
 
 	return FALSE;
 }
@@ -934,6 +1060,10 @@ up_device_supply_coldplug (UpDevice *device)
 		goto out;
 	}
 
+	/* keep the attribute files open, as we read them on every refresh */
+	sysfs_attrs_free (supply->priv->attrs);
+	supply->priv->attrs = sysfs_attrs_new (native_path);
+
 	/* try to work out if the device is powering the system */
 	scope = g_udev_device_get_sysfs_attr (native, "scope");
 	if (scope != NULL && g_ascii_strcasecmp (scope, "device") == 0) {
@@ -947,13 +1077,13 @@ up_device_supply_coldplug (UpDevice *device)
 
 	/* we don't use separate ACs for devices */
 	if (supply->priv->is_power_supply == FALSE &&
-	    !sysfs_file_exists (native_path, "capacity")) {
+	    !sysfs_attrs_file_exists (supply->priv->attrs, "capacity")) {
 		g_debug ("Ignoring device AC, we'll monitor the device battery");
 		goto out;
 	}
 
 	/* try to detect using the device type */
-	device_type = up_device_supply_get_string (native_path, "type");
+	device_type = up_device_supply_get_string (supply->priv->attrs, "type");
 	if (device_type != NULL) {
 		if (g_ascii_strcasecmp (device_type, "mains") == 0) {
 			type = UP_DEVICE_KIND_LINE_POWER;
@@ -1018,7 +1148,7 @@ up_device_supply_coldplug (UpDevice *device)
 
 	/* if reading the device type did not work, use the previous method */
 	if (type == UP_DEVICE_KIND_UNKNOWN) {
-		if (sysfs_file_exists (native_path, "online")) {
+		if (sysfs_attrs_file_exists (supply->priv->attrs, "online")) {
 			type = UP_DEVICE_KIND_LINE_POWER;
 		} else {
 			/* this is a good guess as UPS and CSR are not in the kernel */
@@ -1027,6 +1157,7 @@ up_device_supply_coldplug (UpDevice *device)
 	}
 
 	/* set the value */
+	supply->priv->type = type;
 	g_object_set (device, "type", type, NULL);
 
 	if (type != UP_DEVICE_KIND_LINE_POWER &&
@@ -1080,31 +1211,79 @@ up_device_supply_disable_unknown_poll (UpDevice *device)
 }
 
 /**
- * up_device_supply_refresh:
+ * up_device_supply_refresh_read:
+ *
+ * Reads the sysfs attributes of the device, which can be slow for some
+ * ACPI batteries. This is run in a refresh thread when polling.
+ **/
+static gpointer
+up_device_supply_refresh_read (UpDevice *device)
+{
+	UpDeviceSupply *supply = UP_DEVICE_SUPPLY (device);
+	UpDeviceSupplyValues *values;
+	SysfsAttrs *attrs = supply->priv->attrs;
+
+	values = g_new0 (UpDeviceSupplyValues, 1);
+
+	/* take as much as possible from a single read of the uevent file */
+	sysfs_attrs_snapshot_begin (attrs, "POWER_SUPPLY_");
+	switch (supply->priv->type) {
+	case UP_DEVICE_KIND_LINE_POWER:
+		values->online = sysfs_attrs_get_int (attrs, "online");
+		break;
+	case UP_DEVICE_KIND_BATTERY:
+		up_device_supply_read_battery (supply, attrs, values);
+		break;
+	default:
+		up_device_supply_read_device (supply, attrs, values);
+		break;
+	}
+	sysfs_attrs_snapshot_end (attrs);
+	return values;
+}
+
+/**
+ * up_device_supply_values_free:
+ **/
+static void
+up_device_supply_values_free (UpDeviceSupplyValues *values)
+{
+	g_free (values->technology);
+	g_free (values->manufacturer);
+	g_free (values->model_name);
+	g_free (values->serial_number);
+	g_free (values);
+}
+
+/**
+ * up_device_supply_refresh_apply:
  *
  * Return %TRUE on success, %FALSE if we failed to refresh or no data
  **/
 static gboolean
-up_device_supply_refresh (UpDevice *device)
+up_device_supply_refresh_apply (UpDevice *device, gpointer user_data)
 {
 	gboolean ret;
 	GTimeVal timeval;
 	UpDeviceSupply *supply = UP_DEVICE_SUPPLY (device);
-	UpDeviceKind type;
+	UpDeviceSupplyValues *values = user_data;
 	UpDeviceState state;
 
-	g_object_get (device, "type", &type, NULL);
-	switch (type) {
+	/* emit one notify per changed property once everything is set,
+	 * rather than one per g_object_set() call */
+	g_object_freeze_notify (G_OBJECT (device));
+
+	switch (supply->priv->type) {
 	case UP_DEVICE_KIND_LINE_POWER:
-		ret = up_device_supply_refresh_line_power (supply);
+		ret = up_device_supply_refresh_line_power (supply, values);
 		break;
 	case UP_DEVICE_KIND_BATTERY:
 		up_device_supply_disable_unknown_poll (device);
-		ret = up_device_supply_refresh_battery (supply, &state);
+		ret = up_device_supply_refresh_battery (supply, values, &state);
 		up_device_supply_setup_unknown_poll (device, state);
 		break;
 	default:
-		ret = up_device_supply_refresh_device (supply, &state);
+		ret = up_device_supply_refresh_device (supply, values, &state);
 		break;
 	}
 
@@ -1114,9 +1293,37 @@ up_device_supply_refresh (UpDevice *device)
 		g_object_set (device, "update-time", (guint64) timeval.tv_sec, NULL);
 	}
 
+	g_object_thaw_notify (G_OBJECT (device));
+	up_device_supply_values_free (values);
 	return ret;
 }
 
+/**
+ * up_device_supply_refresh:
+ *
+ * Return %TRUE on success, %FALSE if we failed to refresh or no data
+ **/
+static gboolean
+up_device_supply_refresh (UpDevice *device)
+{
+	return up_device_supply_refresh_apply (device, up_device_supply_refresh_read (device));
+}
+
+/**
+ * up_device_supply_native_changed:
+ *
+ * Called when the kernel sent a change event for the device, as some of
+ * the attributes that were missing may now exist, so the read plan has to
+ * be worked out again.
+ **/
+void
+up_device_supply_native_changed (UpDeviceSupply *supply)
+{
+	g_return_if_fail (UP_IS_DEVICE_SUPPLY (supply));
+	sysfs_attrs_invalidate (supply->priv->attrs, TRUE);
+	g_atomic_int_inc (&supply->priv->plan_generation);
+}
+
 /**
  * up_device_supply_init:
  **/
@@ -1132,6 +1339,7 @@ up_device_supply_init (UpDeviceSupply *supply)
 	supply->priv->energy_old_timespec = g_new (GTimeVal, UP_DEVICE_SUPPLY_ENERGY_OLD_LENGTH);
 
 	supply->priv->shown_invalid_voltage_warning = FALSE;
+	supply->priv->plan.generation = -1;
 
 	config = up_config_new ();
 	/* Seems that we don't get change uevents from the
@@ -1162,6 +1370,7 @@ up_device_supply_finalize (GObject *object)
 
 	g_free (supply->priv->energy_old);
 	g_free (supply->priv->energy_old_timespec);
+	sysfs_attrs_free (supply->priv->attrs);
 
 	G_OBJECT_CLASS (up_device_supply_parent_class)->finalize (object);
 }
@@ -1180,6 +1389,8 @@ up_device_supply_class_init (UpDeviceSupplyClass *klass)
 	device_class->get_online = up_device_supply_get_online;
 	device_class->coldplug = up_device_supply_coldplug;
 	device_class->refresh = up_device_supply_refresh;
+	device_class->refresh_read = up_device_supply_refresh_read;
+	device_class->refresh_apply = up_device_supply_refresh_apply;
 
 	g_type_class_add_private (klass, sizeof (UpDeviceSupplyPrivate));
 }
@@ -49,6 +49,7 @@ typedef struct
 
 GType		 up_device_supply_get_type		(void);
 UpDeviceSupply	*up_device_supply_new			(void);
+void		 up_device_supply_native_changed	(UpDeviceSupply	*supply);
 
 G_END_DECLS
 
@@ -38,22 +38,31 @@ struct UpDeviceUnifyingPrivate
 G_DEFINE_TYPE (UpDeviceUnifying, up_device_unifying, UP_TYPE_DEVICE)
 #define UP_DEVICE_UNIFYING_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), UP_TYPE_DEVICE_UNIFYING, UpDeviceUnifyingPrivate))
 
+typedef struct {
+	gboolean		 ok;
+	gboolean		 reachable;
+	HidppDeviceBattStatus	 batt_status;
+	guint			 percentage;
+	gdouble			 lux;
+} UpDeviceUnifyingValues;
+
 /**
- * up_device_unifying_refresh:
+ * up_device_unifying_refresh_read:
  *
- * Return %TRUE on success, %FALSE if we failed to refresh or no data
+ * Talks HID++ to the device, which can take a while if it is asleep.
+ * This is run in a refresh thread when polling.
  **/
-static gboolean
-up_device_unifying_refresh (UpDevice *device)
+static gpointer
+up_device_unifying_refresh_read (UpDevice *device)
 {
 	gboolean ret;
 	GError *error = NULL;
-	GTimeVal timeval;
 	HidppRefreshFlags refresh_flags;
-	UpDeviceState state = UP_DEVICE_STATE_UNKNOWN;
 	UpDeviceUnifying *unifying = UP_DEVICE_UNIFYING (device);
 	UpDeviceUnifyingPrivate *priv = unifying->priv;
-	double lux;
+	UpDeviceUnifyingValues *values;
+
+	values = g_new0 (UpDeviceUnifyingValues, 1);
 
 	/* refresh the battery stats */
 	refresh_flags = HIDPP_REFRESH_FLAGS_BATTERY;
@@ -76,7 +85,32 @@ up_device_unifying_refresh (UpDevice *device)
 		g_error_free (error);
 		goto out;
 	}
-	switch (hidpp_device_get_batt_status (priv->hidpp_device)) {
+
+	values->ok = TRUE;
+	values->reachable = hidpp_device_is_reachable (priv->hidpp_device);
+	values->batt_status = hidpp_device_get_batt_status (priv->hidpp_device);
+	values->percentage = hidpp_device_get_batt_percentage (priv->hidpp_device);
+	values->lux = hidpp_device_get_luminosity (priv->hidpp_device);
+out:
+	return values;
+}
+
+/**
+ * up_device_unifying_refresh_apply:
+ *
+ * Return %TRUE on success, %FALSE if we failed to refresh or no data
+ **/
+static gboolean
+up_device_unifying_refresh_apply (UpDevice *device, gpointer user_data)
+{
+	GTimeVal timeval;
+	UpDeviceState state = UP_DEVICE_STATE_UNKNOWN;
+	UpDeviceUnifyingValues *values = user_data;
+
+	if (!values->ok)
+		goto out;
+
+	switch (values->batt_status) {
 	case HIDPP_DEVICE_BATT_STATUS_CHARGING:
 		state = UP_DEVICE_STATE_CHARGING;
 		break;
@@ -91,26 +125,37 @@ up_device_unifying_refresh (UpDevice *device)
 	}
 
 	/* if a device is unreachable, some known values do not make sense */
-	if (!hidpp_device_is_reachable (priv->hidpp_device)) {
+	if (!values->reachable) {
 		state = UP_DEVICE_STATE_UNKNOWN;
 	}
 
 	g_get_current_time (&timeval);
-	lux = hidpp_device_get_luminosity (priv->hidpp_device);
-	if (lux >= 0) {
-		g_object_set (device, "luminosity", lux, NULL);
+	if (values->lux >= 0) {
+		g_object_set (device, "luminosity", values->lux, NULL);
 	}
 
 	g_object_set (device,
-		      "is-present", hidpp_device_is_reachable (priv->hidpp_device),
-		      "percentage", (gdouble) hidpp_device_get_batt_percentage (priv->hidpp_device),
+		      "is-present", values->reachable,
+		      "percentage", (gdouble) values->percentage,
 		      "state", state,
 		      "update-time", (guint64) timeval.tv_sec,
 		      NULL);
 out:
+	g_free (values);
 	return TRUE;
 }
 
+/**
+ * up_device_unifying_refresh:
+ *
+ * Return %TRUE on success, %FALSE if we failed to refresh or no data
+ **/
+static gboolean
+up_device_unifying_refresh (UpDevice *device)
+{
+	return up_device_unifying_refresh_apply (device, up_device_unifying_refresh_read (device));
+}
+
 static UpDeviceKind
 up_device_unifying_get_device_kind (UpDeviceUnifying *unifying)
 {
@@ -341,6 +386,8 @@ up_device_unifying_class_init (UpDeviceUnifyingClass *klass)
 	object_class->finalize = up_device_unifying_finalize;
 	device_class->coldplug = up_device_unifying_coldplug;
 	device_class->refresh = up_device_unifying_refresh;
+	device_class->refresh_read = up_device_unifying_refresh_read;
+	device_class->refresh_apply = up_device_unifying_refresh_apply;
 
 	g_type_class_add_private (klass, sizeof (UpDeviceUnifyingPrivate));
 }
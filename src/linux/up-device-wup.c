@@ -86,7 +86,10 @@ up_device_wup_poll_cb (UpDeviceWup *wup)
 	UpDevice *device = UP_DEVICE (wup);
 
 	g_debug ("Polling: %s", up_device_get_object_path (device));
-	up_device_wup_refresh (device);
+
+	/* reading the serial port can block, so do it in a refresh thread,
+	 * which also keeps it from interleaving with any other read */
+	up_device_refresh_async (device, NULL, NULL);
 
 	/* always continue polling */
 	return TRUE;
@@ -380,20 +383,31 @@ out:
 }
 
 /**
- * up_device_wup_refresh:
+ * up_device_wup_refresh_read:
+ *
+ * Reads a command from the serial port, which can block for a while.
+ * This is run in a refresh thread when polling.
+ **/
+static gpointer
+up_device_wup_refresh_read (UpDevice *device)
+{
+	return up_device_wup_read_command (UP_DEVICE_WUP (device));
+}
+
+/**
+ * up_device_wup_refresh_apply:
  *
  * Return %TRUE on success, %FALSE if we failed to refresh or no data
  **/
 static gboolean
-up_device_wup_refresh (UpDevice *device)
+up_device_wup_refresh_apply (UpDevice *device, gpointer user_data)
 {
 	gboolean ret = FALSE;
 	GTimeVal timeval;
-	gchar *data = NULL;
+	gchar *data = user_data;
 	UpDeviceWup *wup = UP_DEVICE_WUP (device);
 
 	/* get data */
-	data = up_device_wup_read_command (wup);
 	if (data == NULL) {
 		g_debug ("no data");
 		goto out;
@@ -416,6 +430,17 @@ out:
 	return TRUE;
 }
 
+/**
+ * up_device_wup_refresh:
+ *
+ * Return %TRUE on success, %FALSE if we failed to refresh or no data
+ **/
+static gboolean
+up_device_wup_refresh (UpDevice *device)
+{
+	return up_device_wup_refresh_apply (device, up_device_wup_refresh_read (device));
+}
+
 /**
  * up_device_wup_init:
  **/
@@ -463,6 +488,8 @@ up_device_wup_class_init (UpDeviceWupClass *klass)
 	object_class->finalize = up_device_wup_finalize;
 	device_class->coldplug = up_device_wup_coldplug;
 	device_class->refresh = up_device_wup_refresh;
+	device_class->refresh_read = up_device_wup_refresh_read;
+	device_class->refresh_apply = up_device_wup_refresh_apply;
 
 	g_type_class_add_private (klass, sizeof (UpDeviceWupPrivate));
 }
@@ -25,6 +25,7 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <math.h>
 
 #include <glib.h>
 #include <glib/gi18n-lib.h>
@@ -55,6 +56,7 @@ enum
 {
 	SIGNAL_DEVICE_ADDED,
 	SIGNAL_DEVICE_REMOVED,
+	SIGNAL_SUBSCRIBED_PROPERTIES_CHANGED,
 	SIGNAL_LAST,
 };
 
@@ -69,6 +71,12 @@ struct UpDaemonPrivate
 	UpDeviceList		*power_devices;
 	guint			 action_timeout_id;
 	GHashTable		*poll_timeouts;
+	GSequence		*poll_queue;
+	guint			 poll_source_id;
+	gint64			 poll_source_due;
+	UpDaemonPollStats	 poll_stats;
+	guint			 poll_interval_max;
+	guint			 poll_watchdog;
 
 	/* Properties */
 	gboolean		 on_battery;
@@ -79,6 +87,11 @@ struct UpDaemonPrivate
 	/* PropertiesChanged to be emitted */
 	GHashTable		*changed_props;
 	guint			 props_idle_id;
+	guint			 props_interval;
+	UpDaemonPropsStats	 props_stats;
+
+	/* clients that asked for targeted PropertiesChanged */
+	GHashTable		*subscribers;
 
 	/* Display battery properties */
 	UpDevice		*display_device;
@@ -111,6 +124,20 @@ G_DEFINE_TYPE (UpDaemon, up_daemon, G_TYPE_OBJECT)
 #define UP_DAEMON_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), UP_TYPE_DAEMON, UpDaemonPrivate))
 
 #define UP_DAEMON_ACTION_DELAY				20 /* seconds */
+#define UP_DAEMON_POLL_SLACK				(1 * G_USEC_PER_SEC)
+#define UP_DAEMON_POLL_INTERVAL_MIN			5 /* seconds */
+#define UP_DAEMON_POLL_INTERVAL_MAX			300 /* seconds */
+#define UP_DAEMON_POLL_FLAT_DELTA			0.5f /* percent */
+#define UP_DAEMON_POLL_WATCHDOG				600 /* seconds */
+#define UP_DAEMON_UEVENT_RELIABLE			3 /* uevents */
+#define UP_DAEMON_SUBSCRIBERS_MAX			128
+#define UP_DAEMON_SUBSCRIBER_FILTERS_MAX		32
+
+typedef struct {
+	gchar			*name;		/* unique bus name */
+	GArray			*filters;	/* of UpDaemonFilter */
+	GHashTable		*sent;		/* "path index" -> GVariant last sent for that filter */
+} UpDaemonSubscriber;
 
 /**
  * up_daemon_get_on_battery_local:
@@ -440,6 +467,38 @@ up_daemon_enumerate_devices (UpDaemon *daemon, DBusGMethodInvocation *context)
 	return TRUE;
 }
 
+/**
+ * up_daemon_enumerate_devices_with_properties:
+ **/
+gboolean
+up_daemon_enumerate_devices_with_properties (UpDaemon *daemon, DBusGMethodInvocation *context)
+{
+	guint i;
+	GPtrArray *array;
+	GHashTable *devices;
+	UpDevice *device;
+
+	/* map each object path to all its properties, so that clients
+	 * don't have to ask every device for them in turn */
+	devices = g_hash_table_new_full (g_str_hash, g_str_equal,
+					 NULL, (GDestroyNotify) g_hash_table_unref);
+	array = up_device_list_get_array (daemon->priv->power_devices);
+	for (i=0; i<array->len; i++) {
+		device = (UpDevice *) g_ptr_array_index (array, i);
+		g_hash_table_insert (devices,
+				     (gpointer) up_device_get_object_path (device),
+				     up_device_get_properties (device));
+	}
+
+	/* return it on the bus */
+	dbus_g_method_return (context, devices);
+
+	/* free, the paths belong to the devices */
+	g_hash_table_unref (devices);
+	g_ptr_array_unref (array);
+	return TRUE;
+}
+
 /**
  * up_daemon_get_display_device:
  **/
@@ -462,6 +521,159 @@ up_daemon_get_critical_action (UpDaemon			*daemon,
 	return TRUE;
 }
 
+/**
+ * up_daemon_subscriber_free:
+ **/
+static void
+up_daemon_subscriber_free (UpDaemonSubscriber *subscriber)
+{
+	guint i;
+
+	for (i = 0; i < subscriber->filters->len; i++)
+		g_free (g_array_index (subscriber->filters, UpDaemonFilter, i).property);
+	g_array_unref (subscriber->filters);
+	g_hash_table_unref (subscriber->sent);
+	g_free (subscriber->name);
+	g_free (subscriber);
+}
+
+/**
+ * up_daemon_subscribe:
+ *
+ * Replaces any filters the caller had set before.
+ **/
+gboolean
+up_daemon_subscribe (UpDaemon *daemon, GPtrArray *filters, DBusGMethodInvocation *context)
+{
+	GError *error;
+	GValueArray *gva;
+	UpDaemonFilter filter;
+	UpDaemonSubscriber *subscriber;
+	const gchar *kind;
+	gchar *sender;
+	guint i;
+
+	sender = dbus_g_method_get_sender (context);
+	if (sender == NULL) {
+		error = g_error_new (UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL, "no sender");
+		dbus_g_method_return_error (context, error);
+		g_error_free (error);
+		return TRUE;
+	}
+
+	if (filters->len == 0 || filters->len > UP_DAEMON_SUBSCRIBER_FILTERS_MAX) {
+		error = g_error_new (UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL,
+				     "between 1 and %i filters are allowed", UP_DAEMON_SUBSCRIBER_FILTERS_MAX);
+		dbus_g_method_return_error (context, error);
+		g_error_free (error);
+		goto out;
+	}
+	if (g_hash_table_size (daemon->priv->subscribers) >= UP_DAEMON_SUBSCRIBERS_MAX &&
+	    g_hash_table_lookup (daemon->priv->subscribers, sender) == NULL) {
+		error = g_error_new (UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL, "too many subscribers");
+		dbus_g_method_return_error (context, error);
+		g_error_free (error);
+		goto out;
+	}
+
+	subscriber = g_new0 (UpDaemonSubscriber, 1);
+	subscriber->filters = g_array_sized_new (FALSE, FALSE, sizeof (UpDaemonFilter), filters->len);
+	subscriber->sent = g_hash_table_new_full (g_str_hash, g_str_equal,
+						  g_free, (GDestroyNotify) g_variant_unref);
+	for (i = 0; i < filters->len; i++) {
+		gva = (GValueArray *) g_ptr_array_index (filters, i);
+		filter.property = g_value_dup_string (g_value_array_get_nth (gva, 0));
+		kind = g_value_get_string (g_value_array_get_nth (gva, 1));
+		filter.threshold = g_value_get_double (g_value_array_get_nth (gva, 2));
+		if (g_strcmp0 (kind, "any") == 0) {
+			filter.kind = UP_DAEMON_FILTER_ANY;
+		} else if (g_strcmp0 (kind, "delta") == 0) {
+			filter.kind = UP_DAEMON_FILTER_DELTA;
+		} else if (g_strcmp0 (kind, "crossing") == 0) {
+			filter.kind = UP_DAEMON_FILTER_CROSSING;
+		} else {
+			error = g_error_new (UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL,
+					     "invalid filter kind '%s' for %s", kind, filter.property);
+			g_free (filter.property);
+			dbus_g_method_return_error (context, error);
+			g_error_free (error);
+			up_daemon_subscriber_free (subscriber);
+			goto out;
+		}
+		g_array_append_val (subscriber->filters, filter);
+	}
+
+	g_debug ("%s subscribed with %i filters", sender, filters->len);
+	subscriber->name = sender;
+	sender = NULL;
+	g_hash_table_replace (daemon->priv->subscribers, subscriber->name, subscriber);
+	dbus_g_method_return (context);
+out:
+	g_free (sender);
+	return TRUE;
+}
+
+/**
+ * up_daemon_unsubscribe:
+ **/
+gboolean
+up_daemon_unsubscribe (UpDaemon *daemon, DBusGMethodInvocation *context)
+{
+	gchar *sender;
+
+	sender = dbus_g_method_get_sender (context);
+	if (sender != NULL && g_hash_table_remove (daemon->priv->subscribers, sender))
+		g_debug ("%s unsubscribed", sender);
+	dbus_g_method_return (context);
+	g_free (sender);
+	return TRUE;
+}
+
+/**
+ * up_daemon_name_owner_changed_cb:
+ *
+ * Drops the filters of subscribers that left the bus without
+ * calling Unsubscribe.
+ **/
+static void
+up_daemon_name_owner_changed_cb (DBusGProxy *proxy, const gchar *name,
+				 const gchar *old_owner, const gchar *new_owner,
+				 UpDaemon *daemon)
+{
+	if (new_owner != NULL && new_owner[0] != '\0')
+		return;
+	if (g_hash_table_remove (daemon->priv->subscribers, name))
+		g_debug ("%s left the bus, dropping its subscription", name);
+}
+
+/**
+ * up_daemon_subscriber_forget_cb:
+ **/
+static gboolean
+up_daemon_subscriber_forget_cb (gpointer key, gpointer value, gpointer user_data)
+{
+	return g_str_has_prefix (key, user_data);
+}
+
+/**
+ * up_daemon_subscribers_forget:
+ *
+ * Drops the values last sent to subscribers for an object that has gone.
+ **/
+static void
+up_daemon_subscribers_forget (UpDaemon *daemon, const gchar *object_path)
+{
+	GHashTableIter iter;
+	UpDaemonSubscriber *subscriber;
+	gchar *prefix;
+
+	prefix = g_strdup_printf ("%s ", object_path);
+	g_hash_table_iter_init (&iter, daemon->priv->subscribers);
+	while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &subscriber))
+		g_hash_table_foreach_remove (subscriber->sent, up_daemon_subscriber_forget_cb, prefix);
+	g_free (prefix);
+}
+
 /**
  * up_daemon_register_power_daemon:
  **/
@@ -490,6 +702,10 @@ up_daemon_register_power_daemon (UpDaemon *daemon)
 						 DBUS_SERVICE_DBUS,
 						 DBUS_PATH_DBUS,
 						 DBUS_INTERFACE_DBUS);
+	dbus_g_proxy_add_signal (priv->proxy, "NameOwnerChanged",
+				 G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_INVALID);
+	dbus_g_proxy_connect_signal (priv->proxy, "NameOwnerChanged",
+				     G_CALLBACK (up_daemon_name_owner_changed_cb), daemon, NULL);
 
 	/* register GObject */
 	dbus_g_connection_register_g_object (priv->connection,
@@ -598,23 +814,15 @@ changed_props_add_to_msg (gpointer key,
 	dbus_message_iter_close_container (subiter, &dict_iter);
 }
 
-void
-up_daemon_emit_properties_changed (DBusGConnection *gconnection,
-				   const gchar     *object_path,
-				   const gchar     *interface,
-				   GHashTable      *props)
+static DBusMessage *
+up_daemon_new_properties_changed (const gchar *object_path,
+				  const gchar *interface,
+				  GHashTable  *props)
 {
-	DBusConnection *connection;
 	DBusMessage *message;
 	DBusMessageIter iter;
 	DBusMessageIter subiter;
 
-	g_return_if_fail (gconnection != NULL);
-	g_return_if_fail (object_path != NULL);
-	g_return_if_fail (interface != NULL);
-	g_return_if_fail (props != NULL);
-
-	connection = dbus_g_connection_get_connection (gconnection);
 	message = dbus_message_new_signal (object_path,
 					   "org.freedesktop.DBus.Properties",
 					   "PropertiesChanged");
@@ -631,10 +839,204 @@ up_daemon_emit_properties_changed (DBusGConnection *gconnection,
 	dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY, "s", &subiter);
 	dbus_message_iter_close_container (&iter, &subiter);
 
+	return message;
+}
+
+void
+up_daemon_emit_properties_changed (DBusGConnection *gconnection,
+				   const gchar     *object_path,
+				   const gchar     *interface,
+				   GHashTable      *props)
+{
+	DBusConnection *connection;
+	DBusMessage *message;
+
+	g_return_if_fail (gconnection != NULL);
+	g_return_if_fail (object_path != NULL);
+	g_return_if_fail (interface != NULL);
+	g_return_if_fail (props != NULL);
+
+	connection = dbus_g_connection_get_connection (gconnection);
+	message = up_daemon_new_properties_changed (object_path, interface, props);
 	dbus_connection_send (connection, message, NULL);
 	dbus_message_unref (message);
 }
 
+/**
+ * up_daemon_variant_to_double:
+ **/
+static gboolean
+up_daemon_variant_to_double (GVariant *value, gdouble *result)
+{
+	if (g_variant_is_of_type (value, G_VARIANT_TYPE_DOUBLE))
+		*result = g_variant_get_double (value);
+	else if (g_variant_is_of_type (value, G_VARIANT_TYPE_UINT32))
+		*result = g_variant_get_uint32 (value);
+	else if (g_variant_is_of_type (value, G_VARIANT_TYPE_INT64))
+		*result = g_variant_get_int64 (value);
+	else if (g_variant_is_of_type (value, G_VARIANT_TYPE_UINT64))
+		*result = g_variant_get_uint64 (value);
+	else
+		return FALSE;
+	return TRUE;
+}
+
+/**
+ * up_daemon_filter_matches:
+ * @last: the value last sent for this filter, or %NULL
+ *
+ * Properties that are not numbers, like IconName, match on any change
+ * whatever the filter kind.
+ **/
+gboolean
+up_daemon_filter_matches (const UpDaemonFilter *filter, GVariant *last, GVariant *value)
+{
+	gdouble old;
+	gdouble new;
+
+	/* the subscriber has nothing to compare against yet */
+	if (last == NULL)
+		return TRUE;
+	if (filter->kind == UP_DAEMON_FILTER_ANY ||
+	    !up_daemon_variant_to_double (last, &old) ||
+	    !up_daemon_variant_to_double (value, &new))
+		return !g_variant_equal (last, value);
+
+	if (filter->kind == UP_DAEMON_FILTER_DELTA)
+		return ABS (new - old) >= filter->threshold;
+	return (old < filter->threshold) != (new < filter->threshold);
+}
+
+/**
+ * up_daemon_emit_subscribed_properties_changed:
+ *
+ * Sends SubscribedPropertiesChanged to each subscriber that has a filter
+ * matching one of @props, with just the properties that matched.
+ **/
+void
+up_daemon_emit_subscribed_properties_changed (UpDaemon    *daemon,
+					      const gchar *object_path,
+					      GHashTable  *props)
+{
+	DBusConnection *connection;
+	DBusMessage *message;
+	DBusMessageIter msg_iter;
+	DBusMessageIter subiter;
+	GHashTable *matched;
+	GHashTableIter iter;
+	GVariant *value;
+	UpDaemonFilter *filter;
+	UpDaemonSubscriber *subscriber;
+	gchar *key;
+	guint i;
+
+	g_return_if_fail (UP_IS_DAEMON (daemon));
+
+	if (daemon->priv->connection == NULL ||
+	    g_hash_table_size (daemon->priv->subscribers) == 0)
+		return;
+
+	connection = dbus_g_connection_get_connection (daemon->priv->connection);
+	g_hash_table_iter_init (&iter, daemon->priv->subscribers);
+	while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &subscriber)) {
+		matched = NULL;
+		for (i = 0; i < subscriber->filters->len; i++) {
+			filter = &g_array_index (subscriber->filters, UpDaemonFilter, i);
+			value = g_hash_table_lookup (props, filter->property);
+			if (value == NULL)
+				continue;
+
+			/* each filter keeps its own reference point */
+			key = g_strdup_printf ("%s %i", object_path, i);
+			if (!up_daemon_filter_matches (filter, g_hash_table_lookup (subscriber->sent, key), value)) {
+				g_free (key);
+				continue;
+			}
+			g_hash_table_replace (subscriber->sent, key, g_variant_ref (value));
+
+			if (matched == NULL)
+				matched = g_hash_table_new (g_str_hash, g_str_equal);
+			g_hash_table_insert (matched, filter->property, value);
+		}
+		if (matched == NULL)
+			continue;
+
+		message = dbus_message_new_signal ("/org/freedesktop/UPower",
+						   "org.freedesktop.UPower",
+						   "SubscribedPropertiesChanged");
+		dbus_message_iter_init_append (message, &msg_iter);
+		dbus_message_iter_append_basic (&msg_iter, DBUS_TYPE_OBJECT_PATH, &object_path);
+		dbus_message_iter_open_container (&msg_iter, DBUS_TYPE_ARRAY, "{sv}", &subiter);
+		g_hash_table_foreach (matched, changed_props_add_to_msg, &subiter);
+		dbus_message_iter_close_container (&msg_iter, &subiter);
+		dbus_message_set_destination (message, subscriber->name);
+		dbus_connection_send (connection, message, NULL);
+		dbus_message_unref (message);
+		g_hash_table_unref (matched);
+		daemon->priv->props_stats.targeted++;
+	}
+}
+
+/**
+ * up_daemon_get_properties_changed_delay:
+ * @last_sent: when the object last sent PropertiesChanged, in monotonic
+ *	       time, or 0 if it never did
+ * @urgent: if the change is one clients have to hear about at once
+ *
+ * Gets how long an object has to hold back its next PropertiesChanged
+ * so that it sends at most one every PropertiesChangedInterval seconds.
+ *
+ * Return value: the delay in ms, or 0 to send it now
+ **/
+guint
+up_daemon_get_properties_changed_delay (UpDaemon *daemon, gint64 last_sent, gboolean urgent)
+{
+	gint64 due;
+	gint64 now;
+
+	g_return_val_if_fail (UP_IS_DAEMON (daemon), 0);
+
+	if (urgent || daemon->priv->props_interval == 0 || last_sent == 0)
+		return 0;
+
+	due = last_sent + (gint64) daemon->priv->props_interval * G_USEC_PER_SEC;
+	now = g_get_monotonic_time ();
+	if (due <= now)
+		return 0;
+	return (due - now + 999) / 1000;
+}
+
+/**
+ * up_daemon_count_properties_changed:
+ * @suppressed: the number of signals that were held back and merged
+ *		into this one by the PropertiesChangedInterval window
+ *
+ * Records one PropertiesChanged sent by the daemon or one of its devices.
+ **/
+void
+up_daemon_count_properties_changed (UpDaemon *daemon, guint suppressed)
+{
+	g_return_if_fail (UP_IS_DAEMON (daemon));
+
+	daemon->priv->props_stats.sent++;
+	daemon->priv->props_stats.suppressed += suppressed;
+}
+
+/**
+ * up_daemon_get_props_stats:
+ *
+ * Gets how many PropertiesChanged signals were sent, and how many more
+ * would have been sent without the PropertiesChangedInterval window.
+ **/
+void
+up_daemon_get_props_stats (UpDaemon *daemon, UpDaemonPropsStats *stats)
+{
+	g_return_if_fail (UP_IS_DAEMON (daemon));
+	g_return_if_fail (stats != NULL);
+
+	*stats = daemon->priv->props_stats;
+}
+
 static gboolean
 changed_props_idle_cb (gpointer user_data)
 {
@@ -645,14 +1047,22 @@ changed_props_idle_cb (gpointer user_data)
 					   "/org/freedesktop/UPower",
 					   "org.freedesktop.UPower",
 					   daemon->priv->changed_props);
+	up_daemon_emit_subscribed_properties_changed (daemon,
+						      "/org/freedesktop/UPower",
+						      daemon->priv->changed_props);
 	g_clear_pointer (&daemon->priv->changed_props, g_hash_table_unref);
 	daemon->priv->props_idle_id = 0;
+	up_daemon_count_properties_changed (daemon, 0);
 
 	return G_SOURCE_REMOVE;
 }
 
 /**
  * up_daemon_queue_changed_property:
+ *
+ * The daemon's own properties are all transitions like OnBattery that
+ * clients have to hear about at once, so unlike the devices these are
+ * never held back by PropertiesChangedInterval.
  **/
 static void
 up_daemon_queue_changed_property (UpDaemon    *daemon,
@@ -862,77 +1272,559 @@ up_daemon_device_changed_cb (UpDevice *device, GParamSpec *pspec, UpDaemon *daem
 }
 
 typedef struct {
-	guint id;
-	guint timeout;
-	GSourceFunc callback;
+	UpDevice	*device;
+	GSourceFunc	 callback;
+	guint		 timeout;	/* seconds */
+	gint64		 due;		/* monotonic, us */
+	GSequenceIter	*iter;
+	gulong		 notify_id;
+	gboolean	 has_last;
+	gdouble		 last_percentage;
+	gint64		 last_time;		/* monotonic, us */
+	gint64		 predicted_crossing;	/* monotonic, us */
+	gdouble		 predicted_threshold;
+	gboolean	 predicted_in_time;
+	guint		 uevents_since_miss;
+	guint		 uevent_misses;
+	guint		 uevents_queued;
+	UpDeviceState	 poll_state;
+	gdouble		 poll_percentage;
 } TimeoutData;
 
+static void	up_daemon_poll_rearm		(UpDaemon	*daemon);
+
+/**
+ * up_daemon_poll_predict_crossing:
+ *
+ * Predicts how long it will take a discharging device to reach the next
+ * warning level threshold, using the same policy as
+ * up_daemon_compute_warning_level().
+ *
+ * Return value: the number of seconds, or -1 if unknown
+ **/
+static gint64
+up_daemon_poll_predict_crossing (UpDaemon	*daemon,
+				 TimeoutData	*data,
+				 gint64		 now,
+				 UpDeviceState	 state,
+				 UpDeviceKind	 kind,
+				 gboolean	 power_supply,
+				 gdouble	 percentage,
+				 gdouble	 energy_full,
+				 gdouble	 energy_rate,
+				 gint64		 time_to_empty,
+				 gdouble	*threshold,
+				 gboolean	*in_time)
+{
+	UpDaemonPrivate *priv = daemon->priv;
+	gdouble thresholds[3];
+	gdouble slope = 0.0f;
+	gdouble elapsed;
+	guint i;
+
+	if (state != UP_DEVICE_STATE_DISCHARGING)
+		return -1;
+
+	/* time based policy, the time left goes down with the clock */
+	if (kind != UP_DEVICE_KIND_MOUSE &&
+	    kind != UP_DEVICE_KIND_KEYBOARD &&
+	    power_supply &&
+	    !priv->use_percentage_for_policy &&
+	    time_to_empty > 0) {
+		thresholds[0] = priv->low_time;
+		thresholds[1] = priv->critical_time;
+		thresholds[2] = priv->action_time;
+		for (i = 0; i < G_N_ELEMENTS (thresholds); i++) {
+			if (time_to_empty > thresholds[i]) {
+				*threshold = thresholds[i];
+				*in_time = TRUE;
+				return time_to_empty - thresholds[i];
+			}
+		}
+		return -1;
+	}
+
+	if (kind == UP_DEVICE_KIND_MOUSE ||
+	    kind == UP_DEVICE_KIND_KEYBOARD) {
+		thresholds[0] = 26.0f;
+		thresholds[1] = 13.0f;
+		thresholds[2] = 0.0f;
+	} else {
+		thresholds[0] = priv->low_percentage;
+		thresholds[1] = priv->critical_percentage;
+		thresholds[2] = priv->action_percentage;
+	}
+
+	/* percent per second, from the rate if we have one, or else from
+	 * what we saw since the last poll */
+	if (energy_full > 0.0f && energy_rate > 0.0f) {
+		slope = energy_rate / energy_full * 100.0f / 3600.0f;
+	} else if (data->has_last && now > data->last_time) {
+		elapsed = (gdouble) (now - data->last_time) / G_USEC_PER_SEC;
+		slope = (data->last_percentage - percentage) / elapsed;
+	}
+	if (slope <= 0.0f)
+		return -1;
+
+	for (i = 0; i < G_N_ELEMENTS (thresholds); i++) {
+		if (percentage > thresholds[i]) {
+			*threshold = thresholds[i];
+			*in_time = FALSE;
+			return (percentage - thresholds[i]) / slope;
+		}
+	}
+	return -1;
+}
+
+/**
+ * up_daemon_poll_check_prediction:
+ *
+ * Once the device went past the threshold we predicted, records how far
+ * off the prediction was.
+ **/
 static void
-change_idle_timeout (UpDevice   *device,
-		     GParamSpec *pspec,
-		     gpointer    user_data)
+up_daemon_poll_check_prediction (UpDaemon	*daemon,
+				 TimeoutData	*data,
+				 gint64		 now,
+				 UpDeviceState	 state,
+				 gdouble	 percentage,
+				 gint64		 time_to_empty)
 {
-	TimeoutData *data;
-	GSourceFunc callback;
-	UpDaemon *daemon;
+	UpDaemonPollStats *stats = &daemon->priv->poll_stats;
+	gboolean crossed;
+	gint64 error;
 
-	daemon = up_device_get_daemon (device);
+	if (data->predicted_crossing == 0)
+		return;
 
-	data = g_hash_table_lookup (daemon->priv->poll_timeouts, device);
-	callback = data->callback;
+	/* not discharging anymore, the prediction is moot */
+	if (state != UP_DEVICE_STATE_DISCHARGING) {
+		data->predicted_crossing = 0;
+		return;
+	}
+
+	if (data->predicted_in_time)
+		crossed = time_to_empty > 0 && time_to_empty <= data->predicted_threshold;
+	else
+		crossed = percentage <= data->predicted_threshold;
+	if (!crossed)
+		return;
 
-	up_daemon_stop_poll (G_OBJECT (device));
-	up_daemon_start_poll (G_OBJECT (device), callback);
+	error = ABS (now - data->predicted_crossing) / G_USEC_PER_SEC;
+	stats->predictions++;
+	stats->prediction_error_total += error;
+	stats->last_prediction_error = error;
+	stats->max_prediction_error = MAX (stats->max_prediction_error, error);
+	g_debug ("Threshold crossing for '%s' predicted %" G_GINT64_FORMAT "s off",
+		 up_device_get_object_path (data->device), error);
+	data->predicted_crossing = 0;
 }
 
+/**
+ * up_daemon_get_poll_timeout:
+ * @timeout: the current poll interval, in seconds
+ * @uevents_reliable: if the kernel sends change events for the device
+ * @delta: how much the percentage moved since the previous refresh
+ * @crossing: seconds until the next warning level, or -1 if unknown
+ *
+ * Works out the next poll interval of a device from how much it changed
+ * since the previous refresh. Devices that sit unchanged while charged or
+ * on AC get polled less and less often, up to PollIntervalMax, while fast
+ * changing devices are polled often enough to see every percent.
+ *
+ * Discharging devices are also polled just before they are predicted to
+ * reach the next warning level, so the warning is never late by more than
+ * UP_DAEMON_POLL_INTERVAL_MIN seconds. This holds for devices that send
+ * uevents too, which are otherwise only polled every PollWatchdogInterval.
+ *
+ * Return value: the next poll interval, in seconds
+ **/
+guint
+up_daemon_get_poll_timeout (UpDaemon		*daemon,
+			    guint		 timeout,
+			    gboolean		 uevents_reliable,
+			    gdouble		 delta,
+			    UpDeviceState	 state,
+			    gdouble		 percentage,
+			    gdouble		 energy_full,
+			    gdouble		 energy_rate,
+			    gint64		 crossing)
+{
+	UpDaemonPrivate *priv = daemon->priv;
+
+	timeout = MAX (timeout, UP_DAEMON_POLL_INTERVAL_MIN);
+	if (uevents_reliable) {
+		/* the kernel tells us about changes, so polling is only a
+		 * safety net, but not all drivers send one as the charge drops */
+		timeout = priv->poll_watchdog;
+	} else if (priv->poll_interval_max <= UP_DAEMON_POLL_INTERVAL_MIN) {
+		return UP_DAEMON_POLL_INTERVAL_MIN;
+	} else if (delta >= UP_DAEMON_POLL_FLAT_DELTA) {
+		/* still moving, come back sooner */
+		timeout = MAX (timeout / 2, UP_DAEMON_POLL_INTERVAL_MIN);
+	} else if (state == UP_DEVICE_STATE_FULLY_CHARGED ||
+		   !priv->on_battery ||
+		   crossing >= 0) {
+		/* nothing happening, or we know when it will */
+		timeout = MIN (timeout * 2, priv->poll_interval_max);
+	} else if (state == UP_DEVICE_STATE_DISCHARGING &&
+		   percentage <= 2 * priv->low_percentage) {
+		/* getting close to the low level with no idea how fast */
+		return UP_DAEMON_POLL_INTERVAL_MIN;
+	}
+
+	/* don't move by more than 1% between two polls */
+	if (energy_full > 0.0f && energy_rate > 0.0f)
+		timeout = MIN (timeout, MAX (3600.0f * energy_full / (100.0f * energy_rate),
+					     UP_DAEMON_POLL_INTERVAL_MIN));
+
+	/* be there just before the next warning level */
+	if (crossing >= 0)
+		timeout = MIN (timeout, MAX (crossing - UP_DAEMON_POLL_INTERVAL_MIN,
+					     UP_DAEMON_POLL_INTERVAL_MIN));
+
+	return timeout;
+}
+
+/**
+ * calculate_timeout:
+ *
+ * Works out the next poll interval of a polled device after a refresh,
+ * keeping track of what is needed to predict when it will reach the next
+ * warning level.
+ **/
+static guint
+calculate_timeout (UpDaemon *daemon, TimeoutData *data)
+{
+	UpDeviceState state;
+	UpDeviceKind kind;
+	gboolean power_supply;
+	gdouble percentage;
+	gdouble energy_full;
+	gdouble energy_rate;
+	gdouble threshold = 0.0f;
+	gboolean in_time = FALSE;
+	gdouble delta;
+	gint64 time_to_empty;
+	gint64 crossing;
+	gint64 now;
+	gboolean had_last;
+
+	g_object_get (data->device,
+		      "state", &state,
+		      "type", &kind,
+		      "power-supply", &power_supply,
+		      "percentage", &percentage,
+		      "energy-full", &energy_full,
+		      "energy-rate", &energy_rate,
+		      "time-to-empty", &time_to_empty,
+		      NULL);
+
+	now = g_get_monotonic_time ();
+	up_daemon_poll_check_prediction (daemon, data, now, state, percentage, time_to_empty);
+	crossing = up_daemon_poll_predict_crossing (daemon, data, now, state, kind,
+						    power_supply, percentage, energy_full,
+						    energy_rate, time_to_empty,
+						    &threshold, &in_time);
+
+	had_last = data->has_last;
+	delta = fabs (percentage - data->last_percentage);
+	data->last_percentage = percentage;
+	data->last_time = now;
+	data->has_last = TRUE;
+
+	/* keep the first prediction for a threshold, so we measure how good
+	 * it was from afar, not how good the last one before crossing was */
+	if (crossing >= 0 &&
+	    (data->predicted_crossing == 0 ||
+	     data->predicted_threshold != threshold ||
+	     data->predicted_in_time != in_time)) {
+		data->predicted_crossing = now + crossing * G_USEC_PER_SEC;
+		data->predicted_threshold = threshold;
+		data->predicted_in_time = in_time;
+	}
+
+	if (!had_last)
+		return UP_DAEMON_POLL_INTERVAL_MIN;
+
+	return up_daemon_get_poll_timeout (daemon, data->timeout,
+					   data->uevents_since_miss >= UP_DAEMON_UEVENT_RELIABLE,
+					   delta, state, percentage, energy_full,
+					   energy_rate, crossing);
+}
+
+/**
+ * up_daemon_poll_compare_cb:
+ *
+ * Orders the poll queue by next due time, earliest first.
+ **/
+static gint
+up_daemon_poll_compare_cb (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+	const TimeoutData *data_a = a;
+	const TimeoutData *data_b = b;
+
+	if (data_a->due < data_b->due)
+		return -1;
+	if (data_a->due > data_b->due)
+		return 1;
+	return 0;
+}
+
+/**
+ * up_daemon_poll_align:
+ *
+ * Returns the first multiple of @timeout seconds after @time. Deadlines
+ * are kept on this grid so that devices with the same (or a multiple of
+ * the same) interval always come due on the same tick, instead of each
+ * one drifting according to when it was added.
+ **/
+static gint64
+up_daemon_poll_align (gint64 time, guint timeout)
+{
+	gint64 period = (gint64) MAX (timeout, 1) * G_USEC_PER_SEC;
+	return (time / period + 1) * period;
+}
+
+/**
+ * up_daemon_poll_set_due:
+ **/
 static void
-device_destroyed (gpointer  user_data,
-		  GObject  *where_the_object_was)
+up_daemon_poll_set_due (UpDaemon *daemon, TimeoutData *data, gint64 due)
+{
+	data->due = due;
+	if (data->iter == NULL)
+		data->iter = g_sequence_insert_sorted (daemon->priv->poll_queue, data,
+						       up_daemon_poll_compare_cb, NULL);
+	else
+		g_sequence_sort_changed (data->iter, up_daemon_poll_compare_cb, NULL);
+}
+
+/**
+ * up_daemon_poll_remove:
+ **/
+static void
+up_daemon_poll_remove (UpDaemon *daemon, TimeoutData *data)
+{
+	if (data->iter != NULL)
+		g_sequence_remove (data->iter);
+	g_hash_table_remove (daemon->priv->poll_timeouts, data->device);
+	up_daemon_poll_rearm (daemon);
+}
+
+/**
+ * up_daemon_poll_refreshed:
+ *
+ * Called once a polled device has been refreshed, to work out when to
+ * poll it next.
+ **/
+static void
+up_daemon_poll_refreshed (UpDaemon *daemon, UpDevice *device)
 {
-	UpDaemon *daemon = user_data;
 	TimeoutData *data;
+	UpDeviceState state;
+	gdouble percentage;
+	guint timeout;
 
-	data = g_hash_table_lookup (daemon->priv->poll_timeouts, where_the_object_was);
+	/* the refresh may have stopped the poll */
+	data = g_hash_table_lookup (daemon->priv->poll_timeouts, device);
 	if (data == NULL)
 		return;
-	g_source_remove (data->id);
-	g_hash_table_remove (daemon->priv->poll_timeouts, where_the_object_was);
+
+	/* the poll found something the kernel did not tell us about,
+	 * unless the refresh of a uevent was merged into this one */
+	g_object_get (device,
+		      "state", &state,
+		      "percentage", &percentage,
+		      NULL);
+	if (data->uevents_queued == 0 &&
+	    (state != data->poll_state || percentage != data->poll_percentage)) {
+		data->uevent_misses++;
+		if (data->uevents_since_miss >= UP_DAEMON_UEVENT_RELIABLE)
+			g_debug ("Missed uevent for '%s' (%u so far), going back to polling",
+				 up_device_get_object_path (device), data->uevent_misses);
+		data->uevents_since_miss = 0;
+	}
+
+	timeout = calculate_timeout (daemon, data);
+	if (timeout == data->timeout)
+		return;
+	g_debug ("Poll interval for '%s' now %u seconds",
+		 up_device_get_object_path (device), timeout);
+	data->timeout = timeout;
+	up_daemon_poll_set_due (daemon, data,
+				up_daemon_poll_align (g_get_monotonic_time () + UP_DAEMON_POLL_SLACK, timeout));
+}
+
+/**
+ * up_daemon_poll_refreshed_cb:
+ **/
+static void
+up_daemon_poll_refreshed_cb (UpDevice *device, gboolean ret, gpointer user_data)
+{
+	UpDaemon *daemon = UP_DAEMON (user_data);
+
+	up_daemon_poll_refreshed (daemon, device);
+	up_daemon_poll_rearm (daemon);
+	g_object_unref (daemon);
 }
 
+/**
+ * up_daemon_poll_tick_cb:
+ *
+ * Refreshes every device that is due in one go, so the daemon only
+ * wakes up once no matter how many devices are being polled.
+ **/
 static gboolean
-fire_timeout_callback (gpointer user_data)
+up_daemon_poll_tick_cb (gpointer user_data)
 {
-	UpDevice *device = user_data;
+	UpDaemon *daemon = UP_DAEMON (user_data);
+	UpDaemonPrivate *priv = daemon->priv;
+	GSequenceIter *iter;
+	GPtrArray *batch;
 	TimeoutData *data;
-	UpDaemon *daemon;
+	UpDevice *device;
+	gint64 now;
+	gint64 dispatch;
+	guint i;
 
-	daemon = up_device_get_daemon (device);
+	priv->poll_source_id = 0;
+	now = g_get_monotonic_time ();
 
-	data = g_hash_table_lookup (daemon->priv->poll_timeouts, device);
-	g_assert (data);
+	/* take everything that is due, and move it to its next slot
+	 * before running any callback, as callbacks can stop or restart
+	 * polling */
+	batch = g_ptr_array_new_with_free_func (g_object_unref);
+	for (;;) {
+		iter = g_sequence_get_begin_iter (priv->poll_queue);
+		if (g_sequence_iter_is_end (iter))
+			break;
+		data = g_sequence_get (iter);
+		if (data->due > now + UP_DAEMON_POLL_SLACK)
+			break;
+		g_ptr_array_add (batch, g_object_ref (data->device));
+		up_daemon_poll_set_due (daemon, data,
+					up_daemon_poll_align (MAX (now + UP_DAEMON_POLL_SLACK, data->due), data->timeout));
+	}
 
-	g_debug ("Firing timeout for '%s' after %u seconds",
-		 up_device_get_object_path (device), data->timeout);
+	for (i = 0; i < batch->len; i++) {
+		device = g_ptr_array_index (batch, i);
 
-	/* Fire the actual callback */
-	(data->callback) (device);
+		/* stopped by one of the previous callbacks */
+		data = g_hash_table_lookup (priv->poll_timeouts, device);
+		if (data == NULL)
+			continue;
+
+		g_debug ("Firing timeout for '%s' after %u seconds",
+			 up_device_get_object_path (device), data->timeout);
+		g_object_get (device,
+			      "state", &data->poll_state,
+			      "percentage", &data->poll_percentage,
+			      NULL);
+
+		/* slow devices get refreshed in a thread */
+		if (UP_DEVICE_GET_CLASS (device)->refresh_read != NULL) {
+			up_device_refresh_async (device, up_daemon_poll_refreshed_cb,
+						 g_object_ref (daemon));
+			continue;
+		}
 
-	return G_SOURCE_CONTINUE;
+		(data->callback) (device);
+		up_daemon_poll_refreshed (daemon, device);
+	}
+	dispatch = g_get_monotonic_time () - now;
+
+	/* keep some numbers around to check we really coalesce */
+	priv->poll_stats.ticks++;
+	priv->poll_stats.refreshes += batch->len;
+	priv->poll_stats.last_batch_size = batch->len;
+	priv->poll_stats.max_batch_size = MAX (priv->poll_stats.max_batch_size, batch->len);
+	priv->poll_stats.last_dispatch_time = dispatch;
+	priv->poll_stats.max_dispatch_time = MAX (priv->poll_stats.max_dispatch_time, dispatch);
+	g_debug ("Poll tick %u refreshed %u device(s) in %" G_GINT64_FORMAT "us",
+		 priv->poll_stats.ticks, batch->len, dispatch);
+
+	g_ptr_array_unref (batch);
+	up_daemon_poll_rearm (daemon);
+	return G_SOURCE_REMOVE;
 }
 
-static guint
-calculate_timeout (UpDevice *device)
+/**
+ * up_daemon_poll_rearm:
+ *
+ * Makes sure the single poll timeout fires when the earliest device is due.
+ **/
+static void
+up_daemon_poll_rearm (UpDaemon *daemon)
 {
-	return 5;
-/*	UpDeviceLevel warning_level;
+	UpDaemonPrivate *priv = daemon->priv;
+	GSequenceIter *iter;
+	TimeoutData *data;
+	gint64 now;
+	guint delay = 0;
+
+	iter = g_sequence_get_begin_iter (priv->poll_queue);
+	if (g_sequence_iter_is_end (iter)) {
+		if (priv->poll_source_id != 0) {
+			g_source_remove (priv->poll_source_id);
+			priv->poll_source_id = 0;
+		}
+		return;
+	}
+	data = g_sequence_get (iter);
 
-	g_object_get (G_OBJECT (device), "warning-level", &warning_level, NULL);
-	if (warning_level >= UP_DEVICE_LEVEL_DISCHARGING)
-		return 30;
-	return 120;
-*/
+	/* already armed for this deadline */
+	if (priv->poll_source_id != 0 && priv->poll_source_due == data->due)
+		return;
+	if (priv->poll_source_id != 0)
+		g_source_remove (priv->poll_source_id);
+
+	now = g_get_monotonic_time ();
+	if (data->due > now)
+		delay = (data->due - now + 999) / 1000;
+	priv->poll_source_due = data->due;
+	priv->poll_source_id = g_timeout_add (delay, up_daemon_poll_tick_cb, daemon);
+	g_source_set_name_by_id (priv->poll_source_id, "[upower] up_daemon_poll_tick_cb");
 }
 
+static void
+change_idle_timeout (UpDevice   *device,
+		     GParamSpec *pspec,
+		     gpointer    user_data)
+{
+	UpDaemon *daemon = UP_DAEMON (user_data);
+	TimeoutData *data;
+
+	data = g_hash_table_lookup (daemon->priv->poll_timeouts, device);
+	if (data == NULL)
+		return;
+
+	/* the warning level changed, so the interval is likely too long */
+	data->timeout = UP_DAEMON_POLL_INTERVAL_MIN;
+	up_daemon_poll_set_due (daemon, data,
+				up_daemon_poll_align (g_get_monotonic_time (), data->timeout));
+	up_daemon_poll_rearm (daemon);
+}
+
+static void
+device_destroyed (gpointer  user_data,
+		  GObject  *where_the_object_was)
+{
+	UpDaemon *daemon = user_data;
+	TimeoutData *data;
+
+	data = g_hash_table_lookup (daemon->priv->poll_timeouts, where_the_object_was);
+	if (data == NULL)
+		return;
+	up_daemon_poll_remove (daemon, data);
+}
+
+/**
+ * up_daemon_start_poll:
+ *
+ * Devices implementing refresh_read() and refresh_apply() are refreshed in
+ * the refresh threads rather than by calling @callback.
+ **/
 void
 up_daemon_start_poll (GObject     *object,
 		      GSourceFunc  callback)
@@ -940,38 +1832,35 @@ up_daemon_start_poll (GObject     *object,
 	UpDaemon *daemon;
 	UpDevice *device;
 	TimeoutData *data;
-	guint timeout;
-	char *name;
 
 	device = UP_DEVICE (object);
 	daemon = up_device_get_daemon (device);
+	g_return_if_fail (daemon != NULL);
 
 	if (g_hash_table_lookup (daemon->priv->poll_timeouts, device) != NULL) {
 		g_warning ("Poll already started for device '%s'",
 			   up_device_get_object_path (device));
-		return;
+		goto out;
 	}
 
 	data = g_new0 (TimeoutData, 1);
+	data->device = device;
 	data->callback = callback;
+	data->timeout = UP_DAEMON_POLL_INTERVAL_MIN;
+	g_hash_table_insert (daemon->priv->poll_timeouts, device, data);
 
-	timeout = calculate_timeout (device);
-	data->timeout = timeout;
-
-	g_signal_connect (device, "notify::warning-level",
-			  G_CALLBACK (change_idle_timeout), NULL);
+	data->notify_id = g_signal_connect (device, "notify::warning-level",
+					    G_CALLBACK (change_idle_timeout), daemon);
 	g_object_weak_ref (object, device_destroyed, daemon);
 
-	data->id = g_timeout_add_seconds (timeout, fire_timeout_callback, device);
-	name = g_strdup_printf ("[upower] UpDevice::poll for %s (%u secs)",
-				up_device_get_object_path (device), timeout);
-	g_source_set_name_by_id (data->id, name);
-	g_free (name);
-
-	g_hash_table_insert (daemon->priv->poll_timeouts, device, data);
+	up_daemon_poll_set_due (daemon, data,
+				up_daemon_poll_align (g_get_monotonic_time (), data->timeout));
+	up_daemon_poll_rearm (daemon);
 
 	g_debug ("Setup poll for '%s' every %u seconds",
-		 up_device_get_object_path (device), timeout);
+		 up_device_get_object_path (device), data->timeout);
+out:
+	g_object_unref (daemon);
 }
 
 void
@@ -983,14 +1872,107 @@ up_daemon_stop_poll (GObject *object)
 
 	device = UP_DEVICE (object);
 	daemon = up_device_get_daemon (device);
+	if (daemon == NULL)
+		return;
 
 	data = g_hash_table_lookup (daemon->priv->poll_timeouts, device);
 	if (data == NULL)
-		return;
+		goto out;
 
-	g_source_remove (data->id);
+	g_signal_handler_disconnect (device, data->notify_id);
 	g_object_weak_unref (object, device_destroyed, daemon);
-	g_hash_table_remove (daemon->priv->poll_timeouts, device);
+	up_daemon_poll_remove (daemon, data);
+out:
+	g_object_unref (daemon);
+}
+
+/**
+ * up_daemon_poll_uevent_queued:
+ *
+ * Called by the backend when the kernel sent a change event for the device,
+ * before queueing the refresh for it.
+ **/
+void
+up_daemon_poll_uevent_queued (GObject *object)
+{
+	UpDevice *device;
+	TimeoutData *data;
+	UpDaemon *daemon;
+
+	device = UP_DEVICE (object);
+	daemon = up_device_get_daemon (device);
+	if (daemon == NULL)
+		return;
+
+	data = g_hash_table_lookup (daemon->priv->poll_timeouts, device);
+	if (data != NULL)
+		data->uevents_queued++;
+	g_object_unref (daemon);
+}
+
+/**
+ * up_daemon_poll_uevent:
+ *
+ * Called by the backend once the refresh for a change event of the device
+ * has been applied. Devices that keep sending them are then only polled if
+ * no event arrives within PollWatchdogInterval.
+ **/
+void
+up_daemon_poll_uevent (GObject *object)
+{
+	UpDevice *device;
+	TimeoutData *data;
+	UpDaemon *daemon;
+
+	device = UP_DEVICE (object);
+	daemon = up_device_get_daemon (device);
+	if (daemon == NULL)
+		return;
+
+	data = g_hash_table_lookup (daemon->priv->poll_timeouts, device);
+	if (data == NULL)
+		goto out;
+	if (data->uevents_queued > 0)
+		data->uevents_queued--;
+
+	/* the next poll should only report what changed after this */
+	g_object_get (device,
+		      "state", &data->poll_state,
+		      "percentage", &data->poll_percentage,
+		      NULL);
+
+	data->uevents_since_miss++;
+	if (data->uevents_since_miss < UP_DAEMON_UEVENT_RELIABLE) {
+		/* and not back off less because of it */
+		data->last_percentage = data->poll_percentage;
+		goto out;
+	}
+	if (data->uevents_since_miss == UP_DAEMON_UEVENT_RELIABLE)
+		g_debug ("'%s' sends uevents, polling every %u seconds",
+			 up_device_get_object_path (device), daemon->priv->poll_watchdog);
+
+	/* push the watchdog back, though not past the next warning level */
+	data->timeout = calculate_timeout (daemon, data);
+	up_daemon_poll_set_due (daemon, data,
+				up_daemon_poll_align (g_get_monotonic_time (), data->timeout));
+	up_daemon_poll_rearm (daemon);
+out:
+	g_object_unref (daemon);
+}
+
+/**
+ * up_daemon_get_poll_stats:
+ *
+ * Gets the counters of the poll scheduler, which can be used to check how
+ * many devices get refreshed for each wakeup.
+ **/
+void
+up_daemon_get_poll_stats (UpDaemon *daemon, UpDaemonPollStats *stats)
+{
+	g_return_if_fail (UP_IS_DAEMON (daemon));
+	g_return_if_fail (stats != NULL);
+
+	*stats = daemon->priv->poll_stats;
 }
 
 /**
@@ -1051,6 +2033,7 @@ up_daemon_device_removed_cb (UpBackend *backend, GObject *native, UpDevice *devi
 		return;
 	}
 	g_signal_emit (daemon, signals[SIGNAL_DEVICE_REMOVED], 0, object_path);
+	up_daemon_subscribers_forget (daemon, object_path);
 
 	/* finalise the object */
 	g_object_unref (device);
@@ -1113,6 +2096,15 @@ up_daemon_init (UpDaemon *daemon)
 	load_percentage_policy (daemon, FALSE);
 	load_time_policy (daemon, FALSE);
 	policy_config_validate (daemon);
+	daemon->priv->poll_interval_max = up_config_get_uint (daemon->priv->config, "PollIntervalMax");
+	if (daemon->priv->poll_interval_max == 0)
+		daemon->priv->poll_interval_max = UP_DAEMON_POLL_INTERVAL_MAX;
+	daemon->priv->poll_watchdog = up_config_get_uint (daemon->priv->config, "PollWatchdogInterval");
+	if (daemon->priv->poll_watchdog == 0)
+		daemon->priv->poll_watchdog = UP_DAEMON_POLL_WATCHDOG;
+	daemon->priv->props_interval = up_config_get_uint (daemon->priv->config, "PropertiesChangedInterval");
+	daemon->priv->subscribers = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+							   (GDestroyNotify) up_daemon_subscriber_free);
 
 	daemon->priv->backend = up_backend_new ();
 	g_signal_connect (daemon->priv->backend, "device-added",
@@ -1122,6 +2114,7 @@ up_daemon_init (UpDaemon *daemon)
 
 	daemon->priv->poll_timeouts = g_hash_table_new_full (g_direct_hash, g_direct_equal,
 							     NULL, g_free);
+	daemon->priv->poll_queue = g_sequence_new (NULL);
 }
 
 /**
@@ -1214,6 +2207,17 @@ up_daemon_class_init (UpDaemonClass *klass)
 			      g_cclosure_marshal_generic,
 			      G_TYPE_NONE, 1, DBUS_TYPE_G_OBJECT_PATH);
 
+	/* never emitted, this only makes dbus-glib export it; the
+	 * signal is sent to each subscriber by hand */
+	signals[SIGNAL_SUBSCRIBED_PROPERTIES_CHANGED] =
+		g_signal_new ("subscribed-properties-changed",
+			      G_OBJECT_CLASS_TYPE (klass),
+			      G_SIGNAL_RUN_LAST,
+			      0, NULL, NULL,
+			      g_cclosure_marshal_generic,
+			      G_TYPE_NONE, 2, DBUS_TYPE_G_OBJECT_PATH,
+			      dbus_g_type_get_map ("GHashTable", G_TYPE_STRING, G_TYPE_VALUE));
+
 	g_object_class_install_property (object_class,
 					 PROP_DAEMON_VERSION,
 					 g_param_spec_string ("daemon-version",
@@ -1265,9 +2269,14 @@ up_daemon_finalize (GObject *object)
 	if (priv->props_idle_id != 0)
 		g_source_remove (priv->props_idle_id);
 
+	if (priv->poll_source_id != 0)
+		g_source_remove (priv->poll_source_id);
+
+	g_clear_pointer (&priv->poll_queue, g_sequence_free);
 	g_clear_pointer (&priv->poll_timeouts, g_hash_table_destroy);
 
 	g_clear_pointer (&daemon->priv->changed_props, g_hash_table_unref);
+	g_hash_table_unref (priv->subscribers);
 	if (priv->proxy != NULL)
 		g_object_unref (priv->proxy);
 	if (priv->connection != NULL)
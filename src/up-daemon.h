@@ -57,6 +57,39 @@ typedef enum
 	UP_DAEMON_NUM_ERRORS
 } UpDaemonError;
 
+typedef struct
+{
+	guint			 ticks;
+	guint			 refreshes;
+	guint			 last_batch_size;
+	guint			 max_batch_size;
+	gint64			 last_dispatch_time;	/* us */
+	gint64			 max_dispatch_time;	/* us */
+	guint			 predictions;
+	gint64			 prediction_error_total;	/* s */
+	gint64			 last_prediction_error;	/* s */
+	gint64			 max_prediction_error;	/* s */
+} UpDaemonPollStats;
+
+typedef struct
+{
+	guint			 sent;
+	guint			 suppressed;	/* merged into a later one by the window */
+	guint			 targeted;	/* sent to one subscriber only */
+} UpDaemonPropsStats;
+
+typedef enum {
+	UP_DAEMON_FILTER_ANY,		/* any change */
+	UP_DAEMON_FILTER_DELTA,		/* a change of at least threshold */
+	UP_DAEMON_FILTER_CROSSING	/* going from one side of threshold to the other */
+} UpDaemonFilterKind;
+
+typedef struct {
+	gchar			*property;
+	UpDaemonFilterKind	 kind;
+	gdouble			 threshold;
+} UpDaemonFilter;
+
 #define UP_DAEMON_ERROR up_daemon_error_quark ()
 
 GType up_daemon_error_get_type (void);
@@ -90,14 +123,47 @@ void		 up_daemon_emit_properties_changed (DBusGConnection	*gconnection,
 						    const gchar		*object_path,
 						    const gchar		*interface,
 						    GHashTable		*props);
-
+gboolean	 up_daemon_filter_matches	(const UpDaemonFilter	*filter,
+						 GVariant		*last,
+						 GVariant		*value);
+void		 up_daemon_emit_subscribed_properties_changed (UpDaemon *daemon,
+						    const gchar		*object_path,
+						    GHashTable		*props);
+guint		 up_daemon_get_properties_changed_delay (UpDaemon	*daemon,
+						 gint64			 last_sent,
+						 gboolean		 urgent);
+void		 up_daemon_count_properties_changed (UpDaemon	*daemon,
+						 guint			 suppressed);
+void		 up_daemon_get_props_stats	(UpDaemon		*daemon,
+						 UpDaemonPropsStats	*stats);
+
+guint		 up_daemon_get_poll_timeout	(UpDaemon		*daemon,
+						 guint			 timeout,
+						 gboolean		 uevents_reliable,
+						 gdouble		 delta,
+						 UpDeviceState		 state,
+						 gdouble		 percentage,
+						 gdouble		 energy_full,
+						 gdouble		 energy_rate,
+						 gint64			 crossing);
 void		 up_daemon_start_poll		(GObject		*object,
 						 GSourceFunc		 callback);
 void		 up_daemon_stop_poll		(GObject		*object);
+void		 up_daemon_poll_uevent_queued	(GObject		*object);
+void		 up_daemon_poll_uevent		(GObject		*object);
+void		 up_daemon_get_poll_stats	(UpDaemon		*daemon,
+						 UpDaemonPollStats	*stats);
 
 /* exported */
 gboolean	 up_daemon_enumerate_devices	(UpDaemon		*daemon,
 						 DBusGMethodInvocation	*context);
+gboolean	 up_daemon_enumerate_devices_with_properties (UpDaemon	*daemon,
+						 DBusGMethodInvocation	*context);
+gboolean	 up_daemon_subscribe		(UpDaemon		*daemon,
+						 GPtrArray		*filters,
+						 DBusGMethodInvocation	*context);
+gboolean	 up_daemon_unsubscribe		(UpDaemon		*daemon,
+						 DBusGMethodInvocation	*context);
 gboolean	 up_daemon_get_display_device   (UpDaemon		*daemon,
 						 DBusGMethodInvocation	*context);
 gboolean	 up_daemon_get_critical_action	(UpDaemon		*daemon,
@@ -32,6 +32,7 @@
 #include <dbus/dbus-glib.h>
 #include <dbus/dbus-glib-lowlevel.h>
 
+#include "up-config.h"
 #include "up-native.h"
 #include "up-device.h"
 #include "up-history.h"
@@ -40,6 +41,26 @@
 #include "up-marshal.h"
 #include "up-device-glue.h"
 
+#define UP_DEVICE_REFRESH_THREADS	4
+
+typedef struct {
+	UpDeviceRefreshFunc	 callback;
+	gpointer		 user_data;
+} UpDeviceRefreshCallback;
+
+struct UpDeviceRefreshJob
+{
+	UpDevice		*device;
+	gpointer		 values;
+	GArray			*callbacks;
+	gboolean		 again;		/* asked for after the read may have started */
+	gboolean		 changed;	/* by an earlier pass of this job */
+};
+
+static gboolean	up_device_refresh_done_cb	(gpointer	 user_data);
+
+static GThreadPool *up_device_refresh_pool = NULL;
+
 struct UpDevicePrivate
 {
 	gchar			*object_path;
@@ -48,10 +69,15 @@ struct UpDevicePrivate
 	UpHistory		*history;
 	GObject			*native;
 	gboolean		 has_ever_refresh;
+	UpDeviceRefreshJob	*refresh_job;
 
 	/* PropertiesChanged to be emitted */
 	GHashTable		*changed_props;
 	guint			 props_idle_id;
+	gboolean		 props_held;		/* props_idle_id is a timeout */
+	gint64			 props_last_sent;
+	guint			 props_suppressed;	/* signals merged into the held one */
+	guint			 props_batch_id;	/* changes were held this iteration */
 
 	/* properties */
 	guint64			 update_time;
@@ -125,11 +151,49 @@ G_DEFINE_TYPE (UpDevice, up_device, G_TYPE_OBJECT)
 	G_TYPE_UINT, G_TYPE_DOUBLE, G_TYPE_UINT, G_TYPE_INVALID))
 #define UP_DBUS_STRUCT_DOUBLE_DOUBLE (dbus_g_type_get_struct ("GValueArray", \
 	G_TYPE_DOUBLE, G_TYPE_DOUBLE, G_TYPE_INVALID))
+#define UP_DBUS_STRUCT_UINT_DOUBLE_ARRAY (dbus_g_type_get_struct ("GValueArray", \
+	G_TYPE_UINT, dbus_g_type_get_collection ("GArray", G_TYPE_DOUBLE), G_TYPE_INVALID))
 
 #define UP_DEVICES_DBUS_PATH "/org/freedesktop/UPower/devices"
 
+#define UP_DEVICE_HISTORY_TOLERANCE	2	/* percent */
+#define UP_DEVICE_HISTORY_MAX_GAP	300	/* seconds */
+
+/* D-Bus property names, indexed by property ID, so that queueing a
+ * change does not have to rebuild the name from the GObject one */
+static const gchar *up_device_dbus_names[PROP_LAST] = {
+	[PROP_NATIVE_PATH]		= "NativePath",
+	[PROP_VENDOR]			= "Vendor",
+	[PROP_MODEL]			= "Model",
+	[PROP_SERIAL]			= "Serial",
+	[PROP_UPDATE_TIME]		= "UpdateTime",
+	[PROP_TYPE]			= "Type",
+	[PROP_ONLINE]			= "Online",
+	[PROP_POWER_SUPPLY]		= "PowerSupply",
+	[PROP_CAPACITY]			= "Capacity",
+	[PROP_IS_PRESENT]		= "IsPresent",
+	[PROP_IS_RECHARGEABLE]		= "IsRechargeable",
+	[PROP_HAS_HISTORY]		= "HasHistory",
+	[PROP_HAS_STATISTICS]		= "HasStatistics",
+	[PROP_STATE]			= "State",
+	[PROP_ENERGY]			= "Energy",
+	[PROP_ENERGY_EMPTY]		= "EnergyEmpty",
+	[PROP_ENERGY_FULL]		= "EnergyFull",
+	[PROP_ENERGY_FULL_DESIGN]	= "EnergyFullDesign",
+	[PROP_ENERGY_RATE]		= "EnergyRate",
+	[PROP_VOLTAGE]			= "Voltage",
+	[PROP_LUMINOSITY]		= "Luminosity",
+	[PROP_TIME_TO_EMPTY]		= "TimeToEmpty",
+	[PROP_TIME_TO_FULL]		= "TimeToFull",
+	[PROP_PERCENTAGE]		= "Percentage",
+	[PROP_TEMPERATURE]		= "Temperature",
+	[PROP_TECHNOLOGY]		= "Technology",
+	[PROP_WARNING_LEVEL]		= "WarningLevel",
+	[PROP_ICON_NAME]		= "IconName",
+};
+
 static void up_device_queue_changed_property (UpDevice    *device,
-					      const gchar *property,
+					      guint        prop_id,
 					      GVariant    *value);
 
 /**
@@ -200,7 +264,7 @@ update_warning_level (UpDevice *device)
 	device->priv->warning_level = warning_level;
 	g_object_notify (G_OBJECT (device), "warning-level");
 
-	up_device_queue_changed_property (device, "warning-level", g_variant_new_uint32 (device->priv->warning_level));
+	up_device_queue_changed_property (device, PROP_WARNING_LEVEL, g_variant_new_uint32 (device->priv->warning_level));
 }
 
 static const gchar *
@@ -263,7 +327,7 @@ update_icon_name (UpDevice *device)
 	device->priv->icon_name = icon_name;
 	g_object_notify (G_OBJECT (device), "icon-name");
 
-	up_device_queue_changed_property (device, "icon-name", g_variant_new_string (device->priv->icon_name));
+	up_device_queue_changed_property (device, PROP_ICON_NAME, g_variant_new_string (device->priv->icon_name));
 }
 
 static gboolean
@@ -276,45 +340,95 @@ changed_props_idle_cb (gpointer user_data)
 					   device->priv->object_path,
 					   "org.freedesktop.UPower.Device",
 					   device->priv->changed_props);
+	if (device->priv->daemon != NULL)
+		up_daemon_emit_subscribed_properties_changed (device->priv->daemon,
+							      device->priv->object_path,
+							      device->priv->changed_props);
 	g_clear_pointer (&device->priv->changed_props, g_hash_table_unref);
 	device->priv->props_idle_id = 0;
+	device->priv->props_held = FALSE;
+	device->priv->props_last_sent = g_get_monotonic_time ();
+
+	if (device->priv->daemon != NULL)
+		up_daemon_count_properties_changed (device->priv->daemon,
+						    device->priv->props_suppressed);
+	device->priv->props_suppressed = 0;
+
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * up_device_props_batch_cb:
+ **/
+static gboolean
+up_device_props_batch_cb (gpointer user_data)
+{
+	UpDevice *device = user_data;
 
+	device->priv->props_batch_id = 0;
 	return G_SOURCE_REMOVE;
 }
 
 /**
  * up_device_queue_changed_property:
+ *
+ * Changes are sent at most once every PropertiesChangedInterval, with
+ * everything that changed in the meantime merged into one signal.
+ * State, WarningLevel and IsPresent changes are sent straight away,
+ * taking anything already held back with them.
  **/
 static void
 up_device_queue_changed_property (UpDevice    *device,
-				  const gchar *property,
+				  guint        prop_id,
 				  GVariant    *value)
 {
-	gchar *dbus_prop;
-	gchar **items;
-	guint i;
+	gboolean urgent;
+	guint delay = 0;
 
 	g_return_if_fail (UP_IS_DEVICE (device));
+	g_return_if_fail (prop_id < PROP_LAST && up_device_dbus_names[prop_id] != NULL);
 
 	if (device->priv->system_bus_connection == NULL)
 		return;
 
 	if (!device->priv->changed_props) {
 		device->priv->changed_props = g_hash_table_new_full (g_str_hash, g_str_equal,
-								     g_free, (GDestroyNotify) g_variant_unref);
+								     NULL, (GDestroyNotify) g_variant_unref);
 	}
 
-	items = g_strsplit (property, "-", -1);
-	for (i = 0; items[i] != NULL; i++)
-		*items[i] = g_ascii_toupper (*items[i]);
-	dbus_prop = g_strjoinv (NULL, items);
-	g_strfreev (items);
-
 	g_hash_table_insert (device->priv->changed_props,
-			     dbus_prop, value);
+			     (gpointer) up_device_dbus_names[prop_id], value);
+
+	urgent = (prop_id == PROP_STATE ||
+		  prop_id == PROP_WARNING_LEVEL ||
+		  prop_id == PROP_IS_PRESENT);
+	if (urgent && device->priv->props_held) {
+		g_source_remove (device->priv->props_idle_id);
+		device->priv->props_idle_id = 0;
+		device->priv->props_held = FALSE;
+	}
+	if (device->priv->props_idle_id != 0) {
+		/* without the window, each main loop iteration that changes
+		 * something would have sent a signal of its own */
+		if (device->priv->props_held && device->priv->props_batch_id == 0) {
+			device->priv->props_suppressed++;
+			device->priv->props_batch_id = g_idle_add (up_device_props_batch_cb, device);
+		}
+		return;
+	}
 
-	if (device->priv->props_idle_id == 0)
+	if (device->priv->daemon != NULL)
+		delay = up_daemon_get_properties_changed_delay (device->priv->daemon,
+								device->priv->props_last_sent,
+								urgent);
+	if (delay == 0) {
 		device->priv->props_idle_id = g_idle_add (changed_props_idle_cb, device);
+		return;
+	}
+	device->priv->props_idle_id = g_timeout_add (delay, changed_props_idle_cb, device);
+	device->priv->props_held = TRUE;
+	if (device->priv->props_batch_id == 0)
+		device->priv->props_batch_id = g_idle_add (up_device_props_batch_cb, device);
 }
 
 /**
@@ -422,6 +536,17 @@ static void
 up_device_set_property (GObject *object, guint prop_id, const GValue *value, GParamSpec *pspec)
 {
 	UpDevice *device = UP_DEVICE (object);
+	GValue old = { 0, };
+	gboolean unchanged;
+
+	/* most refreshes set every property to the value it already has,
+	 * so don't redo the side effects or queue a D-Bus change for those */
+	g_value_init (&old, G_PARAM_SPEC_VALUE_TYPE (pspec));
+	up_device_get_property (object, prop_id, &old, pspec);
+	unchanged = (g_param_values_cmp (pspec, &old, value) == 0);
+	g_value_unset (&old);
+	if (unchanged)
+		return;
 
 	switch (prop_id) {
 	case PROP_NATIVE_PATH:
@@ -524,9 +649,9 @@ up_device_set_property (GObject *object, guint prop_id, const GValue *value, GPa
 
 	if (G_VALUE_TYPE (value) == G_TYPE_STRING &&
 	    g_value_get_string (value) == NULL)
-		up_device_queue_changed_property (device, pspec->name, g_variant_new_string (""));
+		up_device_queue_changed_property (device, prop_id, g_variant_new_string (""));
 	else
-		up_device_queue_changed_property (device, pspec->name, dbus_g_value_build_g_variant (value));
+		up_device_queue_changed_property (device, prop_id, dbus_g_value_build_g_variant (value));
 }
 
 /**
@@ -663,6 +788,43 @@ up_device_get_daemon (UpDevice *device)
 	return g_object_ref (device->priv->daemon);
 }
 
+/**
+ * up_device_setup_history_compression:
+ *
+ * The rate and the times jitter from one refresh to the next, so only
+ * keep the samples needed to draw them within the configured tolerance.
+ **/
+static void
+up_device_setup_history_compression (UpDevice *device)
+{
+	UpConfig *config;
+	UpHistoryCompression compression = UP_HISTORY_COMPRESSION_SWINGING_DOOR;
+	gchar *mode;
+	gdouble tolerance = UP_DEVICE_HISTORY_TOLERANCE / 100.0f;
+	guint max_gap = UP_DEVICE_HISTORY_MAX_GAP;
+
+	config = up_config_new ();
+	mode = up_config_get_string (config, "HistoryCompression");
+	if (g_strcmp0 (mode, "None") == 0)
+		compression = UP_HISTORY_COMPRESSION_NONE;
+	else if (g_strcmp0 (mode, "Deadband") == 0)
+		compression = UP_HISTORY_COMPRESSION_DEADBAND;
+	if (up_config_get_uint (config, "HistoryCompressionTolerance") > 0)
+		tolerance = up_config_get_uint (config, "HistoryCompressionTolerance") / 100.0f;
+	if (up_config_get_uint (config, "HistoryCompressionMaxGap") > 0)
+		max_gap = up_config_get_uint (config, "HistoryCompressionMaxGap");
+	g_free (mode);
+	g_object_unref (config);
+
+	/* the charge is kept exactly, as the statistics are built from it */
+	up_history_set_compression (device->priv->history, UP_HISTORY_TYPE_RATE,
+				    compression, 0.1f, tolerance, max_gap);
+	up_history_set_compression (device->priv->history, UP_HISTORY_TYPE_TIME_FULL,
+				    compression, 60.0f, tolerance, max_gap);
+	up_history_set_compression (device->priv->history, UP_HISTORY_TYPE_TIME_EMPTY,
+				    compression, 60.0f, tolerance, max_gap);
+}
+
 /**
  * up_device_coldplug:
  *
@@ -707,6 +869,7 @@ up_device_coldplug (UpDevice *device, UpDaemon *daemon, GObject *native)
 	/* get the id so we can load the old history */
 	id = up_device_get_id (device);
 	if (id != NULL) {
+		up_device_setup_history_compression (device);
 		up_history_set_id (device->priv->history, id);
 		g_free (id);
 	}
@@ -802,38 +965,44 @@ out:
 }
 
 /**
- * up_device_get_history:
+ * up_device_history_type_from_string:
  **/
-gboolean
-up_device_get_history (UpDevice *device, const gchar *type_string, guint timespan, guint resolution, DBusGMethodInvocation *context)
+static UpHistoryType
+up_device_history_type_from_string (const gchar *type)
+{
+	if (g_strcmp0 (type, "rate") == 0)
+		return UP_HISTORY_TYPE_RATE;
+	if (g_strcmp0 (type, "charge") == 0)
+		return UP_HISTORY_TYPE_CHARGE;
+	if (g_strcmp0 (type, "time-full") == 0)
+		return UP_HISTORY_TYPE_TIME_FULL;
+	if (g_strcmp0 (type, "time-empty") == 0)
+		return UP_HISTORY_TYPE_TIME_EMPTY;
+	return UP_HISTORY_TYPE_UNKNOWN;
+}
+
+/**
+ * up_device_get_history_data:
+ *
+ * Gets the history for the GetHistory methods, or returns the error and
+ * %NULL.
+ **/
+static GPtrArray *
+up_device_get_history_data (UpDevice *device, const gchar *type_string, guint timespan, guint resolution, DBusGMethodInvocation *context)
 {
 	GError *error;
 	GPtrArray *array = NULL;
-	GPtrArray *complex;
-	UpHistoryItem *item;
-	GValue *value;
-	guint i;
-	UpHistoryType type = UP_HISTORY_TYPE_UNKNOWN;
-
-	g_return_val_if_fail (UP_IS_DEVICE (device), FALSE);
-	g_return_val_if_fail (type_string != NULL, FALSE);
+	UpHistoryType type;
 
 	/* doesn't even try to support this */
 	if (!device->priv->has_history) {
 		error = g_error_new (UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL, "device does not support getting history");
 		dbus_g_method_return_error (context, error);
-		goto out;
+		return NULL;
 	}
 
 	/* get the correct data */
-	if (g_strcmp0 (type_string, "rate") == 0)
-		type = UP_HISTORY_TYPE_RATE;
-	else if (g_strcmp0 (type_string, "charge") == 0)
-		type = UP_HISTORY_TYPE_CHARGE;
-	else if (g_strcmp0 (type_string, "time-full") == 0)
-		type = UP_HISTORY_TYPE_TIME_FULL;
-	else if (g_strcmp0 (type_string, "time-empty") == 0)
-		type = UP_HISTORY_TYPE_TIME_EMPTY;
+	type = up_device_history_type_from_string (type_string);
 
 	/* something recognised */
 	if (type != UP_HISTORY_TYPE_UNKNOWN)
@@ -843,8 +1012,29 @@ up_device_get_history (UpDevice *device, const gchar *type_string, guint timespa
 	if (array == NULL) {
 		error = g_error_new (UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL, "device has no history");
 		dbus_g_method_return_error (context, error);
-		goto out;
+		return NULL;
 	}
+	return array;
+}
+
+/**
+ * up_device_get_history:
+ **/
+gboolean
+up_device_get_history (UpDevice *device, const gchar *type_string, guint timespan, guint resolution, DBusGMethodInvocation *context)
+{
+	GPtrArray *array;
+	GPtrArray *complex;
+	UpHistoryItem *item;
+	GValue *value;
+	guint i;
+
+	g_return_val_if_fail (UP_IS_DEVICE (device), FALSE);
+	g_return_val_if_fail (type_string != NULL, FALSE);
+
+	array = up_device_get_history_data (device, type_string, timespan, resolution, context);
+	if (array == NULL)
+		goto out;
 
 	/* copy data to dbus struct */
 	complex = g_ptr_array_sized_new (array->len);
@@ -868,6 +1058,127 @@ out:
 	return TRUE;
 }
 
+/**
+ * up_device_get_history_packed:
+ *
+ * Like GetHistory, but as three arrays of fixed size types, which are
+ * marshalled as single blocks rather than one struct per point.
+ **/
+gboolean
+up_device_get_history_packed (UpDevice *device, const gchar *type_string, guint timespan, guint resolution, DBusGMethodInvocation *context)
+{
+	GPtrArray *array;
+	GArray *times = NULL;
+	GArray *values = NULL;
+	GArray *states = NULL;
+	UpHistoryItem *item;
+	guint i;
+	guint time_s;
+	guint state;
+	gdouble value;
+
+	g_return_val_if_fail (UP_IS_DEVICE (device), FALSE);
+	g_return_val_if_fail (type_string != NULL, FALSE);
+
+	array = up_device_get_history_data (device, type_string, timespan, resolution, context);
+	if (array == NULL)
+		goto out;
+
+	times = g_array_sized_new (FALSE, FALSE, sizeof (guint), array->len);
+	values = g_array_sized_new (FALSE, FALSE, sizeof (gdouble), array->len);
+	states = g_array_sized_new (FALSE, FALSE, sizeof (guint), array->len);
+	for (i=0; i<array->len; i++) {
+		item = (UpHistoryItem *) g_ptr_array_index (array, i);
+		time_s = up_history_item_get_time (item);
+		value = up_history_item_get_value (item);
+		state = up_history_item_get_state (item);
+		g_array_append_val (times, time_s);
+		g_array_append_val (values, value);
+		g_array_append_val (states, state);
+	}
+
+	dbus_g_method_return (context, times, values, states);
+out:
+	if (times != NULL)
+		g_array_unref (times);
+	if (values != NULL)
+		g_array_unref (values);
+	if (states != NULL)
+		g_array_unref (states);
+	if (array != NULL)
+		g_ptr_array_unref (array);
+	return TRUE;
+}
+
+/**
+ * up_device_query_history:
+ **/
+gboolean
+up_device_query_history (UpDevice *device, const gchar *type_string, guint start, guint end,
+			 guint bucket_seconds, gchar **aggregates, DBusGMethodInvocation *context)
+{
+	GError *error = NULL;
+	GError *error_local = NULL;
+	GArray *rows = NULL;
+	GArray *values;
+	GPtrArray *complex;
+	GValue *value;
+	guint i;
+	guint width;
+	UpHistoryType type;
+
+	g_return_val_if_fail (UP_IS_DEVICE (device), FALSE);
+	g_return_val_if_fail (type_string != NULL, FALSE);
+
+	/* doesn't even try to support this */
+	if (!device->priv->has_history) {
+		error = g_error_new (UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL, "device does not support getting history");
+		dbus_g_method_return_error (context, error);
+		goto out;
+	}
+
+	type = up_device_history_type_from_string (type_string);
+	if (type == UP_HISTORY_TYPE_UNKNOWN) {
+		error = g_error_new (UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL, "invalid history type '%s'", type_string);
+		dbus_g_method_return_error (context, error);
+		goto out;
+	}
+
+	/* the daemon does the reduction, so only the buckets go over the bus */
+	rows = up_history_query (device->priv->history, type, start, end,
+				 bucket_seconds, aggregates, &error_local);
+	if (rows == NULL) {
+		error = g_error_new (UP_DAEMON_ERROR, UP_DAEMON_ERROR_GENERAL, "failed to query history: %s", error_local->message);
+		dbus_g_method_return_error (context, error);
+		g_error_free (error_local);
+		goto out;
+	}
+
+	/* copy data to dbus struct, each row being the time then the values */
+	width = g_strv_length (aggregates) + 1;
+	complex = g_ptr_array_sized_new (rows->len / width);
+	values = g_array_sized_new (FALSE, FALSE, sizeof (gdouble), width - 1);
+	for (i = 0; i < rows->len; i += width) {
+		g_array_set_size (values, 0);
+		g_array_append_vals (values, &g_array_index (rows, gdouble, i + 1), width - 1);
+		value = g_new0 (GValue, 1);
+		g_value_init (value, UP_DBUS_STRUCT_UINT_DOUBLE_ARRAY);
+		g_value_take_boxed (value, dbus_g_type_specialized_construct (UP_DBUS_STRUCT_UINT_DOUBLE_ARRAY));
+		dbus_g_type_struct_set (value,
+					0, (guint) g_array_index (rows, gdouble, i),
+					1, values, -1);
+		g_ptr_array_add (complex, g_value_get_boxed (value));
+		g_free (value);
+	}
+	g_array_unref (values);
+
+	dbus_g_method_return (context, complex);
+out:
+	if (rows != NULL)
+		g_array_unref (rows);
+	return TRUE;
+}
+
 /**
  * up_device_refresh_internal:
  *
@@ -885,6 +1196,13 @@ up_device_refresh_internal (UpDevice *device)
 	if (klass->refresh == NULL)
 		goto out;
 
+	/* a thread is reading the device already; rather than have its
+	 * older values applied over ours, get it to read again */
+	if (device->priv->refresh_job != NULL) {
+		device->priv->refresh_job->again = TRUE;
+		goto out;
+	}
+
 	/* do the refresh */
 	ret = klass->refresh (device);
 	if (!ret) {
@@ -902,6 +1220,141 @@ out:
 	return ret;
 }
 
+/**
+ * up_device_refresh_thread_cb:
+ *
+ * Runs in one of the refresh threads, so only does the slow I/O.
+ **/
+static void
+up_device_refresh_thread_cb (gpointer job_data, gpointer user_data)
+{
+	UpDeviceRefreshJob *job = job_data;
+	UpDeviceClass *klass = UP_DEVICE_GET_CLASS (job->device);
+
+	job->values = klass->refresh_read (job->device);
+	g_idle_add (up_device_refresh_done_cb, job);
+}
+
+/**
+ * up_device_refresh_done_cb:
+ *
+ * Back in the main context, applies what the refresh thread read.
+ **/
+static gboolean
+up_device_refresh_done_cb (gpointer user_data)
+{
+	UpDeviceRefreshJob *job = user_data;
+	UpDevice *device = job->device;
+	UpDeviceClass *klass = UP_DEVICE_GET_CLASS (device);
+	UpDeviceRefreshCallback *cb;
+	gboolean ret;
+	guint i;
+
+	device->priv->refresh_job = NULL;
+	ret = klass->refresh_apply (device, job->values);
+	job->values = NULL;
+	if (!ret)
+		g_debug ("no changes");
+	else if (!device->priv->has_ever_refresh) {
+		g_debug ("added native-path: %s\n", device->priv->native_path);
+		device->priv->has_ever_refresh = TRUE;
+	}
+	ret = ret || job->changed;
+
+	/* read again for whoever asked while the thread was reading */
+	if (job->again) {
+		job->again = FALSE;
+		job->changed = ret;
+		device->priv->refresh_job = job;
+		g_thread_pool_push (up_device_refresh_pool, job, NULL);
+		return G_SOURCE_REMOVE;
+	}
+
+	for (i = 0; i < job->callbacks->len; i++) {
+		cb = &g_array_index (job->callbacks, UpDeviceRefreshCallback, i);
+		cb->callback (device, ret, cb->user_data);
+	}
+
+	g_array_unref (job->callbacks);
+	g_object_unref (job->device);
+	g_free (job);
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * up_device_refresh_async:
+ *
+ * Refreshes the device without blocking the main loop, for devices that
+ * split their refresh between reading (in a thread) and applying the new
+ * values (in the main context). Others are refreshed synchronously.
+ *
+ * There is only ever one refresh in progress for a device; if one is
+ * already running, it reads the device again once it is done, and
+ * @callback is called after that.
+ **/
+void
+up_device_refresh_async (UpDevice		*device,
+			 UpDeviceRefreshFunc	 callback,
+			 gpointer		 user_data)
+{
+	UpDeviceClass *klass = UP_DEVICE_GET_CLASS (device);
+	UpDeviceRefreshCallback cb;
+	UpDeviceRefreshJob *job;
+	GError *error = NULL;
+	gboolean ret;
+
+	g_return_if_fail (UP_IS_DEVICE (device));
+
+	if (klass->refresh_read == NULL || klass->refresh_apply == NULL) {
+		ret = up_device_refresh_internal (device);
+		if (callback != NULL)
+			callback (device, ret, user_data);
+		return;
+	}
+
+	cb.callback = callback;
+	cb.user_data = user_data;
+
+	/* coalesce with the refresh already in flight */
+	job = device->priv->refresh_job;
+	if (job != NULL) {
+		job->again = TRUE;
+		if (callback != NULL)
+			g_array_append_val (job->callbacks, cb);
+		return;
+	}
+
+	if (up_device_refresh_pool == NULL) {
+		up_device_refresh_pool = g_thread_pool_new (up_device_refresh_thread_cb, NULL,
+							    UP_DEVICE_REFRESH_THREADS, FALSE, &error);
+		if (up_device_refresh_pool == NULL) {
+			g_warning ("failed to create refresh threads: %s", error->message);
+			g_error_free (error);
+			ret = up_device_refresh_internal (device);
+			if (callback != NULL)
+				callback (device, ret, user_data);
+			return;
+		}
+	}
+
+	job = g_new0 (UpDeviceRefreshJob, 1);
+	job->device = g_object_ref (device);
+	job->callbacks = g_array_new (FALSE, FALSE, sizeof (UpDeviceRefreshCallback));
+	if (callback != NULL)
+		g_array_append_val (job->callbacks, cb);
+	device->priv->refresh_job = job;
+	g_thread_pool_push (up_device_refresh_pool, job, NULL);
+}
+
+/**
+ * up_device_refresh_method_cb:
+ **/
+static void
+up_device_refresh_method_cb (UpDevice *device, gboolean ret, gpointer user_data)
+{
+	dbus_g_method_return ((DBusGMethodInvocation *) user_data);
+}
+
 /**
  * up_device_refresh:
  *
@@ -910,13 +1363,55 @@ out:
 gboolean
 up_device_refresh (UpDevice *device, DBusGMethodInvocation *context)
 {
-	gboolean ret;
-
 	g_return_val_if_fail (UP_IS_DEVICE (device), FALSE);
 
-	ret = up_device_refresh_internal (device);
-	dbus_g_method_return (context);
-	return ret;
+	up_device_refresh_async (device, up_device_refresh_method_cb, context);
+	return TRUE;
+}
+
+/**
+ * up_device_value_free:
+ **/
+static void
+up_device_value_free (GValue *value)
+{
+	g_value_unset (value);
+	g_free (value);
+}
+
+/**
+ * up_device_get_properties:
+ *
+ * Gets all the properties exported on the bus, as D-Bus names mapped
+ * to #GValue's, which is how dbus-glib marshals a{sv}.
+ **/
+GHashTable *
+up_device_get_properties (UpDevice *device)
+{
+	guint i;
+	guint n_pspecs;
+	GParamSpec **pspecs;
+	GValue *value;
+	GHashTable *props;
+
+	g_return_val_if_fail (UP_IS_DEVICE (device), NULL);
+
+	props = g_hash_table_new_full (g_str_hash, g_str_equal,
+				       NULL, (GDestroyNotify) up_device_value_free);
+	pspecs = g_object_class_list_properties (G_OBJECT_GET_CLASS (device), &n_pspecs);
+	for (i = 0; i < n_pspecs; i++) {
+		/* subclasses number their own properties from 1 too */
+		if (pspecs[i]->owner_type != UP_TYPE_DEVICE ||
+		    pspecs[i]->param_id >= PROP_LAST ||
+		    up_device_dbus_names[pspecs[i]->param_id] == NULL)
+			continue;
+		value = g_new0 (GValue, 1);
+		g_value_init (value, pspecs[i]->value_type);
+		g_object_get_property (G_OBJECT (device), pspecs[i]->name, value);
+		g_hash_table_insert (props, (gpointer) up_device_dbus_names[pspecs[i]->param_id], value);
+	}
+	g_free (pspecs);
+	return props;
 }
 
 /**
@@ -1038,6 +1533,9 @@ up_device_finalize (GObject *object)
 		g_object_unref (device->priv->daemon);
 	if (device->priv->props_idle_id != 0)
 		g_source_remove (device->priv->props_idle_id);
+	if (device->priv->props_batch_id != 0)
+		g_source_remove (device->priv->props_batch_id);
+	g_clear_pointer (&device->priv->changed_props, g_hash_table_unref);
 	g_object_unref (device->priv->history);
 	g_free (device->priv->object_path);
 	g_free (device->priv->vendor);
@@ -37,6 +37,7 @@ G_BEGIN_DECLS
 #define UP_DEVICE_GET_CLASS(o) (G_TYPE_INSTANCE_GET_CLASS ((o), UP_TYPE_DEVICE, UpDeviceClass))
 
 typedef struct UpDevicePrivate UpDevicePrivate;
+typedef struct UpDeviceRefreshJob UpDeviceRefreshJob;
 
 typedef struct
 {
@@ -51,6 +52,12 @@ typedef struct
 	/* vtable */
 	gboolean	 (*coldplug)		(UpDevice	*device);
 	gboolean	 (*refresh)		(UpDevice	*device);
+	/* optional, split refresh: read runs in a thread and must not
+	 * touch the GObject, apply runs in the main context and frees
+	 * what read returned */
+	gpointer	 (*refresh_read)	(UpDevice	*device);
+	gboolean	 (*refresh_apply)	(UpDevice	*device,
+						 gpointer	 values);
 	const gchar	*(*get_id)		(UpDevice	*device);
 	gboolean	 (*get_on_battery)	(UpDevice	*device,
 						 gboolean	*on_battery);
@@ -58,6 +65,10 @@ typedef struct
 						 gboolean	*online);
 } UpDeviceClass;
 
+typedef void	(*UpDeviceRefreshFunc)			(UpDevice	*device,
+							 gboolean	 ret,
+							 gpointer	 user_data);
+
 typedef enum
 {
 	UP_DEVICE_ERROR_GENERAL,
@@ -80,11 +91,15 @@ gboolean	 up_device_register_display_device (UpDevice	*device,
 UpDaemon	*up_device_get_daemon		(UpDevice	*device);
 GObject		*up_device_get_native		(UpDevice	*device);
 const gchar	*up_device_get_object_path	(UpDevice	*device);
+GHashTable	*up_device_get_properties	(UpDevice	*device);
 gboolean	 up_device_get_on_battery	(UpDevice	*device,
 						 gboolean	*on_battery);
 gboolean	 up_device_get_online		(UpDevice	*device,
 						 gboolean	*online);
 gboolean	 up_device_refresh_internal	(UpDevice	*device);
+void		 up_device_refresh_async	(UpDevice	*device,
+						 UpDeviceRefreshFunc callback,
+						 gpointer	 user_data);
 
 /* exported methods */
 gboolean	 up_device_refresh		(UpDevice		*device,
@@ -94,6 +109,18 @@ gboolean	 up_device_get_history		(UpDevice		*device,
 						 guint			 timespan,
 						 guint			 resolution,
 						 DBusGMethodInvocation	*context);
+gboolean	 up_device_get_history_packed	(UpDevice		*device,
+						 const gchar		*type,
+						 guint			 timespan,
+						 guint			 resolution,
+						 DBusGMethodInvocation	*context);
+gboolean	 up_device_query_history	(UpDevice		*device,
+						 const gchar		*type,
+						 guint			 start,
+						 guint			 end,
+						 guint			 bucket_seconds,
+						 gchar			**aggregates,
+						 DBusGMethodInvocation	*context);
 gboolean	 up_device_get_statistics	(UpDevice		*device,
 						 const gchar		*type,
 						 DBusGMethodInvocation	*context);
@@ -0,0 +1,547 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+
+#include "up-history-writer.h"
+
+/* The history files of all devices are written by one thread, so that a
+ * slow disk never holds up the main loop. Callers hand over a copy of
+ * what is to be written and carry on; everything queued by the time the
+ * writer gets to it is merged per file and made durable with a single
+ * round of fsync calls. */
+
+typedef enum {
+	UP_HISTORY_WRITER_OP_APPEND,
+	UP_HISTORY_WRITER_OP_REPLACE,
+	UP_HISTORY_WRITER_OP_UNLINK,
+	UP_HISTORY_WRITER_OP_SYNC
+} UpHistoryWriterOp;
+
+typedef struct {
+	UpHistoryWriterOp	 op;
+	gchar			*filename;
+	const gchar		*header;	/* written first to a new file, for OP_APPEND */
+	gsize			 header_len;
+	gchar			*data;
+	gsize			 len;
+	UpHistoryWriterFunc	 func;
+	gpointer		 user_data;
+	GDestroyNotify		 destroy;
+	GAsyncQueue		*done;		/* woken when written, for OP_SYNC */
+	gint64			 queued;
+	gint			 fd;
+	gboolean		 ok;
+} UpHistoryWriterJob;
+
+/* the result of a job, handed back to the main context */
+typedef struct {
+	UpHistoryWriterFunc	 func;
+	GMappedFile		*file;
+	gpointer		 user_data;
+	GDestroyNotify		 destroy;
+} UpHistoryWriterResult;
+
+static GAsyncQueue *up_history_writer_queue = NULL;
+static GThreadPool *up_history_writer_pool = NULL;
+static UpHistoryWriterStats up_history_writer_stats;	/* under the queue lock */
+static GHashTable *up_history_writer_fds = NULL;	/* only used by the writer */
+
+/**
+ * up_history_writer_write:
+ **/
+static gboolean
+up_history_writer_write (gint fd, const gchar *data, gsize len)
+{
+	gssize wrote;
+
+	while (len > 0) {
+		wrote = write (fd, data, len);
+		if (wrote < 0) {
+			if (errno == EINTR)
+				continue;
+			return FALSE;
+		}
+		data += wrote;
+		len -= wrote;
+	}
+	return TRUE;
+}
+
+/**
+ * up_history_writer_result_cb:
+ **/
+static gboolean
+up_history_writer_result_cb (UpHistoryWriterResult *result)
+{
+	if (result->func != NULL)
+		result->func (result->file, result->user_data);
+	if (result->destroy != NULL)
+		result->destroy (result->user_data);
+	if (result->file != NULL)
+		g_mapped_file_unref (result->file);
+	g_free (result);
+	return FALSE;
+}
+
+/**
+ * up_history_writer_notify:
+ * @file: what was written, or %NULL; this is taken over
+ *
+ * Hands the result of a job back to the main context.
+ **/
+static void
+up_history_writer_notify (UpHistoryWriterFunc func, GMappedFile *file,
+			  gpointer user_data, GDestroyNotify destroy)
+{
+	UpHistoryWriterResult *result;
+
+	if (func == NULL && destroy == NULL) {
+		if (file != NULL)
+			g_mapped_file_unref (file);
+		return;
+	}
+	result = g_new0 (UpHistoryWriterResult, 1);
+	result->func = func;
+	result->file = file;
+	result->user_data = user_data;
+	result->destroy = destroy;
+	g_idle_add ((GSourceFunc) up_history_writer_result_cb, result);
+}
+
+/**
+ * up_history_writer_job_free:
+ * @file: what was written, or %NULL
+ **/
+static void
+up_history_writer_job_free (UpHistoryWriterJob *job, GMappedFile *file)
+{
+	up_history_writer_notify (job->func, file, job->user_data, job->destroy);
+	g_free (job->filename);
+	g_free (job->data);
+	g_free (job);
+}
+
+/**
+ * up_history_writer_merge:
+ *
+ * Folds @job into @prev, the earlier job for the same file, and frees it.
+ **/
+static void
+up_history_writer_merge (UpHistoryWriterJob *prev, UpHistoryWriterJob *job)
+{
+	gchar *data;
+
+	if (job->op == UP_HISTORY_WRITER_OP_APPEND &&
+	    prev->op != UP_HISTORY_WRITER_OP_UNLINK) {
+		/* just more to write at the end */
+		prev->data = g_realloc (prev->data, prev->len + job->len);
+		memcpy (prev->data + prev->len, job->data, job->len);
+		prev->len += job->len;
+	} else if (job->op == UP_HISTORY_WRITER_OP_APPEND) {
+		/* removed and then started again */
+		data = g_malloc (job->header_len + job->len);
+		memcpy (data, job->header, job->header_len);
+		memcpy (data + job->header_len, job->data, job->len);
+		prev->op = UP_HISTORY_WRITER_OP_REPLACE;
+		prev->data = data;
+		prev->len = job->header_len + job->len;
+	} else {
+		/* the earlier contents are never written, so only let go
+		 * of what was to be passed back with them */
+		up_history_writer_notify (NULL, NULL, prev->user_data, prev->destroy);
+		g_free (prev->data);
+		prev->op = job->op;
+		prev->data = job->data;
+		prev->len = job->len;
+		prev->func = job->func;
+		prev->user_data = job->user_data;
+		prev->destroy = job->destroy;
+		job->data = NULL;
+		job->func = NULL;
+		job->destroy = NULL;
+	}
+	up_history_writer_job_free (job, NULL);
+}
+
+/**
+ * up_history_writer_get_fd:
+ *
+ * Returns the descriptor kept open for appending to @filename.
+ **/
+static gint
+up_history_writer_get_fd (const gchar *filename, const gchar *header, gsize header_len)
+{
+	gint fd;
+	gpointer value;
+
+	if (g_hash_table_lookup_extended (up_history_writer_fds, filename, NULL, &value))
+		return GPOINTER_TO_INT (value);
+
+	fd = g_open (filename, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -1;
+	if (lseek (fd, 0, SEEK_END) == 0 &&
+	    !up_history_writer_write (fd, header, header_len)) {
+		close (fd);
+		return -1;
+	}
+	g_hash_table_insert (up_history_writer_fds, g_strdup (filename), GINT_TO_POINTER (fd));
+	return fd;
+}
+
+/**
+ * up_history_writer_close_fd:
+ **/
+static void
+up_history_writer_close_fd (const gchar *filename)
+{
+	gpointer value;
+
+	if (!g_hash_table_lookup_extended (up_history_writer_fds, filename, NULL, &value))
+		return;
+	close (GPOINTER_TO_INT (value));
+	g_hash_table_remove (up_history_writer_fds, filename);
+}
+
+/**
+ * up_history_writer_flush:
+ *
+ * Writes out everything queued so far.
+ **/
+static void
+up_history_writer_flush (void)
+{
+	guint i;
+	guint coalesced = 0;
+	gint fd;
+	gint64 oldest = G_MAXINT64;
+	guint64 latency;
+	gboolean ok = TRUE;
+	gchar *tmp;
+	GError *error = NULL;
+	GMappedFile *file;
+	GHashTable *by_name;
+	GHashTable *dirs;
+	GHashTableIter iter;
+	gpointer dir;
+	GPtrArray *jobs;
+	GPtrArray *syncs;
+	UpHistoryWriterJob *job;
+	UpHistoryWriterJob *prev;
+
+	jobs = g_ptr_array_new ();
+	syncs = g_ptr_array_new ();
+	by_name = g_hash_table_new (g_str_hash, g_str_equal);
+	dirs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+	/* take everything queued in one go, keeping one job per file */
+	g_async_queue_lock (up_history_writer_queue);
+	while ((job = g_async_queue_try_pop_unlocked (up_history_writer_queue)) != NULL) {
+		oldest = MIN (oldest, job->queued);
+		if (job->op == UP_HISTORY_WRITER_OP_SYNC) {
+			g_ptr_array_add (syncs, job);
+			continue;
+		}
+		prev = g_hash_table_lookup (by_name, job->filename);
+		if (prev == NULL) {
+			job->fd = -1;
+			g_hash_table_insert (by_name, job->filename, job);
+			g_ptr_array_add (jobs, job);
+			continue;
+		}
+		/* the key stays valid as merging keeps the old filename */
+		up_history_writer_merge (prev, job);
+		coalesced++;
+	}
+	up_history_writer_stats.queue_depth = 0;
+	g_async_queue_unlock (up_history_writer_queue);
+	if (jobs->len == 0 && syncs->len == 0)
+		goto out;
+
+	/* write everything, new files going to a temporary name */
+	for (i = 0; i < jobs->len; i++) {
+		job = g_ptr_array_index (jobs, i);
+		if (job->op == UP_HISTORY_WRITER_OP_APPEND) {
+			job->fd = up_history_writer_get_fd (job->filename, job->header, job->header_len);
+		} else if (job->op == UP_HISTORY_WRITER_OP_REPLACE) {
+			tmp = g_strdup_printf ("%s.tmp", job->filename);
+			job->fd = g_open (tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+			g_free (tmp);
+		} else {
+			job->ok = TRUE;
+			continue;
+		}
+		job->ok = job->fd >= 0 &&
+			  up_history_writer_write (job->fd, job->data, job->len);
+		if (!job->ok)
+			g_warning ("failed to write %s: %s", job->filename, g_strerror (errno));
+	}
+
+	/* then get it all on disk in one pass */
+	for (i = 0; i < jobs->len; i++) {
+		job = g_ptr_array_index (jobs, i);
+		if (job->op == UP_HISTORY_WRITER_OP_UNLINK || !job->ok)
+			continue;
+		if (fsync (job->fd) < 0) {
+			g_warning ("failed to sync %s: %s", job->filename, g_strerror (errno));
+			job->ok = FALSE;
+		}
+	}
+
+	/* only now swap in the new files */
+	for (i = 0; i < jobs->len; i++) {
+		job = g_ptr_array_index (jobs, i);
+		if (job->op == UP_HISTORY_WRITER_OP_UNLINK)
+			continue;
+		if (job->op == UP_HISTORY_WRITER_OP_REPLACE) {
+			tmp = g_strdup_printf ("%s.tmp", job->filename);
+			if (job->fd >= 0)
+				close (job->fd);
+			if (job->ok && g_rename (tmp, job->filename) < 0) {
+				g_warning ("failed to rename %s: %s", tmp, g_strerror (errno));
+				job->ok = FALSE;
+			}
+			if (!job->ok)
+				g_unlink (tmp);
+			g_free (tmp);
+			up_history_writer_close_fd (job->filename);
+		}
+		if (job->ok)
+			g_hash_table_insert (dirs, g_path_get_dirname (job->filename), NULL);
+		ok &= job->ok;
+	}
+
+	/* and make the new names durable too */
+	g_hash_table_iter_init (&iter, dirs);
+	while (g_hash_table_iter_next (&iter, &dir, NULL)) {
+		fd = g_open (dir, O_RDONLY | O_CLOEXEC, 0);
+		if (fd < 0)
+			continue;
+		if (fsync (fd) < 0)
+			g_debug ("failed to sync %s: %s", (const gchar *) dir, g_strerror (errno));
+		close (fd);
+	}
+
+	/* files are only removed once what replaces them is safe */
+	for (i = 0; i < jobs->len; i++) {
+		job = g_ptr_array_index (jobs, i);
+		if (job->op != UP_HISTORY_WRITER_OP_UNLINK)
+			continue;
+		if (!ok) {
+			g_warning ("keeping %s as not everything was written", job->filename);
+			continue;
+		}
+		up_history_writer_close_fd (job->filename);
+		g_unlink (job->filename);
+	}
+
+	for (i = 0; i < jobs->len; i++) {
+		job = g_ptr_array_index (jobs, i);
+		file = NULL;
+		if (job->op == UP_HISTORY_WRITER_OP_REPLACE && job->ok && job->func != NULL) {
+			file = g_mapped_file_new (job->filename, FALSE, &error);
+			if (file == NULL) {
+				g_warning ("failed to map %s: %s", job->filename, error->message);
+				g_clear_error (&error);
+			}
+		}
+		up_history_writer_job_free (job, file);
+	}
+
+	latency = g_get_monotonic_time () - oldest;
+	g_async_queue_lock (up_history_writer_queue);
+	up_history_writer_stats.flushes++;
+	up_history_writer_stats.coalesced += coalesced;
+	up_history_writer_stats.latency_last = latency;
+	up_history_writer_stats.latency_max = MAX (up_history_writer_stats.latency_max, latency);
+	g_async_queue_unlock (up_history_writer_queue);
+	g_debug ("wrote %i history files in %" G_GUINT64_FORMAT "us, %i jobs coalesced",
+		 jobs->len, latency, coalesced);
+
+	for (i = 0; i < syncs->len; i++) {
+		job = g_ptr_array_index (syncs, i);
+		g_async_queue_push (job->done, job);
+	}
+out:
+	g_hash_table_unref (dirs);
+	g_hash_table_unref (by_name);
+	g_ptr_array_unref (syncs);
+	g_ptr_array_unref (jobs);
+}
+
+/**
+ * up_history_writer_thread_cb:
+ **/
+static void
+up_history_writer_thread_cb (gpointer data, gpointer user_data)
+{
+	/* earlier runs may already have taken this job */
+	up_history_writer_flush ();
+}
+
+/**
+ * up_history_writer_push:
+ *
+ * Queues @job, which must only be done from the main context.
+ **/
+static void
+up_history_writer_push (UpHistoryWriterJob *job)
+{
+	guint depth;
+	GError *error = NULL;
+
+	if (up_history_writer_queue == NULL) {
+		up_history_writer_queue = g_async_queue_new ();
+		up_history_writer_fds = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+		up_history_writer_pool = g_thread_pool_new (up_history_writer_thread_cb, NULL,
+							    1, FALSE, &error);
+		if (up_history_writer_pool == NULL) {
+			g_warning ("failed to create history writer, writing directly: %s", error->message);
+			g_error_free (error);
+		}
+	}
+
+	job->queued = g_get_monotonic_time ();
+	g_async_queue_lock (up_history_writer_queue);
+	g_async_queue_push_unlocked (up_history_writer_queue, job);
+	depth = MAX (g_async_queue_length_unlocked (up_history_writer_queue), 0);
+	up_history_writer_stats.queue_depth = depth;
+	up_history_writer_stats.queue_depth_max = MAX (up_history_writer_stats.queue_depth_max, depth);
+	g_async_queue_unlock (up_history_writer_queue);
+
+	if (up_history_writer_pool == NULL) {
+		up_history_writer_flush ();
+		return;
+	}
+	g_thread_pool_push (up_history_writer_pool, up_history_writer_queue, NULL);
+}
+
+/**
+ * up_history_writer_append:
+ * @header: written first if the file is new
+ * @data: the bytes to append, which are taken over
+ *
+ * Appends @data to @filename in the background.
+ **/
+void
+up_history_writer_append (const gchar *filename, const gchar *header, gsize header_len,
+			  gchar *data, gsize len)
+{
+	UpHistoryWriterJob *job;
+
+	job = g_new0 (UpHistoryWriterJob, 1);
+	job->op = UP_HISTORY_WRITER_OP_APPEND;
+	job->filename = g_strdup (filename);
+	job->header = header;
+	job->header_len = header_len;
+	job->data = data;
+	job->len = len;
+	up_history_writer_push (job);
+}
+
+/**
+ * up_history_writer_replace:
+ * @data: the new contents, which are taken over
+ * @func: called once the file is on disk, or %NULL
+ * @destroy: called on @user_data when the job is done with, even if
+ * @func never was because a later replace made it pointless
+ *
+ * Atomically replaces @filename with @data in the background.
+ **/
+void
+up_history_writer_replace (const gchar *filename, gchar *data, gsize len,
+			   UpHistoryWriterFunc func, gpointer user_data, GDestroyNotify destroy)
+{
+	UpHistoryWriterJob *job;
+
+	job = g_new0 (UpHistoryWriterJob, 1);
+	job->op = UP_HISTORY_WRITER_OP_REPLACE;
+	job->filename = g_strdup (filename);
+	job->data = data;
+	job->len = len;
+	job->func = func;
+	job->user_data = user_data;
+	job->destroy = destroy;
+	up_history_writer_push (job);
+}
+
+/**
+ * up_history_writer_unlink:
+ *
+ * Removes @filename once everything queued before it has been written.
+ **/
+void
+up_history_writer_unlink (const gchar *filename)
+{
+	UpHistoryWriterJob *job;
+
+	job = g_new0 (UpHistoryWriterJob, 1);
+	job->op = UP_HISTORY_WRITER_OP_UNLINK;
+	job->filename = g_strdup (filename);
+	up_history_writer_push (job);
+}
+
+/**
+ * up_history_writer_sync:
+ *
+ * Waits for everything queued so far to be written.
+ **/
+void
+up_history_writer_sync (void)
+{
+	GAsyncQueue *done;
+	UpHistoryWriterJob *job;
+
+	if (up_history_writer_queue == NULL)
+		return;
+
+	done = g_async_queue_new ();
+	job = g_new0 (UpHistoryWriterJob, 1);
+	job->op = UP_HISTORY_WRITER_OP_SYNC;
+	job->done = done;
+	up_history_writer_push (job);
+	g_free (g_async_queue_pop (done));
+	g_async_queue_unref (done);
+}
+
+/**
+ * up_history_writer_get_stats:
+ **/
+void
+up_history_writer_get_stats (UpHistoryWriterStats *stats)
+{
+	g_return_if_fail (stats != NULL);
+
+	if (up_history_writer_queue == NULL) {
+		memset (stats, 0, sizeof (UpHistoryWriterStats));
+		return;
+	}
+	g_async_queue_lock (up_history_writer_queue);
+	*stats = up_history_writer_stats;
+	g_async_queue_unlock (up_history_writer_queue);
+}
@@ -0,0 +1,60 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __UP_HISTORY_WRITER_H
+#define __UP_HISTORY_WRITER_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct {
+	guint			 queue_depth;		/* jobs waiting now */
+	guint			 queue_depth_max;
+	guint			 flushes;
+	guint			 coalesced;		/* jobs merged into or replaced by later ones */
+	guint64			 latency_last;		/* us from the oldest job queued to it being on disk */
+	guint64			 latency_max;
+} UpHistoryWriterStats;
+
+/* called in the main context once a replaced file is on disk, with a
+ * read-only mapping of what was written, or %NULL if that failed */
+typedef void (*UpHistoryWriterFunc)		(GMappedFile	*file,
+						 gpointer	 user_data);
+
+void		 up_history_writer_append	(const gchar	*filename,
+						 const gchar	*header,
+						 gsize		 header_len,
+						 gchar		*data,
+						 gsize		 len);
+void		 up_history_writer_replace	(const gchar	*filename,
+						 gchar		*data,
+						 gsize		 len,
+						 UpHistoryWriterFunc func,
+						 gpointer	 user_data,
+						 GDestroyNotify	 destroy);
+void		 up_history_writer_unlink	(const gchar	*filename);
+void		 up_history_writer_sync		(void);
+void		 up_history_writer_get_stats	(UpHistoryWriterStats *stats);
+
+G_END_DECLS
+
+#endif /* __UP_HISTORY_WRITER_H */
@@ -23,21 +23,181 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 #include <glib/gi18n.h>
 #include <gio/gio.h>
 
 #include "up-history.h"
+#include "up-history-writer.h"
 #include "up-stats-item.h"
 #include "up-history-item.h"
 
 static void	up_history_finalize	(GObject		*object);
+static void	up_history_load_data	(UpHistory		*history);
+static guint32	up_history_get_cutoff	(UpHistory		*history);
 
 #define UP_HISTORY_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), UP_TYPE_HISTORY, UpHistoryPrivate))
 
 #define UP_HISTORY_FILE_HEADER		"PackageKit Profile"
 #define UP_HISTORY_SAVE_INTERVAL	(10*60)		/* seconds */
 #define UP_HISTORY_DEFAULT_MAX_DATA_AGE	(7*24*60*60)	/* seconds */
+#define UP_HISTORY_DEFAULT_MAX_DATA_SIZE (4*1024*1024)	/* bytes, per device */
+#define UP_HISTORY_SERIES_MIN_SIZE	64		/* samples */
+#define UP_HISTORY_SAMPLE_SIZE		(sizeof (guint32) + sizeof (gfloat) + sizeof (guint8))
+#define UP_HISTORY_JOURNAL_MAGIC	"UPHJ0001"
+#define UP_HISTORY_JOURNAL_MAGIC_LEN	8
+#define UP_HISTORY_ROLLUP_LEVELS	3
+#define UP_HISTORY_PROFILE_MAGIC	"UPHP0002"
+#define UP_HISTORY_PROFILE_BINS		101
+#define UP_HISTORY_PROFILE_SLOTS	8
+#define UP_HISTORY_QUERY_MAX_BUCKETS	10000
+
+/* bucket widths, in seconds, of the rollups kept for each series */
+static const guint up_history_rollup_granularity[UP_HISTORY_ROLLUP_LEVELS] = { 60, 600, 3600 };
+
+/* one sample as stored in a journal file, in host byte order */
+typedef struct {
+	guint32			 time;
+	gfloat			 value;
+	guint8			 state;
+	guint8			 reserved[3];
+} UpHistoryRecord;
+
+G_STATIC_ASSERT (sizeof (UpHistoryRecord) == 12);
+
+/* the samples of one series that fall in one rollup bucket */
+typedef struct {
+	guint32			 start;
+	guint32			 count;
+	guint64			 time_sum;
+	gdouble			 value_sum;
+	gfloat			 min;
+	gfloat			 max;
+	guint16			 states[UP_DEVICE_STATE_LAST];
+} UpHistoryBucket;
+
+/* one series of samples, stored as packed columns rather than as one
+ * UpHistoryItem per sample; items are only created for the points that
+ * are actually returned over D-Bus.
+ *
+ * The samples in the journal when it was loaded or last compacted are
+ * read straight from a read-only mapping of it, and only the ones added
+ * since are kept on the heap. */
+typedef struct {
+	GMappedFile		*base_file;
+	const UpHistoryRecord	*base;		/* oldest mapped sample still used */
+	guint			 base_len;
+	guint32			*time;
+	gfloat			*value;
+	guint8			*state;
+	guint			 len;
+	guint			 size;
+	guint			 max_len;	/* 0 for unbounded */
+	guint64			 dropped;	/* samples ever trimmed from the front */
+	GArray			*rollup[UP_HISTORY_ROLLUP_LEVELS];	/* built on first use */
+} UpHistorySeries;
+
+/* the append-only file backing one series */
+typedef struct {
+	guint			 len;		/* records in the file, once written */
+	guint			 pending;	/* samples at the end of the series not yet written */
+	gboolean		 stale;		/* a rewrite failed, so it needs doing again */
+} UpHistoryJournal;
+
+/* a journal rewrite on its way to disk */
+typedef struct {
+	UpHistory		*history;	/* weak */
+	UpHistoryType		 type;
+	guint64			 dropped;	/* of the series when it was written */
+} UpHistoryCompaction;
+
+/* what the charge samples of one stretch of time added to the profile;
+ * index 0 is for charging and 1 for discharging */
+typedef struct {
+	gdouble			 time[2][UP_HISTORY_PROFILE_BINS];
+	guint32			 count[2][UP_HISTORY_PROFILE_BINS];
+	guint32			 time_first;	/* 0 if unused */
+	guint32			 time_last;
+} UpHistoryProfileSlot;
+
+/* the charge and discharge profile, updated as charge samples come in
+ * and saved as-is, in host byte order; the slots are a ring, so that
+ * what is older than the maximum data age can be dropped again */
+typedef struct {
+	UpHistoryProfileSlot	 slots[UP_HISTORY_PROFILE_SLOTS];
+	guint32			 slot_current;
+	/* where the scan of the charge samples has got to */
+	guint32			 time_last;
+	guint32			 time_old;
+	gfloat			 value_old;
+	guint32			 bin_old;
+	guint8			 state_last;
+	guint8			 has_last;
+	guint8			 has_old;
+	guint8			 reserved;
+} UpHistoryProfile;
+
+/* decides which incoming samples of a series are worth storing */
+typedef struct {
+	UpHistoryCompression	 compression;
+	gdouble			 tolerance_abs;
+	gdouble			 tolerance_rel;
+	guint			 max_gap;
+	/* the last sample stored */
+	gboolean		 has_stored;
+	guint32			 stored_time;
+	gfloat			 stored_value;
+	UpDeviceState		 stored_state;
+	/* the newest sample, held back until we know if it is needed */
+	gboolean		 has_held;
+	guint32			 held_time;
+	gfloat			 held_value;
+	/* the doors, as slopes from the last sample stored */
+	gdouble			 slope_low;
+	gdouble			 slope_high;
+	guint			 offered;
+	guint			 stored;
+} UpHistoryFilter;
+
+/* something a query can ask for about each bucket */
+typedef enum {
+	UP_HISTORY_AGGREGATE_MEAN,
+	UP_HISTORY_AGGREGATE_MIN,
+	UP_HISTORY_AGGREGATE_MAX,
+	UP_HISTORY_AGGREGATE_FIRST,
+	UP_HISTORY_AGGREGATE_LAST,
+	UP_HISTORY_AGGREGATE_COUNT,
+	UP_HISTORY_AGGREGATE_PERCENTILE,
+	UP_HISTORY_AGGREGATE_INTEGRAL
+} UpHistoryAggregateKind;
+
+typedef struct {
+	UpHistoryAggregateKind	 kind;
+	gdouble			 percentile;	/* 0 to 100 */
+	UpDeviceState		 state;		/* of the integral, or unknown for all */
+} UpHistoryAggregate;
+
+/* what a query gathers for the bucket it is in */
+typedef struct {
+	guint32			 start;
+	guint			 count;
+	gdouble			 sum;
+	gfloat			 min;
+	gfloat			 max;
+	gfloat			 first;
+	gfloat			 last;
+	gdouble			 integral[UP_DEVICE_STATE_LAST];
+	GArray			*values;	/* only kept for percentiles */
+} UpHistoryAccumulator;
+
+/* a contiguous range of a series, read in place */
+typedef struct {
+	const UpHistorySeries	*series;
+	guint			 first;		/* oldest sample */
+	guint			 len;
+	gboolean		 newest_first;
+} UpHistoryView;
 
 struct UpHistoryPrivate
 {
@@ -47,12 +207,18 @@ struct UpHistoryPrivate
 	gint64			 time_empty_last;
 	gdouble			 percentage_last;
 	UpDeviceState		 state;
-	GPtrArray		*data_rate;
-	GPtrArray		*data_charge;
-	GPtrArray		*data_time_full;
-	GPtrArray		*data_time_empty;
+	UpHistorySeries		 data_rate;
+	UpHistorySeries		 data_charge;
+	UpHistorySeries		 data_time_full;
+	UpHistorySeries		 data_time_empty;
+	UpHistoryJournal	 journal[UP_HISTORY_TYPE_UNKNOWN];
+	UpHistoryProfile	 profile;
+	UpHistoryFilter		 filter[UP_HISTORY_TYPE_UNKNOWN];
+	gboolean		 profile_dirty;
+	gboolean		 loaded;
 	guint			 save_id;
 	guint			 max_data_age;
+	gsize			 max_data_size;
 	gchar			*dir;
 };
 
@@ -73,17 +239,461 @@ up_history_set_max_data_age (UpHistory *history, guint max_data_age)
 }
 
 /**
- * up_history_array_copy_cb:
+ * up_history_series_resize:
+ **/
+static void
+up_history_series_resize (UpHistorySeries *series, guint size)
+{
+	series->size = size;
+	series->time = g_renew (guint32, series->time, series->size);
+	series->value = g_renew (gfloat, series->value, series->size);
+	series->state = g_renew (guint8, series->state, series->size);
+}
+
+/**
+ * up_history_series_get_length:
+ **/
+static guint
+up_history_series_get_length (const UpHistorySeries *series)
+{
+	return series->base_len + series->len;
+}
+
+/**
+ * up_history_series_get:
+ * @index: counting from the oldest sample, mapped or not
+ **/
+static void
+up_history_series_get (const UpHistorySeries *series, guint index,
+		       guint32 *time_s, gfloat *value, UpDeviceState *state)
+{
+	if (index < series->base_len) {
+		*time_s = series->base[index].time;
+		if (value != NULL)
+			*value = series->base[index].value;
+		if (state != NULL)
+			*state = series->base[index].state;
+		return;
+	}
+	index -= series->base_len;
+	*time_s = series->time[index];
+	if (value != NULL)
+		*value = series->value[index];
+	if (state != NULL)
+		*state = series->state[index];
+}
+
+/**
+ * up_history_rollup_add:
+ **/
+static void
+up_history_rollup_add (GArray *rollup, guint granularity, guint32 time_s, gfloat value, UpDeviceState state)
+{
+	UpHistoryBucket *bucket = NULL;
+	UpHistoryBucket new;
+	guint32 start = time_s - time_s % granularity;
+
+	/* samples are in time order, so only the newest bucket is updated,
+	 * and the odd one from a clock change just goes in that too */
+	if (rollup->len > 0) {
+		bucket = &g_array_index (rollup, UpHistoryBucket, rollup->len - 1);
+		if (start > bucket->start)
+			bucket = NULL;
+	}
+	if (bucket == NULL) {
+		memset (&new, 0, sizeof (UpHistoryBucket));
+		new.start = start;
+		new.min = value;
+		new.max = value;
+		g_array_append_val (rollup, new);
+		bucket = &g_array_index (rollup, UpHistoryBucket, rollup->len - 1);
+	}
+
+	bucket->count++;
+	bucket->time_sum += time_s;
+	bucket->value_sum += value;
+	bucket->min = MIN (bucket->min, value);
+	bucket->max = MAX (bucket->max, value);
+	if (state < UP_DEVICE_STATE_LAST && bucket->states[state] < G_MAXUINT16)
+		bucket->states[state]++;
+}
+
+/**
+ * up_history_bucket_get_state:
+ *
+ * Returns the state most of the samples in the bucket were in.
+ **/
+static UpDeviceState
+up_history_bucket_get_state (const UpHistoryBucket *bucket)
+{
+	UpDeviceState state;
+	UpDeviceState dominant = UP_DEVICE_STATE_UNKNOWN;
+
+	for (state = UP_DEVICE_STATE_UNKNOWN; state < UP_DEVICE_STATE_LAST; state++) {
+		if (bucket->states[state] > bucket->states[dominant])
+			dominant = state;
+	}
+	return dominant;
+}
+
+/**
+ * up_history_series_get_rollup:
+ *
+ * Returns the rollup for @level, building it from the samples the first
+ * time it is needed; after that, appends keep it up to date.
+ **/
+static GArray *
+up_history_series_get_rollup (UpHistorySeries *series, guint level)
+{
+	guint i;
+	guint length;
+	guint32 time_s;
+	gfloat value;
+	UpDeviceState state;
+
+	if (series->rollup[level] != NULL)
+		return series->rollup[level];
+
+	series->rollup[level] = g_array_new (FALSE, FALSE, sizeof (UpHistoryBucket));
+	length = up_history_series_get_length (series);
+	for (i = 0; i < length; i++) {
+		up_history_series_get (series, i, &time_s, &value, &state);
+		up_history_rollup_add (series->rollup[level], up_history_rollup_granularity[level],
+				       time_s, value, state);
+	}
+	return series->rollup[level];
+}
+
+/**
+ * up_history_series_trim_rollups:
+ *
+ * Drops the buckets that end before the oldest sample we still have.
+ **/
+static void
+up_history_series_trim_rollups (UpHistorySeries *series)
+{
+	guint i;
+	guint level;
+	guint32 oldest = G_MAXUINT32;
+	GArray *rollup;
+
+	if (up_history_series_get_length (series) > 0)
+		up_history_series_get (series, 0, &oldest, NULL, NULL);
+	for (level = 0; level < UP_HISTORY_ROLLUP_LEVELS; level++) {
+		rollup = series->rollup[level];
+		if (rollup == NULL)
+			continue;
+		for (i = 0; i < rollup->len; i++) {
+			if (g_array_index (rollup, UpHistoryBucket, i).start +
+			    up_history_rollup_granularity[level] > oldest)
+				break;
+		}
+		if (i > 0)
+			g_array_remove_range (rollup, 0, i);
+	}
+}
+
+/**
+ * up_history_view_get:
+ * @index: counting from the start of the view, in its direction
+ **/
+static void
+up_history_view_get (const UpHistoryView *view, guint index,
+		     guint32 *time_s, gfloat *value, UpDeviceState *state)
+{
+	if (view->newest_first)
+		index = view->len - 1 - index;
+	up_history_series_get (view->series, view->first + index, time_s, value, state);
+}
+
+/**
+ * up_history_series_set_base:
+ *
+ * Replaces the mapped samples with the ones in @file, which takes
+ * ownership of it.
+ **/
+static void
+up_history_series_set_base (UpHistorySeries *series, GMappedFile *file)
+{
+	if (series->base_file != NULL)
+		g_mapped_file_unref (series->base_file);
+	series->base_file = file;
+	series->base = NULL;
+	series->base_len = 0;
+	if (file == NULL)
+		return;
+	series->base = (const UpHistoryRecord *) (g_mapped_file_get_contents (file) + UP_HISTORY_JOURNAL_MAGIC_LEN);
+	series->base_len = (g_mapped_file_get_length (file) - UP_HISTORY_JOURNAL_MAGIC_LEN) / sizeof (UpHistoryRecord);
+}
+
+/**
+ * up_history_series_remove_heap:
+ *
+ * Removes the oldest @count samples held on the heap.
+ **/
+static void
+up_history_series_remove_heap (UpHistorySeries *series, guint count)
+{
+	if (count == 0)
+		return;
+
+	series->len -= count;
+	memmove (series->time, series->time + count, series->len * sizeof (guint32));
+	memmove (series->value, series->value + count, series->len * sizeof (gfloat));
+	memmove (series->state, series->state + count, series->len * sizeof (guint8));
+
+	/* give memory back once the series is well below its size */
+	if (series->size > UP_HISTORY_SERIES_MIN_SIZE &&
+	    series->len < series->size / 4)
+		up_history_series_resize (series, MAX (series->len * 2, UP_HISTORY_SERIES_MIN_SIZE));
+}
+
+/**
+ * up_history_series_trim:
+ * @cutoff: drop samples older than this time
+ * @max_len: keep at most this many samples, or 0 for no limit
+ **/
+static void
+up_history_series_trim (UpHistorySeries *series, guint32 cutoff, guint max_len)
+{
+	guint start = 0;
+	guint drop;
+	guint length = up_history_series_get_length (series);
+	guint32 time_s;
+
+	/* samples are appended in time order, so stale ones are at the front */
+	while (start < length) {
+		up_history_series_get (series, start, &time_s, NULL, NULL);
+		if (time_s >= cutoff)
+			break;
+		start++;
+	}
+	if (max_len > 0 && length - start > max_len)
+		start = length - max_len;
+	if (start == 0)
+		return;
+
+	series->dropped += start;
+
+	/* mapped samples are dropped by just moving past them */
+	drop = MIN (start, series->base_len);
+	series->base += drop;
+	series->base_len -= drop;
+	if (series->base_len == 0)
+		up_history_series_set_base (series, NULL);
+	up_history_series_remove_heap (series, start - drop);
+	up_history_series_trim_rollups (series);
+}
+
+/**
+ * up_history_get_series:
+ **/
+static UpHistorySeries *
+up_history_get_series (UpHistory *history, UpHistoryType type)
+{
+	if (type == UP_HISTORY_TYPE_CHARGE)
+		return &history->priv->data_charge;
+	if (type == UP_HISTORY_TYPE_RATE)
+		return &history->priv->data_rate;
+	if (type == UP_HISTORY_TYPE_TIME_FULL)
+		return &history->priv->data_time_full;
+	if (type == UP_HISTORY_TYPE_TIME_EMPTY)
+		return &history->priv->data_time_empty;
+	return NULL;
+}
+
+/**
+ * up_history_type_to_string:
+ **/
+static const gchar *
+up_history_type_to_string (UpHistoryType type)
+{
+	if (type == UP_HISTORY_TYPE_CHARGE)
+		return "charge";
+	if (type == UP_HISTORY_TYPE_RATE)
+		return "rate";
+	if (type == UP_HISTORY_TYPE_TIME_FULL)
+		return "time-full";
+	if (type == UP_HISTORY_TYPE_TIME_EMPTY)
+		return "time-empty";
+	return NULL;
+}
+
+/**
+ * up_history_series_get_rollup_size:
+ **/
+static gsize
+up_history_series_get_rollup_size (const UpHistorySeries *series)
+{
+	gsize size = 0;
+	guint level;
+
+	for (level = 0; level < UP_HISTORY_ROLLUP_LEVELS; level++) {
+		if (series->rollup[level] != NULL)
+			size += series->rollup[level]->len * sizeof (UpHistoryBucket);
+	}
+	return size;
+}
+
+/**
+ * up_history_series_get_max_len:
+ *
+ * Gets how many samples fit in the memory the rollups leave, or 0 for
+ * no limit. A series always keeps at least UP_HISTORY_SERIES_MIN_SIZE
+ * samples; as no bucket is kept once its samples are gone, its rollups
+ * are then bounded by that too.
+ **/
+static guint
+up_history_series_get_max_len (const UpHistorySeries *series)
+{
+	gsize rollup_len;
+
+	if (series->max_len == 0)
+		return 0;
+	rollup_len = up_history_series_get_rollup_size (series) / UP_HISTORY_SAMPLE_SIZE;
+	if (rollup_len + UP_HISTORY_SERIES_MIN_SIZE >= series->max_len)
+		return UP_HISTORY_SERIES_MIN_SIZE;
+	return series->max_len - rollup_len;
+}
+
+/**
+ * up_history_series_append:
+ **/
+static void
+up_history_series_append (UpHistorySeries *series, guint32 time_s, gfloat value, UpDeviceState state)
+{
+	guint size;
+	guint level;
+	guint max_len;
+
+	/* at the cap, so drop the oldest eighth in one go rather than
+	 * moving everything for each sample */
+	max_len = up_history_series_get_max_len (series);
+	if (max_len > 0 &&
+	    up_history_series_get_length (series) >= max_len) {
+		up_history_series_trim (series, 0, max_len - max_len / 8);
+
+		/* the rollups may have taken some of the room since */
+		if (series->size > max_len)
+			up_history_series_resize (series, MAX (series->len, max_len));
+	}
+
+	/* grow geometrically so appending stays cheap */
+	if (series->len == series->size) {
+		size = MAX (series->size * 2, UP_HISTORY_SERIES_MIN_SIZE);
+		if (max_len > 0)
+			size = MIN (size, max_len);
+		up_history_series_resize (series, size);
+	}
+	series->time[series->len] = time_s;
+	series->value[series->len] = value;
+	series->state[series->len] = state;
+	series->len++;
+
+	/* keep any rollups that have been asked for current */
+	for (level = 0; level < UP_HISTORY_ROLLUP_LEVELS; level++) {
+		if (series->rollup[level] != NULL)
+			up_history_rollup_add (series->rollup[level], up_history_rollup_granularity[level],
+					       time_s, value, state);
+	}
+}
+
+/**
+ * up_history_series_set_max_len:
+ **/
+static void
+up_history_series_set_max_len (UpHistorySeries *series, guint max_len)
+{
+	series->max_len = max_len;
+	max_len = up_history_series_get_max_len (series);
+	up_history_series_trim (series, 0, max_len);
+	if (series->size > max_len)
+		up_history_series_resize (series, MAX (series->len, max_len));
+}
+
+/**
+ * up_history_series_clear:
  **/
 static void
-up_history_array_copy_cb (UpHistoryItem *item, GPtrArray *dest)
+up_history_series_clear (UpHistorySeries *series)
+{
+	guint level;
+
+	g_free (series->time);
+	g_free (series->value);
+	g_free (series->state);
+	series->time = NULL;
+	series->value = NULL;
+	series->state = NULL;
+	series->len = 0;
+	series->size = 0;
+	up_history_series_set_base (series, NULL);
+	for (level = 0; level < UP_HISTORY_ROLLUP_LEVELS; level++) {
+		if (series->rollup[level] != NULL) {
+			g_array_unref (series->rollup[level]);
+			series->rollup[level] = NULL;
+		}
+	}
+}
+
+/**
+ * up_history_set_max_data_size:
+ * @max_data_size: the most memory, in bytes, to use for the samples and
+ *   rollups of all types
+ **/
+void
+up_history_set_max_data_size (UpHistory *history, gsize max_data_size)
 {
-	g_ptr_array_add (dest, g_object_ref (item));
+	guint max_len;
+	UpHistoryType type;
+
+	/* shared equally between the four series */
+	history->priv->max_data_size = max_data_size;
+	max_len = max_data_size / (4 * UP_HISTORY_SAMPLE_SIZE);
+	max_len = MAX (max_len, UP_HISTORY_SERIES_MIN_SIZE);
+	for (type = UP_HISTORY_TYPE_CHARGE; type < UP_HISTORY_TYPE_UNKNOWN; type++)
+		up_history_series_set_max_len (up_history_get_series (history, type), max_len);
+}
+
+/**
+ * up_history_get_size:
+ * @samples: (out) (allow-none): the number of samples held
+ * @bytes: (out) (allow-none): the heap allocated for them and their
+ *   rollups, which does not include samples read from the mapped journal
+ **/
+void
+up_history_get_size (UpHistory *history, UpHistoryType type, guint *samples, gsize *bytes)
+{
+	const UpHistorySeries *series;
+
+	g_return_if_fail (UP_IS_HISTORY (history));
+
+	series = up_history_get_series (history, type);
+	if (samples != NULL)
+		*samples = series != NULL ? up_history_series_get_length (series) : 0;
+	if (bytes != NULL)
+		*bytes = series != NULL ? series->size * UP_HISTORY_SAMPLE_SIZE +
+					  up_history_series_get_rollup_size (series) : 0;
+}
+
+/**
+ * up_history_series_add_item:
+ **/
+static void
+up_history_series_add_item (GPtrArray *array, guint32 time_s, gdouble value, UpDeviceState state)
+{
+	UpHistoryItem *item;
+
+	item = up_history_item_new ();
+	up_history_item_set_time (item, time_s);
+	up_history_item_set_value (item, value);
+	up_history_item_set_state (item, state);
+	g_ptr_array_add (array, item);
 }
 
 /**
  * up_history_array_limit_resolution:
- * @array: The data we have for a specific graph
+ * @view: The data we have for a specific graph
  * @max_num: The max desired points
  *
  * We need to reduce the number of data points else the graph will take a long
@@ -115,10 +725,8 @@ up_history_array_copy_cb (UpHistoryItem *item, GPtrArray *dest)
  * 3 = 85,30
  **/
 static GPtrArray *
-up_history_array_limit_resolution (GPtrArray *array, guint max_num)
+up_history_array_limit_resolution (const UpHistoryView *view, guint max_num)
 {
-	UpHistoryItem *item;
-	UpHistoryItem *item_new;
 	gfloat division;
 	guint length;
 	guint i;
@@ -131,25 +739,31 @@ up_history_array_limit_resolution (GPtrArray *array, guint max_num)
 	guint64 count = 0;
 	guint step = 1;
 	gfloat preset;
+	guint32 time_item;
+	gfloat value_item;
+	UpDeviceState state_item;
 
 	new = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
-	g_debug ("length of array (before) %i", array->len);
+	g_debug ("length of array (before) %i", view->len);
 
 	/* check length */
-	length = array->len;
+	length = view->len;
 	if (length == 0)
 		goto out;
 	if (length < max_num) {
 		/* need to copy array */
-		g_ptr_array_foreach (array, (GFunc) up_history_array_copy_cb, new);
+		for (i = 0; i < length; i++) {
+			up_history_view_get (view, i, &time_item, &value_item, &state_item);
+			up_history_series_add_item (new, time_item, value_item, state_item);
+		}
 		goto out;
 	}
 
 	/* last element */
-	item = (UpHistoryItem *) g_ptr_array_index (array, length-1);
-	last = up_history_item_get_time (item);
-	item = (UpHistoryItem *) g_ptr_array_index (array, 0);
-	first = up_history_item_get_time (item);
+	up_history_view_get (view, length-1, &time_item, NULL, NULL);
+	last = time_item;
+	up_history_view_get (view, 0, &time_item, NULL, NULL);
+	first = time_item;
 
 	division = (first - last) / (gfloat) max_num;
 	g_debug ("Using a x division of %f (first=%i,last=%i)", division, first, last);
@@ -158,39 +772,30 @@ up_history_array_limit_resolution (GPtrArray *array, guint max_num)
 	 * division algorithm so we don't keep diluting the previous
 	 * data with a conventional 1-in-x type algorithm. */
 	for (i = 0; i < length; i++) {
-		item = (UpHistoryItem *) g_ptr_array_index (array, i);
+		up_history_view_get (view, i, &time_item, &value_item, &state_item);
 		preset = last + (division * (gfloat) step);
 
 		/* if state changed or we went over the preset do a new point */
 		if (count > 0 &&
-		    (up_history_item_get_time (item) > preset ||
-		     up_history_item_get_state (item) != state)) {
-			item_new = up_history_item_new ();
-			up_history_item_set_time (item_new, time_s / count);
-			up_history_item_set_value (item_new, value / count);
-			up_history_item_set_state (item_new, state);
-			g_ptr_array_add (new, item_new);
+		    (time_item > preset ||
+		     state_item != state)) {
+			up_history_series_add_item (new, time_s / count, value / count, state);
 
 			step++;
-			time_s = up_history_item_get_time (item);
-			value = up_history_item_get_value (item);
-			state = up_history_item_get_state (item);
+			time_s = time_item;
+			value = value_item;
+			state = state_item;
 			count = 1;
 		} else {
 			count++;
-			time_s += up_history_item_get_time (item);
-			value += up_history_item_get_value (item);
+			time_s += time_item;
+			value += value_item;
 		}
 	}
 
 	/* only add if nonzero */
-	if (count > 0) {
-		item_new = up_history_item_new ();
-		up_history_item_set_time (item_new, time_s / count);
-		up_history_item_set_value (item_new, value / count);
-		up_history_item_set_state (item_new, state);
-		g_ptr_array_add (new, item_new);
-	}
+	if (count > 0)
+		up_history_series_add_item (new, time_s / count, value / count, state);
 
 	/* check length */
 	g_debug ("length of array (after) %i", new->len);
@@ -200,39 +805,116 @@ out:
 
 /**
  * up_history_copy_array_timespan:
+ * @series: the source series, oldest first
+ * @view: the range to use, newest first unless @timespan is zero
+ *
+ * The samples are in time order, so the ones in the last @timespan
+ * seconds are found with a binary search and used where they are. The
+ * markers saved when the history is loaded carry no data, so any at the
+ * start of the window are left out.
  **/
-static GPtrArray *
-up_history_copy_array_timespan (const GPtrArray *array, guint timespan)
+static gboolean
+up_history_copy_array_timespan (const UpHistorySeries *series, UpHistoryView *view, guint timespan)
 {
-	guint i;
-	UpHistoryItem *item;
-	GPtrArray *array_new;
+	guint length;
+	guint lo;
+	guint hi;
+	guint mid;
+	gint64 cutoff;
 	GTimeVal timeval;
+	guint32 time_s;
+	UpDeviceState state;
 
 	/* no data */
-	if (array->len == 0)
-		return NULL;
+	length = up_history_series_get_length (series);
+	if (length == 0)
+		return FALSE;
 
 	/* no limit on data */
+	view->series = series;
 	if (timespan == 0) {
-		array_new = g_ptr_array_ref ((GPtrArray *) array);
-		goto out;
+		view->first = 0;
+		view->len = length;
+		view->newest_first = FALSE;
+		return TRUE;
 	}
 
 	/* new data */
-	array_new = g_ptr_array_new ();
 	g_get_current_time (&timeval);
 	g_debug ("limiting data to last %i seconds", timespan);
 
-	/* treat the timespan like a range, and search backwards */
+	/* treat the timespan like a range, and find the oldest sample in it */
 	timespan *= 0.95f;
-	for (i=array->len-1; i>0; i--) {
-		item = (UpHistoryItem *) g_ptr_array_index (array, i);
-		if (timeval.tv_sec - up_history_item_get_time (item) < timespan)
-			g_ptr_array_add (array_new, g_object_ref (item));
+	cutoff = (gint64) timeval.tv_sec - timespan;
+	lo = 0;
+	hi = length;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		up_history_series_get (series, mid, &time_s, NULL, NULL);
+		if ((gint64) time_s > cutoff)
+			hi = mid;
+		else
+			lo = mid + 1;
 	}
-out:
-	return array_new;
+	while (lo < length) {
+		up_history_series_get (series, lo, &time_s, NULL, &state);
+		if (state != UP_DEVICE_STATE_UNKNOWN)
+			break;
+		lo++;
+	}
+	view->first = lo;
+	view->len = length - lo;
+	view->newest_first = TRUE;
+	return TRUE;
+}
+
+/**
+ * up_history_get_data_rollup:
+ * @since: the time of the oldest sample in the window
+ *
+ * Answers a query from the coarsest rollup with buckets no wider than the
+ * point spacing asked for, so that only a few buckets per output point
+ * have to be merged rather than every sample.
+ **/
+static GPtrArray *
+up_history_get_data_rollup (UpHistorySeries *series, guint32 since, guint timespan, guint resolution)
+{
+	gint level;
+	guint i;
+	GArray *rollup;
+	GPtrArray *array = NULL;
+	const UpHistoryBucket *bucket;
+	UpHistorySeries points = { NULL, };
+	UpHistoryView view;
+
+	for (level = UP_HISTORY_ROLLUP_LEVELS - 1; level >= 0; level--) {
+		if (up_history_rollup_granularity[level] <= timespan / resolution)
+			break;
+	}
+	if (level < 0)
+		return NULL;
+	rollup = up_history_series_get_rollup (series, level);
+	g_debug ("using %is rollup", up_history_rollup_granularity[level]);
+
+	/* one point per bucket in the window, at its mean */
+	for (i = 0; i < rollup->len; i++) {
+		bucket = &g_array_index (rollup, UpHistoryBucket, i);
+		if (bucket->start + up_history_rollup_granularity[level] <= since)
+			continue;
+		up_history_series_append (&points,
+					  bucket->time_sum / bucket->count,
+					  bucket->value_sum / bucket->count,
+					  up_history_bucket_get_state (bucket));
+	}
+
+	/* then merge those down to the resolution asked for */
+	view.series = &points;
+	view.first = 0;
+	view.len = up_history_series_get_length (&points);
+	view.newest_first = TRUE;
+	array = up_history_array_limit_resolution (&view, resolution);
+	up_history_series_clear (&points);
+	return array;
 }
 
 /**
@@ -241,40 +923,525 @@ out:
 GPtrArray *
 up_history_get_data (UpHistory *history, UpHistoryType type, guint timespan, guint resolution)
 {
-	GPtrArray *array;
 	GPtrArray *array_resolution;
-	const GPtrArray *array_data = NULL;
+	UpHistorySeries *series;
+	UpHistoryView view;
+	guint32 since;
 
 	g_return_val_if_fail (UP_IS_HISTORY (history), NULL);
 
 	if (history->priv->id == NULL)
 		return NULL;
-
-	if (type == UP_HISTORY_TYPE_CHARGE)
-		array_data = history->priv->data_charge;
-	else if (type == UP_HISTORY_TYPE_RATE)
-		array_data = history->priv->data_rate;
-	else if (type == UP_HISTORY_TYPE_TIME_FULL)
-		array_data = history->priv->data_time_full;
-	else if (type == UP_HISTORY_TYPE_TIME_EMPTY)
-		array_data = history->priv->data_time_empty;
+	up_history_load_data (history);
 
 	/* not recognised */
-	if (array_data == NULL)
+	series = up_history_get_series (history, type);
+	if (series == NULL)
 		return NULL;
 
 	/* only return a certain time */
-	array = up_history_copy_array_timespan (array_data, timespan);
-	if (array == NULL)
+	if (!up_history_copy_array_timespan (series, &view, timespan))
 		return NULL;
 
+	/* use the rollups when there are more samples than points wanted */
+	if (timespan > 0 && resolution > 0 && view.len > resolution) {
+		up_history_view_get (&view, view.len - 1, &since, NULL, NULL);
+		array_resolution = up_history_get_data_rollup (series, since, timespan, resolution);
+		if (array_resolution != NULL)
+			return array_resolution;
+	}
+
 	/* only add a certain number of points */
-	array_resolution = up_history_array_limit_resolution (array, resolution);
-	g_ptr_array_unref (array);
+	array_resolution = up_history_array_limit_resolution (&view, resolution);
 
 	return array_resolution;
 }
 
+/**
+ * up_history_aggregate_parse:
+ *
+ * Parses the name of an aggregate, such as "max", "p95" or
+ * "integral-discharging".
+ **/
+static gboolean
+up_history_aggregate_parse (const gchar *name, UpHistoryAggregate *aggregate)
+{
+	gchar *endptr = NULL;
+
+	aggregate->percentile = 0.0f;
+	aggregate->state = UP_DEVICE_STATE_UNKNOWN;
+	if (g_strcmp0 (name, "mean") == 0) {
+		aggregate->kind = UP_HISTORY_AGGREGATE_MEAN;
+	} else if (g_strcmp0 (name, "min") == 0) {
+		aggregate->kind = UP_HISTORY_AGGREGATE_MIN;
+	} else if (g_strcmp0 (name, "max") == 0) {
+		aggregate->kind = UP_HISTORY_AGGREGATE_MAX;
+	} else if (g_strcmp0 (name, "first") == 0) {
+		aggregate->kind = UP_HISTORY_AGGREGATE_FIRST;
+	} else if (g_strcmp0 (name, "last") == 0) {
+		aggregate->kind = UP_HISTORY_AGGREGATE_LAST;
+	} else if (g_strcmp0 (name, "count") == 0) {
+		aggregate->kind = UP_HISTORY_AGGREGATE_COUNT;
+	} else if (g_strcmp0 (name, "median") == 0) {
+		aggregate->kind = UP_HISTORY_AGGREGATE_PERCENTILE;
+		aggregate->percentile = 50.0f;
+	} else if (name[0] == 'p' && g_ascii_isdigit (name[1])) {
+		aggregate->kind = UP_HISTORY_AGGREGATE_PERCENTILE;
+		aggregate->percentile = g_ascii_strtod (name + 1, &endptr);
+		if (*endptr != '\0' || aggregate->percentile > 100.0f)
+			return FALSE;
+	} else if (g_strcmp0 (name, "integral") == 0) {
+		aggregate->kind = UP_HISTORY_AGGREGATE_INTEGRAL;
+	} else if (g_str_has_prefix (name, "integral-")) {
+		aggregate->kind = UP_HISTORY_AGGREGATE_INTEGRAL;
+		aggregate->state = up_device_state_from_string (name + strlen ("integral-"));
+		if (aggregate->state == UP_DEVICE_STATE_UNKNOWN)
+			return FALSE;
+	} else {
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * up_history_accumulator_reset:
+ **/
+static void
+up_history_accumulator_reset (UpHistoryAccumulator *acc, guint32 start)
+{
+	GArray *values = acc->values;
+
+	memset (acc, 0, sizeof (UpHistoryAccumulator));
+	acc->start = start;
+	acc->values = values;
+	if (values != NULL)
+		g_array_set_size (values, 0);
+}
+
+/**
+ * up_history_accumulator_add:
+ **/
+static void
+up_history_accumulator_add (UpHistoryAccumulator *acc, gfloat value)
+{
+	if (acc->count == 0) {
+		acc->min = value;
+		acc->max = value;
+		acc->first = value;
+	}
+	acc->count++;
+	acc->sum += value;
+	acc->min = MIN (acc->min, value);
+	acc->max = MAX (acc->max, value);
+	acc->last = value;
+	if (acc->values != NULL)
+		g_array_append_val (acc->values, value);
+}
+
+/**
+ * up_history_accumulator_hold:
+ * @from: start of the time @value was held for
+ * @to: end of it, no later than the end of the bucket
+ **/
+static void
+up_history_accumulator_hold (UpHistoryAccumulator *acc, guint32 from, guint32 to,
+			     gfloat value, UpDeviceState state)
+{
+	/* nothing is known over gaps, such as from before a restart */
+	if (state == UP_DEVICE_STATE_UNKNOWN || to <= from)
+		return;
+	if (from < acc->start)
+		from = acc->start;
+	if (to <= from)
+		return;
+	acc->integral[state] += value * (gdouble) (to - from) / 3600.0f;
+}
+
+/**
+ * up_history_accumulator_compare:
+ **/
+static gint
+up_history_accumulator_compare (gconstpointer a, gconstpointer b)
+{
+	gfloat fa = *((const gfloat *) a);
+	gfloat fb = *((const gfloat *) b);
+
+	if (fa < fb)
+		return -1;
+	if (fa > fb)
+		return 1;
+	return 0;
+}
+
+/**
+ * up_history_accumulator_emit:
+ *
+ * Appends the row for the bucket: its start time, then each aggregate.
+ **/
+static void
+up_history_accumulator_emit (UpHistoryAccumulator *acc, GArray *aggregates, GArray *rows)
+{
+	guint i;
+	guint rank;
+	gdouble value;
+	UpDeviceState state;
+	const UpHistoryAggregate *aggregate;
+
+	value = acc->start;
+	g_array_append_val (rows, value);
+	if (acc->values != NULL && acc->values->len > 1)
+		g_array_sort (acc->values, up_history_accumulator_compare);
+
+	for (i = 0; i < aggregates->len; i++) {
+		aggregate = &g_array_index (aggregates, UpHistoryAggregate, i);
+		value = NAN;
+		switch (aggregate->kind) {
+		case UP_HISTORY_AGGREGATE_MEAN:
+			if (acc->count > 0)
+				value = acc->sum / acc->count;
+			break;
+		case UP_HISTORY_AGGREGATE_MIN:
+			if (acc->count > 0)
+				value = acc->min;
+			break;
+		case UP_HISTORY_AGGREGATE_MAX:
+			if (acc->count > 0)
+				value = acc->max;
+			break;
+		case UP_HISTORY_AGGREGATE_FIRST:
+			if (acc->count > 0)
+				value = acc->first;
+			break;
+		case UP_HISTORY_AGGREGATE_LAST:
+			if (acc->count > 0)
+				value = acc->last;
+			break;
+		case UP_HISTORY_AGGREGATE_COUNT:
+			value = acc->count;
+			break;
+		case UP_HISTORY_AGGREGATE_PERCENTILE:
+			/* nearest rank */
+			if (acc->count == 0)
+				break;
+			rank = ceil (aggregate->percentile / 100.0f * acc->count);
+			if (rank > 0)
+				rank--;
+			value = g_array_index (acc->values, gfloat, MIN (rank, acc->count - 1));
+			break;
+		case UP_HISTORY_AGGREGATE_INTEGRAL:
+			if (aggregate->state != UP_DEVICE_STATE_UNKNOWN) {
+				value = acc->integral[aggregate->state];
+				break;
+			}
+			value = 0.0f;
+			for (state = 0; state < UP_DEVICE_STATE_LAST; state++)
+				value += acc->integral[state];
+			break;
+		default:
+			g_assert_not_reached ();
+		}
+		g_array_append_val (rows, value);
+	}
+}
+
+/**
+ * up_history_query:
+ * @start: the start of the window, in seconds since the epoch
+ * @end: the end of the window, or 0 for now
+ * @bucket_seconds: the width of each bucket, or 0 for just one
+ * @aggregates: names of what to return for each bucket, %NULL terminated
+ *
+ * Reduces the samples in a window to the aggregates asked for, per
+ * bucket, in one pass over the series. The aggregates are "mean", "min",
+ * "max", "first", "last", "count", "median", a percentile such as "p95",
+ * and "integral", the sum of each value times how long it was held for,
+ * per hour, optionally just for one state as in "integral-charging".
+ * Samples of unknown state, like those marking a restart, are left out.
+ *
+ * Return value: rows of doubles, each being the bucket start time then
+ * one value per aggregate, NaN where there were no samples to use.
+ **/
+GArray *
+up_history_query (UpHistory *history, UpHistoryType type, guint start, guint end,
+		  guint bucket_seconds, gchar **aggregates, GError **error)
+{
+	guint i;
+	guint lo;
+	guint hi;
+	guint mid;
+	guint length;
+	guint n_buckets;
+	gboolean need_values = FALSE;
+	gboolean has_prev = FALSE;
+	guint32 bucket_end;
+	guint32 time_s;
+	guint32 time_prev = 0;
+	gfloat value = 0.0f;
+	gfloat value_prev = 0.0f;
+	UpDeviceState state = UP_DEVICE_STATE_UNKNOWN;
+	UpDeviceState state_prev = UP_DEVICE_STATE_UNKNOWN;
+	UpHistoryAggregate aggregate;
+	UpHistoryAccumulator acc;
+	UpHistorySeries *series;
+	GArray *parsed;
+	GArray *rows = NULL;
+	GTimeVal timeval;
+
+	g_return_val_if_fail (UP_IS_HISTORY (history), NULL);
+	g_return_val_if_fail (aggregates != NULL, NULL);
+
+	series = up_history_get_series (history, type);
+	if (history->priv->id == NULL || series == NULL) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "no history");
+		return NULL;
+	}
+
+	/* work out what to gather before looking at any samples */
+	parsed = g_array_new (FALSE, FALSE, sizeof (UpHistoryAggregate));
+	for (i = 0; aggregates[i] != NULL; i++) {
+		if (!up_history_aggregate_parse (aggregates[i], &aggregate)) {
+			g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+				     "unknown aggregate '%s'", aggregates[i]);
+			goto out;
+		}
+		if (aggregate.kind == UP_HISTORY_AGGREGATE_PERCENTILE)
+			need_values = TRUE;
+		g_array_append_val (parsed, aggregate);
+	}
+	if (parsed->len == 0) {
+		g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+				     "no aggregates");
+		goto out;
+	}
+
+	/* the end is exclusive, so take in samples from this second too */
+	if (end == 0) {
+		g_get_current_time (&timeval);
+		end = timeval.tv_sec + 1;
+	}
+	if (end <= start) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+			     "window %u to %u is empty", start, end);
+		goto out;
+	}
+	if (bucket_seconds == 0)
+		bucket_seconds = end - start;
+	n_buckets = (end - start - 1) / bucket_seconds + 1;
+	if (n_buckets > UP_HISTORY_QUERY_MAX_BUCKETS) {
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+			     "%u buckets is more than the limit of %i",
+			     n_buckets, UP_HISTORY_QUERY_MAX_BUCKETS);
+		goto out;
+	}
+
+	up_history_load_data (history);
+	length = up_history_series_get_length (series);
+
+	/* start from the last sample before the window, as it holds into it */
+	lo = 0;
+	hi = length;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		up_history_series_get (series, mid, &time_s, NULL, NULL);
+		if (time_s >= start)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	if (lo > 0)
+		lo--;
+
+	rows = g_array_sized_new (FALSE, FALSE, sizeof (gdouble), n_buckets * (parsed->len + 1));
+	memset (&acc, 0, sizeof (UpHistoryAccumulator));
+	if (need_values)
+		acc.values = g_array_new (FALSE, FALSE, sizeof (gfloat));
+	up_history_accumulator_reset (&acc, start);
+	bucket_end = MIN (start + bucket_seconds, end);
+
+	for (i = lo; i <= length; i++) {
+		if (i < length) {
+			up_history_series_get (series, i, &time_s, &value, &state);
+			if (time_s >= end)
+				time_s = end;
+		} else {
+			time_s = end;
+		}
+
+		/* close the buckets this sample is past, crediting each with
+		 * the time the previous value held for */
+		while (time_s >= bucket_end && acc.start < end) {
+			if (has_prev)
+				up_history_accumulator_hold (&acc, time_prev, bucket_end, value_prev, state_prev);
+			up_history_accumulator_emit (&acc, parsed, rows);
+			up_history_accumulator_reset (&acc, bucket_end);
+			bucket_end = MIN (bucket_end + bucket_seconds, end);
+		}
+		if (time_s >= end)
+			break;
+
+		if (has_prev)
+			up_history_accumulator_hold (&acc, time_prev, time_s, value_prev, state_prev);
+		if (time_s >= start && state != UP_DEVICE_STATE_UNKNOWN)
+			up_history_accumulator_add (&acc, value);
+		time_prev = time_s;
+		value_prev = value;
+		state_prev = state;
+		has_prev = TRUE;
+	}
+	g_debug ("reduced %s history from %u to %u in %u buckets",
+		 up_history_type_to_string (type), start, end, n_buckets);
+	if (acc.values != NULL)
+		g_array_unref (acc.values);
+out:
+	g_array_unref (parsed);
+	return rows;
+}
+
+/**
+ * up_history_profile_reset:
+ **/
+static void
+up_history_profile_reset (UpHistoryProfile *profile)
+{
+	memset (profile, 0, sizeof (UpHistoryProfile));
+	profile->bin_old = 999;
+}
+
+/**
+ * up_history_profile_get_slot:
+ *
+ * Returns the slot to add a sample at @time_s to, starting the next one
+ * once the current one spans its share of @max_data_age.
+ **/
+static UpHistoryProfileSlot *
+up_history_profile_get_slot (UpHistoryProfile *profile, guint32 time_s, guint max_data_age)
+{
+	UpHistoryProfileSlot *slot;
+	guint32 span;
+
+	span = MAX (max_data_age / (UP_HISTORY_PROFILE_SLOTS - 1), 1);
+	slot = &profile->slots[profile->slot_current];
+	if (slot->time_first != 0 && time_s >= slot->time_first + span) {
+		profile->slot_current = (profile->slot_current + 1) % UP_HISTORY_PROFILE_SLOTS;
+		slot = &profile->slots[profile->slot_current];
+		memset (slot, 0, sizeof (UpHistoryProfileSlot));
+	}
+	if (slot->time_first == 0)
+		slot->time_first = time_s;
+	slot->time_last = time_s;
+	return slot;
+}
+
+/**
+ * up_history_profile_expire:
+ *
+ * Drops the slots with nothing newer than @cutoff, so the profile follows
+ * the battery as it wears rather than averaging over its whole life.
+ *
+ * Return value: %TRUE if anything was dropped
+ **/
+static gboolean
+up_history_profile_expire (UpHistoryProfile *profile, guint32 cutoff)
+{
+	UpHistoryProfileSlot *slot;
+	gboolean ret = FALSE;
+	guint i;
+
+	for (i = 0; i < UP_HISTORY_PROFILE_SLOTS; i++) {
+		slot = &profile->slots[i];
+		if (slot->time_first == 0 || slot->time_last >= cutoff)
+			continue;
+		memset (slot, 0, sizeof (UpHistoryProfileSlot));
+		ret = TRUE;
+	}
+	return ret;
+}
+
+/**
+ * up_history_profile_add:
+ *
+ * Feeds one charge sample into the profile. Across a state change or a
+ * jump of more than 3%, the time taken to move between whole percentages
+ * is added to the bin of the percentage reached.
+ **/
+static void
+up_history_profile_add (UpHistoryProfile *profile, guint max_data_age,
+			guint32 time_s, gfloat value, UpDeviceState state)
+{
+	UpHistoryProfileSlot *slot;
+	guint bin;
+	guint index;
+	gdouble delta;
+
+	if (!profile->has_last || state != profile->state_last) {
+		profile->has_old = FALSE;
+		goto out;
+	}
+
+	/* round to the nearest int */
+	bin = rint (value);
+
+	/* ensure bin is in range */
+	if (bin >= UP_HISTORY_PROFILE_BINS)
+		bin = UP_HISTORY_PROFILE_BINS - 1;
+
+	/* same */
+	if (profile->bin_old == bin)
+		goto out;
+	profile->bin_old = bin;
+
+	if (profile->has_old) {
+		/* not enough or too much difference */
+		delta = fabs (value - profile->value_old);
+		if (delta < 0.01f || delta > 3.0f) {
+			profile->has_old = FALSE;
+			goto out;
+		}
+
+		if (state == UP_DEVICE_STATE_CHARGING || state == UP_DEVICE_STATE_DISCHARGING) {
+			index = (state == UP_DEVICE_STATE_CHARGING) ? 0 : 1;
+			slot = up_history_profile_get_slot (profile, time_s, max_data_age);
+			slot->time[index][bin] += time_s - profile->time_old;
+			slot->count[index][bin]++;
+		}
+	}
+	profile->has_old = TRUE;
+	profile->time_old = time_s;
+	profile->value_old = value;
+out:
+	profile->has_last = TRUE;
+	profile->state_last = state;
+	profile->time_last = time_s;
+}
+
+/**
+ * up_history_profile_catch_up:
+ *
+ * Feeds in the charge samples newer than the profile has seen, which is
+ * all of them when there was no saved profile.
+ **/
+static void
+up_history_profile_catch_up (UpHistory *history)
+{
+	guint i;
+	guint length;
+	guint32 time_s;
+	gfloat value;
+	UpDeviceState state;
+	UpHistoryProfile *profile = &history->priv->profile;
+	const UpHistorySeries *series = &history->priv->data_charge;
+
+	length = up_history_series_get_length (series);
+	for (i = 0; i < length; i++) {
+		up_history_series_get (series, i, &time_s, &value, &state);
+		if (profile->has_last && time_s <= profile->time_last)
+			continue;
+		up_history_profile_add (profile, history->priv->max_data_age,
+					time_s, value, state);
+		history->priv->profile_dirty = TRUE;
+	}
+}
+
 /**
  * up_history_get_profile_data:
  **/
@@ -282,225 +1449,496 @@ GPtrArray *
 up_history_get_profile_data (UpHistory *history, gboolean charging)
 {
 	guint i;
+	guint j;
+	guint index;
 	guint non_zero_accuracy = 0;
 	gfloat average = 0.0f;
-	guint bin;
-	guint oldbin = 999;
-	UpHistoryItem *item_last = NULL;
-	UpHistoryItem *item;
-	UpHistoryItem *item_old = NULL;
 	UpStatsItem *stats;
-	GPtrArray *array;
 	GPtrArray *data;
-	guint time_s;
-	gdouble value;
 	gdouble total_value = 0.0f;
+	gdouble time;
+	guint32 count;
+	UpHistoryProfile *profile;
 
 	g_return_val_if_fail (UP_IS_HISTORY (history), NULL);
 
-	/* create 100 item list and set to zero */
+	if (history->priv->id != NULL)
+		up_history_load_data (history);
+
+	/* the bins are kept up to date as samples are added, and only
+	 * cover the samples we would keep */
+	profile = &history->priv->profile;
+	if (up_history_profile_expire (profile, up_history_get_cutoff (history)))
+		history->priv->profile_dirty = TRUE;
+	index = charging ? 0 : 1;
+
+	/* divide the time by the number of samples to make the average,
+	 * using the accuracy field as a counter for now */
 	data = g_ptr_array_new ();
-	for (i=0; i<101; i++) {
+	for (i=0; i<UP_HISTORY_PROFILE_BINS; i++) {
 		stats = up_stats_item_new ();
+		time = 0.0f;
+		count = 0;
+		for (j = 0; j < UP_HISTORY_PROFILE_SLOTS; j++) {
+			time += profile->slots[j].time[index][i];
+			count += profile->slots[j].count[index][i];
+		}
+		if (count != 0) {
+			up_stats_item_set_value (stats, time / count);
+			up_stats_item_set_accuracy (stats, count);
+			total_value += up_stats_item_get_value (stats);
+			non_zero_accuracy++;
+		}
 		g_ptr_array_add (data, stats);
 	}
 
-	array = history->priv->data_charge;
-	for (i=0; i<array->len; i++) {
-		item = (UpHistoryItem *) g_ptr_array_index (array, i);
-		if (item_last == NULL ||
-		    up_history_item_get_state (item) != up_history_item_get_state (item_last)) {
-			item_old = NULL;
-			goto cont;
-		}
+	/* average */
+	if (non_zero_accuracy != 0)
+		average = total_value / non_zero_accuracy;
+	g_debug ("average is %f", average);
 
-		/* round to the nearest int */
-		bin = rint (up_history_item_get_value (item));
-
-		/* ensure bin is in range */
-		if (bin >= data->len)
-			bin = data->len - 1;
-
-		/* different */
-		if (oldbin != bin) {
-			oldbin = bin;
-			if (item_old != NULL) {
-				/* not enough or too much difference */
-				value = fabs (up_history_item_get_value (item) - up_history_item_get_value (item_old));
-				if (value < 0.01f) {
-					item_old = NULL;
-					goto cont;
-				}
-				if (value > 3.0f) {
-					item_old = NULL;
-					goto cont;
-				}
-
-				time_s = up_history_item_get_time (item) - up_history_item_get_time (item_old);
-				/* use the accuracy field as a counter for now */
-				if ((charging && up_history_item_get_state (item) == UP_DEVICE_STATE_CHARGING) ||
-				    (!charging && up_history_item_get_state (item) == UP_DEVICE_STATE_DISCHARGING)) {
-					stats = (UpStatsItem *) g_ptr_array_index (data, bin);
-					up_stats_item_set_value (stats, up_stats_item_get_value (stats) + time_s);
-					up_stats_item_set_accuracy (stats, up_stats_item_get_accuracy (stats) + 1);
-				}
-			}
-			item_old = item;
-		}
-cont:
-		item_last = item;
+	/* make the values a factor of 0, so that 1.0 is twice the
+	 * average, and -1.0 is half the average */
+	for (i=0; i<UP_HISTORY_PROFILE_BINS; i++) {
+		stats = (UpStatsItem *) g_ptr_array_index (data, i);
+		if (up_stats_item_get_accuracy (stats) > 0)
+			up_stats_item_set_value (stats, (up_stats_item_get_value (stats) - average) / average);
+		else
+			up_stats_item_set_value (stats, 0.0f);
+
+		/* accuracy is a percentage scale, where each cycle = 20% */
+		up_stats_item_set_accuracy (stats, up_stats_item_get_accuracy (stats) * 20.0f);
 	}
 
-	/* divide the value by the number of samples to make the average */
-	for (i=0; i<101; i++) {
-		stats = (UpStatsItem *) g_ptr_array_index (data, i);
-		if (up_stats_item_get_accuracy (stats) != 0)
-			up_stats_item_set_value (stats, up_stats_item_get_value (stats) / up_stats_item_get_accuracy (stats));
+	return data;
+}
+
+/**
+ * up_history_get_filename:
+ **/
+static gchar *
+up_history_get_filename (UpHistory *history, UpHistoryType type, const gchar *suffix)
+{
+	gchar *path;
+	gchar *filename;
+
+	filename = g_strdup_printf ("history-%s-%s.%s",
+				    up_history_type_to_string (type),
+				    history->priv->id, suffix);
+	path = g_build_filename (history->priv->dir, filename, NULL);
+	g_free (filename);
+	return path;
+}
+
+/**
+ * up_history_set_directory:
+ **/
+void
+up_history_set_directory (UpHistory *history, const gchar *dir)
+{
+	g_free (history->priv->dir);
+	history->priv->dir = g_strdup (dir);
+	g_mkdir_with_parents (dir, 0755);
+}
+
+/**
+ * up_history_add_sample:
+ **/
+static void
+up_history_add_sample (UpHistory *history, UpHistoryType type, guint32 time_s, gfloat value, UpDeviceState state)
+{
+	up_history_series_append (up_history_get_series (history, type), time_s, value, state);
+	history->priv->journal[type].pending++;
+	if (type == UP_HISTORY_TYPE_CHARGE) {
+		up_history_profile_add (&history->priv->profile, history->priv->max_data_age,
+					time_s, value, state);
+		history->priv->profile_dirty = TRUE;
 	}
+}
 
-	/* find non-zero accuracy values for the average */
-	for (i=0; i<101; i++) {
-		stats = (UpStatsItem *) g_ptr_array_index (data, i);
-		if (up_stats_item_get_accuracy (stats) > 0) {
-			total_value += up_stats_item_get_value (stats);
-			non_zero_accuracy++;
-		}
+/**
+ * up_history_filter_store:
+ **/
+static void
+up_history_filter_store (UpHistory *history, UpHistoryType type, guint32 time_s, gfloat value, UpDeviceState state)
+{
+	UpHistoryFilter *filter = &history->priv->filter[type];
+
+	up_history_add_sample (history, type, time_s, value, state);
+	filter->has_stored = TRUE;
+	filter->stored_time = time_s;
+	filter->stored_value = value;
+	filter->stored_state = state;
+	filter->has_held = FALSE;
+	filter->stored++;
+}
+
+/**
+ * up_history_filter_flush:
+ *
+ * Stores the sample held back by the swinging door, if any.
+ **/
+static void
+up_history_filter_flush (UpHistory *history, UpHistoryType type)
+{
+	UpHistoryFilter *filter = &history->priv->filter[type];
+
+	if (filter->has_held)
+		up_history_filter_store (history, type, filter->held_time,
+					 filter->held_value, filter->stored_state);
+}
+
+/**
+ * up_history_filter_set_doors:
+ *
+ * Points the doors from the last sample stored through the error band
+ * around the given one.
+ **/
+static void
+up_history_filter_set_doors (UpHistoryFilter *filter, guint32 time_s, gfloat value, gdouble tolerance)
+{
+	gdouble dt = time_s - filter->stored_time;
+
+	if (dt <= 0) {
+		filter->slope_low = -G_MAXDOUBLE;
+		filter->slope_high = G_MAXDOUBLE;
+		return;
+	}
+	filter->slope_low = (value - tolerance - filter->stored_value) / dt;
+	filter->slope_high = (value + tolerance - filter->stored_value) / dt;
+}
+
+/**
+ * up_history_add_filtered:
+ *
+ * Adds a sample if the series compression says it is needed to draw the
+ * curve within the tolerance; a new state, or @max_gap seconds since the
+ * last sample stored, always stores one.
+ **/
+static void
+up_history_add_filtered (UpHistory *history, UpHistoryType type, guint32 time_s, gfloat value, UpDeviceState state)
+{
+	gdouble tolerance;
+	gdouble slope_low;
+	gdouble slope_high;
+	UpHistoryFilter *filter = &history->priv->filter[type];
+
+	filter->offered++;
+	if (filter->compression == UP_HISTORY_COMPRESSION_NONE ||
+	    !filter->has_stored || state != filter->stored_state) {
+		up_history_filter_flush (history, type);
+		up_history_filter_store (history, type, time_s, value, state);
+		return;
 	}
 
-	/* average */
-	if (non_zero_accuracy != 0)
-		average = total_value / non_zero_accuracy;
-	g_debug ("average is %f", average);
+	tolerance = MAX (filter->tolerance_abs, filter->tolerance_rel * fabs (filter->stored_value));
 
-	/* make the values a factor of 0, so that 1.0 is twice the
-	 * average, and -1.0 is half the average */
-	for (i=0; i<101; i++) {
-		stats = (UpStatsItem *) g_ptr_array_index (data, i);
-		if (up_stats_item_get_accuracy (stats) > 0)
-			up_stats_item_set_value (stats, (up_stats_item_get_value (stats) - average) / average);
-		else
-			up_stats_item_set_value (stats, 0.0f);
+	/* deadband: only a big enough change is kept */
+	if (filter->compression == UP_HISTORY_COMPRESSION_DEADBAND) {
+		if (fabs (value - filter->stored_value) > tolerance ||
+		    time_s - filter->stored_time >= filter->max_gap)
+			up_history_filter_store (history, type, time_s, value, state);
+		return;
 	}
 
-	/* accuracy is a percentage scale, where each cycle = 20% */
-	for (i=0; i<101; i++) {
-		stats = (UpStatsItem *) g_ptr_array_index (data, i);
-		up_stats_item_set_accuracy (stats, up_stats_item_get_accuracy (stats) * 20.0f);
+	/* swinging door: narrow the doors with each sample, and once they
+	 * no longer overlap, no straight line from the last sample stored
+	 * can pass near all of them, so the one before this is needed */
+	if (!filter->has_held) {
+		if (time_s - filter->stored_time >= filter->max_gap) {
+			up_history_filter_store (history, type, time_s, value, state);
+			return;
+		}
+		up_history_filter_set_doors (filter, time_s, value, tolerance);
+	} else {
+		slope_low = filter->slope_low;
+		slope_high = filter->slope_high;
+		up_history_filter_set_doors (filter, time_s, value, tolerance);
+		filter->slope_low = MAX (filter->slope_low, slope_low);
+		filter->slope_high = MIN (filter->slope_high, slope_high);
+		if (filter->slope_low > filter->slope_high ||
+		    time_s - filter->stored_time >= filter->max_gap) {
+			up_history_filter_flush (history, type);
+			tolerance = MAX (filter->tolerance_abs, filter->tolerance_rel * fabs (filter->stored_value));
+			up_history_filter_set_doors (filter, time_s, value, tolerance);
+		}
 	}
-
-	return data;
+	filter->has_held = TRUE;
+	filter->held_time = time_s;
+	filter->held_value = value;
 }
 
 /**
- * up_history_get_filename:
+ * up_history_set_compression:
+ * @tolerance_abs: the error allowed when reconstructing the curve
+ * @tolerance_rel: the same, as a fraction of the value, if larger
+ * @max_gap: the longest time, in seconds, between stored samples
  **/
-static gchar *
-up_history_get_filename (UpHistory *history, const gchar *type)
+void
+up_history_set_compression (UpHistory *history, UpHistoryType type,
+			    UpHistoryCompression compression,
+			    gdouble tolerance_abs, gdouble tolerance_rel, guint max_gap)
 {
-	gchar *path;
-	gchar *filename;
+	UpHistoryFilter *filter;
 
-	filename = g_strdup_printf ("history-%s-%s.dat", type, history->priv->id);
-	path = g_build_filename (history->priv->dir, filename, NULL);
-	g_free (filename);
-	return path;
+	g_return_if_fail (UP_IS_HISTORY (history));
+	g_return_if_fail (type < UP_HISTORY_TYPE_UNKNOWN);
+
+	filter = &history->priv->filter[type];
+	up_history_filter_flush (history, type);
+	filter->compression = compression;
+	filter->tolerance_abs = tolerance_abs;
+	filter->tolerance_rel = tolerance_rel;
+	filter->max_gap = max_gap > 0 ? max_gap : G_MAXUINT;
 }
 
 /**
- * up_history_set_directory:
+ * up_history_get_compression_stats:
+ * @offered: (out) (allow-none): the number of samples added
+ * @stored: (out) (allow-none): how many of them were kept
  **/
 void
-up_history_set_directory (UpHistory *history, const gchar *dir)
+up_history_get_compression_stats (UpHistory *history, UpHistoryType type, guint *offered, guint *stored)
 {
-	g_free (history->priv->dir);
-	history->priv->dir = g_strdup (dir);
-	g_mkdir_with_parents (dir, 0755);
+	g_return_if_fail (UP_IS_HISTORY (history));
+	g_return_if_fail (type < UP_HISTORY_TYPE_UNKNOWN);
+
+	if (offered != NULL)
+		*offered = history->priv->filter[type].offered;
+	if (stored != NULL)
+		*stored = history->priv->filter[type].stored;
 }
 
 /**
- * up_history_array_to_file:
- * @list: a valid #GPtrArray instance
- * @filename: a filename
+ * up_history_journal_fill:
  *
- * Saves a copy of the list to a file
+ * Copies the samples from @first onwards into the on-disk record format.
  **/
-static gboolean
-up_history_array_to_file (UpHistory *history, GPtrArray *list, const gchar *filename)
+static UpHistoryRecord *
+up_history_journal_fill (const UpHistorySeries *series, guint first)
 {
 	guint i;
-	UpHistoryItem *item;
-	gchar *part;
-	GString *string;
-	gboolean ret = TRUE;
-	GError *error = NULL;
-	GTimeVal time_now;
-	guint time_item;
-	guint cull_count = 0;
+	guint length = up_history_series_get_length (series);
+	UpHistoryRecord *records;
+	UpDeviceState state;
+
+	records = g_new0 (UpHistoryRecord, length - first);
+	for (i = first; i < length; i++) {
+		up_history_series_get (series, i, &records[i - first].time,
+				       &records[i - first].value, &state);
+		records[i - first].state = state;
+	}
+	return records;
+}
 
-	/* get current time */
-	g_get_current_time (&time_now);
+/**
+ * up_history_journal_flush:
+ *
+ * Appends the samples added since the last flush to the journal.
+ **/
+static void
+up_history_journal_flush (UpHistory *history, UpHistoryType type)
+{
+	gchar *filename;
+	UpHistoryRecord *records;
+	UpHistoryJournal *journal = &history->priv->journal[type];
+	const UpHistorySeries *series = up_history_get_series (history, type);
+
+	/* the size cap may have dropped some before they were written */
+	journal->pending = MIN (journal->pending, up_history_series_get_length (series));
+	if (journal->pending == 0)
+		return;
+
+	filename = up_history_get_filename (history, type, "journal");
+	records = up_history_journal_fill (series, up_history_series_get_length (series) - journal->pending);
+	up_history_writer_append (filename, UP_HISTORY_JOURNAL_MAGIC, UP_HISTORY_JOURNAL_MAGIC_LEN,
+				  (gchar *) records, journal->pending * sizeof (UpHistoryRecord));
+	g_debug ("appending %i %s samples", journal->pending, up_history_type_to_string (type));
+	journal->len += journal->pending;
+	journal->pending = 0;
+	g_free (filename);
+}
 
-	/* generate data */
-	string = g_string_new ("");
-	for (i=0; i<list->len; i++) {
-		item = g_ptr_array_index (list, i);
+/**
+ * up_history_series_rebase:
+ * @file: a journal holding the samples of the series from @dropped on
+ * @dropped: the number of samples trimmed from the series when it was written
+ *
+ * Reads the samples that are in @file from there from now on, freeing
+ * the copies on the heap. Takes ownership of @file.
+ **/
+static void
+up_history_series_rebase (UpHistorySeries *series, GMappedFile *file, guint64 dropped)
+{
+	guint len;
+	guint keep;
+	guint skip;
+
+	len = (g_mapped_file_get_length (file) - UP_HISTORY_JOURNAL_MAGIC_LEN) / sizeof (UpHistoryRecord);
+
+	/* samples keep their place in the file, but some may have been
+	 * trimmed while it was being written; the rest are still at the
+	 * front of the series */
+	if (series->dropped - dropped >= len) {
+		g_mapped_file_unref (file);
+		return;
+	}
+	skip = series->dropped - dropped;
+	keep = MIN (len - skip, up_history_series_get_length (series));
+	if (keep < series->base_len) {
+		g_mapped_file_unref (file);
+		return;
+	}
+	up_history_series_remove_heap (series, keep - series->base_len);
+	up_history_series_set_base (series, file);
+	series->base += skip;
+	series->base_len = keep;
+}
 
-		/* only save entries for the last 24 hours */
-		time_item = up_history_item_get_time (item);
-		if (time_now.tv_sec - time_item > history->priv->max_data_age) {
-			cull_count++;
-			continue;
-		}
-		part = up_history_item_to_string (item);
-		if (part == NULL) {
-			ret = FALSE;
-			break;
-		}
-		g_string_append_printf (string, "%s\n", part);
-		g_free (part);
+/**
+ * up_history_journal_compact_cb:
+ **/
+static void
+up_history_journal_compact_cb (GMappedFile *file, UpHistoryCompaction *compaction)
+{
+	UpHistory *history = compaction->history;
+
+	if (history == NULL)
+		return;
+
+	/* write it all out again next time */
+	if (file == NULL) {
+		history->priv->journal[compaction->type].stale = TRUE;
+		return;
 	}
-	part = g_string_free (string, FALSE);
 
-	/* how many did we kill? */
-	g_debug ("culled %i of %i", cull_count, list->len);
+	/* everything written is on disk now, so read it from there */
+	up_history_series_rebase (up_history_get_series (history, compaction->type),
+				  g_mapped_file_ref (file), compaction->dropped);
+}
 
-	/* we failed to convert to string */
-	if (!ret) {
-		g_warning ("failed to convert");
-		goto out;
+/**
+ * up_history_journal_compact_free:
+ **/
+static void
+up_history_journal_compact_free (UpHistoryCompaction *compaction)
+{
+	if (compaction->history != NULL)
+		g_object_remove_weak_pointer (G_OBJECT (compaction->history),
+					      (gpointer *) &compaction->history);
+	g_free (compaction);
+}
+
+/**
+ * up_history_journal_compact:
+ * @remap: read the samples back from the new journal once it is written
+ *
+ * Replaces the journal with just the samples we still hold in memory.
+ **/
+static void
+up_history_journal_compact (UpHistory *history, UpHistoryType type, gboolean remap)
+{
+	gchar *filename;
+	gchar *data;
+	gsize len;
+	guint length;
+	UpHistoryRecord *records;
+	UpHistoryCompaction *compaction = NULL;
+	UpHistoryJournal *journal = &history->priv->journal[type];
+	UpHistorySeries *series = up_history_get_series (history, type);
+
+	length = up_history_series_get_length (series);
+	len = UP_HISTORY_JOURNAL_MAGIC_LEN + length * sizeof (UpHistoryRecord);
+	data = g_malloc (len);
+	memcpy (data, UP_HISTORY_JOURNAL_MAGIC, UP_HISTORY_JOURNAL_MAGIC_LEN);
+	records = up_history_journal_fill (series, 0);
+	memcpy (data + UP_HISTORY_JOURNAL_MAGIC_LEN, records, length * sizeof (UpHistoryRecord));
+	g_free (records);
+
+	if (remap) {
+		compaction = g_new0 (UpHistoryCompaction, 1);
+		compaction->history = history;
+		compaction->type = type;
+		compaction->dropped = series->dropped;
+		g_object_add_weak_pointer (G_OBJECT (history), (gpointer *) &compaction->history);
 	}
 
-	/* save to disk */
-	ret = g_file_set_contents (filename, part, -1, &error);
-	if (!ret) {
-		g_warning ("failed to set data: %s", error->message);
+	/* the writer takes over the snapshot and replaces the file atomically */
+	filename = up_history_get_filename (history, type, "journal");
+	g_debug ("compacting %s from %i to %i samples", filename,
+		 journal->len + journal->pending, length);
+	up_history_writer_replace (filename, data, len,
+				   remap ? (UpHistoryWriterFunc) up_history_journal_compact_cb : NULL,
+				   compaction,
+				   remap ? (GDestroyNotify) up_history_journal_compact_free : NULL);
+	journal->len = length;
+	journal->pending = 0;
+	journal->stale = FALSE;
+	g_free (filename);
+}
+
+/**
+ * up_history_journal_load:
+ * @filename: a filename
+ *
+ * Maps the journal file as the oldest samples of the series, returning
+ * %FALSE if the file needs rewriting before it can be appended to.
+ **/
+static gboolean
+up_history_journal_load (UpHistory *history, UpHistoryType type, const gchar *filename)
+{
+	gboolean ret = TRUE;
+	GError *error = NULL;
+	GMappedFile *file;
+	const gchar *data;
+	gsize len;
+	UpHistorySeries *series = up_history_get_series (history, type);
+
+	file = g_mapped_file_new (filename, FALSE, &error);
+	if (file == NULL) {
+		g_warning ("failed to map data: %s", error->message);
 		g_error_free (error);
-		goto out;
+		return FALSE;
+	}
+	data = g_mapped_file_get_contents (file);
+	len = g_mapped_file_get_length (file);
+	if (len < UP_HISTORY_JOURNAL_MAGIC_LEN ||
+	    memcmp (data, UP_HISTORY_JOURNAL_MAGIC, UP_HISTORY_JOURNAL_MAGIC_LEN) != 0) {
+		g_warning ("%s is not a history journal", filename);
+		g_mapped_file_unref (file);
+		return FALSE;
 	}
-	g_debug ("saved %s", filename);
 
-out:
-	g_free (part);
+	/* nothing is parsed or copied, pages are read in as queries need them */
+	up_history_series_set_base (series, file);
+	history->priv->journal[type].len = series->base_len;
+	g_debug ("mapped %i items of data from %s", series->base_len, filename);
+
+	/* a torn final record from a crash has to go before we append */
+	if (series->base_len * sizeof (UpHistoryRecord) != len - UP_HISTORY_JOURNAL_MAGIC_LEN) {
+		g_warning ("%s has a partial record", filename);
+		ret = FALSE;
+	}
 	return ret;
 }
 
 /**
  * up_history_array_from_file:
- * @list: a valid #GPtrArray instance
+ * @series: a series of samples
  * @filename: a filename
  *
- * Appends the list from a file
+ * Appends the series from a file
  **/
 static gboolean
-up_history_array_from_file (GPtrArray *list, const gchar *filename)
+up_history_array_from_file (UpHistorySeries *series, const gchar *filename)
 {
 	gboolean ret;
 	GError *error = NULL;
 	gchar *data = NULL;
 	gchar **parts = NULL;
+	gchar **fields;
 	guint i;
 	guint length;
-	UpHistoryItem *item;
 
 	/* do we exist */
 	ret = g_file_test (filename, G_FILE_TEST_EXISTS);
@@ -528,12 +1966,18 @@ up_history_array_from_file (GPtrArray *list, const gchar *filename)
 	/* add valid entries */
 	g_debug ("loading %i items of data from %s", length, filename);
 	for (i=0; i<length-1; i++) {
-		item = up_history_item_new ();
-		ret = up_history_item_set_from_string (item, parts[i]);
-		if (ret)
-			g_ptr_array_add (list, item);
-		else
-			g_object_unref (item);
+		/* same format as up_history_item_set_from_string() */
+		fields = g_strsplit (parts[i], "\t", 0);
+		ret = (g_strv_length (fields) == 3);
+		if (ret) {
+			up_history_series_append (series,
+						  atoi (fields[0]),
+						  atof (fields[1]),
+						  up_device_state_from_string (fields[2]));
+		} else {
+			g_warning ("invalid string: '%s'", parts[i]);
+		}
+		g_strfreev (fields);
 	}
 
 out:
@@ -543,59 +1987,49 @@ out:
 }
 
 /**
- * up_history_save_data:
+ * up_history_get_cutoff:
+ *
+ * Returns the time before which samples are older than the maximum
+ * data age.
  **/
-gboolean
-up_history_save_data (UpHistory *history)
+static guint32
+up_history_get_cutoff (UpHistory *history)
 {
-	gboolean ret = FALSE;
-	gchar *filename_rate = NULL;
-	gchar *filename_charge = NULL;
-	gchar *filename_time_full = NULL;
-	gchar *filename_time_empty = NULL;
-
-	/* we have an ID? */
-	if (history->priv->id == NULL) {
-		g_warning ("no ID, cannot save");
-		goto out;
-	}
-
-	/* get filenames */
-	filename_rate = up_history_get_filename (history, "rate");
-	filename_charge = up_history_get_filename (history, "charge");
-	filename_time_full = up_history_get_filename (history, "time-full");
-	filename_time_empty = up_history_get_filename (history, "time-empty");
+	GTimeVal time_now;
 
-	/* save to disk */
-	ret = up_history_array_to_file (history, history->priv->data_rate, filename_rate);
-	if (!ret)
-		goto out;
-	ret = up_history_array_to_file (history, history->priv->data_charge, filename_charge);
-	if (!ret)
-		goto out;
-	ret = up_history_array_to_file (history, history->priv->data_time_full, filename_time_full);
-	if (!ret)
-		goto out;
-	ret = up_history_array_to_file (history, history->priv->data_time_empty, filename_time_empty);
-	if (!ret)
-		goto out;
-out:
-	g_free (filename_rate);
-	g_free (filename_charge);
-	g_free (filename_time_full);
-	g_free (filename_time_empty);
-	return ret;
+	g_get_current_time (&time_now);
+	if (time_now.tv_sec > history->priv->max_data_age)
+		return time_now.tv_sec - history->priv->max_data_age;
+	return 0;
 }
 
 /**
- * up_history_schedule_save_cb:
+ * up_history_trim:
+ *
+ * Drops samples older than the maximum data age from memory, the same
+ * ones that up_history_array_to_file() leaves out of the file, and what
+ * they added to the profile.
  **/
-static gboolean
-up_history_schedule_save_cb (UpHistory *history)
+static void
+up_history_trim (UpHistory *history)
 {
-	up_history_save_data (history);
-	history->priv->save_id = 0;
-	return FALSE;
+	guint32 cutoff;
+	UpHistoryType type;
+	UpHistorySeries *series;
+
+	cutoff = up_history_get_cutoff (history);
+	if (up_history_profile_expire (&history->priv->profile, cutoff))
+		history->priv->profile_dirty = TRUE;
+
+	for (type = UP_HISTORY_TYPE_CHARGE; type < UP_HISTORY_TYPE_UNKNOWN; type++) {
+		series = up_history_get_series (history, type);
+		up_history_series_trim (series, cutoff, 0);
+		g_debug ("%s history has %i mapped and %i samples in %" G_GSIZE_FORMAT " bytes, "
+			 "storing %i of %i offered",
+			 up_history_type_to_string (type), series->base_len, series->len,
+			 (gsize) (series->size * UP_HISTORY_SAMPLE_SIZE),
+			 history->priv->filter[type].stored, history->priv->filter[type].offered);
+	}
 }
 
 /**
@@ -605,30 +2039,163 @@ static gboolean
 up_history_is_low_power (UpHistory *history)
 {
 	guint length;
-	UpHistoryItem *item;
+	guint32 time_s;
+	gfloat value;
+	UpDeviceState state;
+	const UpHistorySeries *series = &history->priv->data_charge;
 
 	/* current status is always up to date */
 	if (history->priv->state != UP_DEVICE_STATE_DISCHARGING)
 		return FALSE;
 
 	/* have we got any data? */
-	length = history->priv->data_charge->len;
+	length = up_history_series_get_length (series);
 	if (length == 0)
 		return FALSE;
 
 	/* get the last saved charge object */
-	item = (UpHistoryItem *) g_ptr_array_index (history->priv->data_charge, length-1);
-	if (up_history_item_get_state (item) != UP_DEVICE_STATE_DISCHARGING)
+	up_history_series_get (series, length-1, &time_s, &value, &state);
+	if (state != UP_DEVICE_STATE_DISCHARGING)
 		return FALSE;
 
 	/* high enough */
-	if (up_history_item_get_value (item) > 10)
+	if (value > 10)
 		return FALSE;
 
 	/* we are low power */
 	return TRUE;
 }
 
+/**
+ * up_history_profile_get_filename:
+ **/
+static gchar *
+up_history_profile_get_filename (UpHistory *history)
+{
+	gchar *path;
+	gchar *filename;
+
+	filename = g_strdup_printf ("history-profile-%s.bin", history->priv->id);
+	path = g_build_filename (history->priv->dir, filename, NULL);
+	g_free (filename);
+	return path;
+}
+
+/**
+ * up_history_profile_save:
+ **/
+static void
+up_history_profile_save (UpHistory *history)
+{
+	gchar *filename;
+	gchar *data;
+	gsize len;
+
+	len = UP_HISTORY_JOURNAL_MAGIC_LEN + sizeof (UpHistoryProfile);
+	data = g_malloc (len);
+	memcpy (data, UP_HISTORY_PROFILE_MAGIC, UP_HISTORY_JOURNAL_MAGIC_LEN);
+	memcpy (data + UP_HISTORY_JOURNAL_MAGIC_LEN, &history->priv->profile, sizeof (UpHistoryProfile));
+
+	filename = up_history_profile_get_filename (history);
+	up_history_writer_replace (filename, data, len, NULL, NULL, NULL);
+	history->priv->profile_dirty = FALSE;
+	g_free (filename);
+}
+
+/**
+ * up_history_profile_load:
+ *
+ * Loads the saved profile, then adds any samples saved after it.
+ **/
+static void
+up_history_profile_load (UpHistory *history)
+{
+	gchar *filename;
+	gchar *data = NULL;
+	gsize len = 0;
+
+	filename = up_history_profile_get_filename (history);
+	up_history_profile_reset (&history->priv->profile);
+	if (g_file_get_contents (filename, &data, &len, NULL) &&
+	    len == UP_HISTORY_JOURNAL_MAGIC_LEN + sizeof (UpHistoryProfile) &&
+	    memcmp (data, UP_HISTORY_PROFILE_MAGIC, UP_HISTORY_JOURNAL_MAGIC_LEN) == 0) {
+		memcpy (&history->priv->profile, data + UP_HISTORY_JOURNAL_MAGIC_LEN, sizeof (UpHistoryProfile));
+	} else {
+		g_debug ("no usable profile in %s, rebuilding it", filename);
+	}
+	up_history_profile_catch_up (history);
+	g_free (data);
+	g_free (filename);
+}
+
+/**
+ * up_history_save_data_full:
+ * @final: the history is going away, so rewrite any journal holding
+ * samples we no longer have, and don't read anything back
+ *
+ * Queues what has changed since the last save for the writer, which
+ * does the actual disk I/O.
+ **/
+static gboolean
+up_history_save_data_full (UpHistory *history, gboolean final)
+{
+	guint len;
+	UpHistoryType type;
+	UpHistoryJournal *journal;
+
+	/* we have an ID? */
+	if (history->priv->id == NULL) {
+		g_warning ("no ID, cannot save");
+		return FALSE;
+	}
+
+	/* the size of the journals is needed to know what to write */
+	up_history_load_data (history);
+
+	/* don't keep what we would not save */
+	up_history_trim (history);
+
+	/* normally just append the new samples, but once most of a journal
+	 * is stale, rewrite it from what is held in memory */
+	for (type = UP_HISTORY_TYPE_CHARGE; type < UP_HISTORY_TYPE_UNKNOWN; type++) {
+		journal = &history->priv->journal[type];
+		len = up_history_series_get_length (up_history_get_series (history, type));
+		if (journal->stale ||
+		    journal->len + journal->pending > 2 * len + UP_HISTORY_SERIES_MIN_SIZE ||
+		    (final && journal->len + journal->pending != len))
+			up_history_journal_compact (history, type, !final);
+		else
+			up_history_journal_flush (history, type);
+	}
+
+	/* the profile is rewritten whole, so don't do that for every
+	 * sample when low on power; it catches up on load if need be */
+	if (history->priv->profile_dirty &&
+	    (final || !up_history_is_low_power (history)))
+		up_history_profile_save (history);
+	return TRUE;
+}
+
+/**
+ * up_history_save_data:
+ **/
+gboolean
+up_history_save_data (UpHistory *history)
+{
+	return up_history_save_data_full (history, FALSE);
+}
+
+/**
+ * up_history_schedule_save_cb:
+ **/
+static gboolean
+up_history_schedule_save_cb (UpHistory *history)
+{
+	up_history_save_data (history);
+	history->priv->save_id = 0;
+	return FALSE;
+}
+
 /**
  * up_history_schedule_save:
  **/
@@ -661,53 +2228,78 @@ up_history_schedule_save (UpHistory *history)
 
 /**
  * up_history_load_data:
+ *
+ * Loads the history saved for the device, the first time it is needed.
+ * Samples added before then are kept as the newest ones.
  **/
-static gboolean
+static void
 up_history_load_data (UpHistory *history)
 {
 	gchar *filename;
-	UpHistoryItem *item;
-
-	/* load rate history from disk */
-	filename = up_history_get_filename (history, "rate");
-	up_history_array_from_file (history->priv->data_rate, filename);
-	g_free (filename);
-
-	/* load charge history from disk */
-	filename = up_history_get_filename (history, "charge");
-	up_history_array_from_file (history->priv->data_charge, filename);
-	g_free (filename);
-
-	/* load charge history from disk */
-	filename = up_history_get_filename (history, "time-full");
-	up_history_array_from_file (history->priv->data_time_full, filename);
-	g_free (filename);
-
-	/* load charge history from disk */
-	filename = up_history_get_filename (history, "time-empty");
-	up_history_array_from_file (history->priv->data_time_empty, filename);
-	g_free (filename);
-
-	/* save a marker so we don't use incomplete percentages */
-	item = up_history_item_new ();
-	up_history_item_set_time_to_present (item);
-	g_ptr_array_add (history->priv->data_rate, g_object_ref (item));
-	g_ptr_array_add (history->priv->data_charge, g_object_ref (item));
-	g_ptr_array_add (history->priv->data_time_full, g_object_ref (item));
-	g_ptr_array_add (history->priv->data_time_empty, g_object_ref (item));
-	g_object_unref (item);
-	up_history_schedule_save (history);
+	gchar *filename_old;
+	guint i;
+	guint pending;
+	UpHistoryType type;
+	UpHistorySeries *series;
+	UpHistorySeries buffered;
+
+	if (history->priv->loaded)
+		return;
+	history->priv->loaded = TRUE;
+
+	for (type = UP_HISTORY_TYPE_CHARGE; type < UP_HISTORY_TYPE_UNKNOWN; type++) {
+		/* take the samples added so far out of the way */
+		series = up_history_get_series (history, type);
+		buffered = *series;
+		series->time = NULL;
+		series->value = NULL;
+		series->state = NULL;
+		series->len = 0;
+		series->size = 0;
+		buffered.base_file = NULL;
+		buffered.base_len = 0;
+		memset (buffered.rollup, 0, sizeof (buffered.rollup));
+		pending = history->priv->journal[type].pending;
+
+		/* load history from disk */
+		filename = up_history_get_filename (history, type, "journal");
+		filename_old = up_history_get_filename (history, type, "dat");
+		if (g_file_test (filename, G_FILE_TEST_EXISTS)) {
+			if (!up_history_journal_load (history, type, filename))
+				up_history_journal_compact (history, type, TRUE);
+
+		/* migrate from the old text format, once */
+		} else if (up_history_array_from_file (series, filename_old)) {
+			g_debug ("migrating %s", filename_old);
+			up_history_journal_compact (history, type, TRUE);
+			up_history_writer_unlink (filename_old);
+		}
+		g_free (filename_old);
+		g_free (filename);
+
+		/* then put them back after what was saved */
+		for (i = 0; i < buffered.len; i++)
+			up_history_series_append (series, buffered.time[i],
+						  buffered.value[i], buffered.state[i]);
+		history->priv->journal[type].pending = MIN (pending, buffered.len);
+		up_history_series_clear (&buffered);
+	}
 
-	return TRUE;
+	/* this also counts the samples added so far */
+	up_history_profile_load (history);
 }
 
 /**
  * up_history_set_id:
+ *
+ * Sets the device the history is for. What was saved for it is only
+ * loaded once it is asked for or saved, so this never waits for the disk.
  **/
 gboolean
 up_history_set_id (UpHistory *history, const gchar *id)
 {
-	gboolean ret;
+	GTimeVal timeval;
+	UpHistoryType type;
 
 	g_return_val_if_fail (UP_IS_HISTORY (history), FALSE);
 
@@ -718,9 +2310,13 @@ up_history_set_id (UpHistory *history, const gchar *id)
 
 	g_debug ("using id: %s", id);
 	history->priv->id = g_strdup (id);
-	/* load all previous data */
-	ret = up_history_load_data (history);
-	return ret;
+
+	/* save a marker so we don't use incomplete percentages */
+	g_get_current_time (&timeval);
+	for (type = UP_HISTORY_TYPE_CHARGE; type < UP_HISTORY_TYPE_UNKNOWN; type++)
+		up_history_add_sample (history, type, timeval.tv_sec, 0.0f, UP_DEVICE_STATE_UNKNOWN);
+	up_history_schedule_save (history);
+	return TRUE;
 }
 
 /**
@@ -743,7 +2339,7 @@ up_history_set_state (UpHistory *history, UpDeviceState state)
 gboolean
 up_history_set_charge_data (UpHistory *history, gdouble percentage)
 {
-	UpHistoryItem *item;
+	GTimeVal timeval;
 
 	g_return_val_if_fail (UP_IS_HISTORY (history), FALSE);
 
@@ -755,11 +2351,8 @@ up_history_set_charge_data (UpHistory *history, gdouble percentage)
 		return FALSE;
 
 	/* add to array and schedule save file */
-	item = up_history_item_new ();
-	up_history_item_set_time_to_present (item);
-	up_history_item_set_value (item, percentage);
-	up_history_item_set_state (item, history->priv->state);
-	g_ptr_array_add (history->priv->data_charge, item);
+	g_get_current_time (&timeval);
+	up_history_add_filtered (history, UP_HISTORY_TYPE_CHARGE, timeval.tv_sec, percentage, history->priv->state);
 	up_history_schedule_save (history);
 
 	/* save last value */
@@ -774,7 +2367,7 @@ up_history_set_charge_data (UpHistory *history, gdouble percentage)
 gboolean
 up_history_set_rate_data (UpHistory *history, gdouble rate)
 {
-	UpHistoryItem *item;
+	GTimeVal timeval;
 
 	g_return_val_if_fail (UP_IS_HISTORY (history), FALSE);
 
@@ -786,11 +2379,8 @@ up_history_set_rate_data (UpHistory *history, gdouble rate)
 		return FALSE;
 
 	/* add to array and schedule save file */
-	item = up_history_item_new ();
-	up_history_item_set_time_to_present (item);
-	up_history_item_set_value (item, rate);
-	up_history_item_set_state (item, history->priv->state);
-	g_ptr_array_add (history->priv->data_rate, item);
+	g_get_current_time (&timeval);
+	up_history_add_filtered (history, UP_HISTORY_TYPE_RATE, timeval.tv_sec, rate, history->priv->state);
 	up_history_schedule_save (history);
 
 	/* save last value */
@@ -805,7 +2395,7 @@ up_history_set_rate_data (UpHistory *history, gdouble rate)
 gboolean
 up_history_set_time_full_data (UpHistory *history, gint64 time_s)
 {
-	UpHistoryItem *item;
+	GTimeVal timeval;
 
 	g_return_val_if_fail (UP_IS_HISTORY (history), FALSE);
 
@@ -819,11 +2409,8 @@ up_history_set_time_full_data (UpHistory *history, gint64 time_s)
 		return FALSE;
 
 	/* add to array and schedule save file */
-	item = up_history_item_new ();
-	up_history_item_set_time_to_present (item);
-	up_history_item_set_value (item, (gdouble) time_s);
-	up_history_item_set_state (item, history->priv->state);
-	g_ptr_array_add (history->priv->data_time_full, item);
+	g_get_current_time (&timeval);
+	up_history_add_filtered (history, UP_HISTORY_TYPE_TIME_FULL, timeval.tv_sec, (gfloat) time_s, history->priv->state);
 	up_history_schedule_save (history);
 
 	/* save last value */
@@ -838,7 +2425,7 @@ up_history_set_time_full_data (UpHistory *history, gint64 time_s)
 gboolean
 up_history_set_time_empty_data (UpHistory *history, gint64 time_s)
 {
-	UpHistoryItem *item;
+	GTimeVal timeval;
 
 	g_return_val_if_fail (UP_IS_HISTORY (history), FALSE);
 
@@ -852,11 +2439,8 @@ up_history_set_time_empty_data (UpHistory *history, gint64 time_s)
 		return FALSE;
 
 	/* add to array and schedule save file */
-	item = up_history_item_new ();
-	up_history_item_set_time_to_present (item);
-	up_history_item_set_value (item, (gdouble) time_s);
-	up_history_item_set_state (item, history->priv->state);
-	g_ptr_array_add (history->priv->data_time_empty, item);
+	g_get_current_time (&timeval);
+	up_history_add_filtered (history, UP_HISTORY_TYPE_TIME_EMPTY, timeval.tv_sec, (gfloat) time_s, history->priv->state);
 	up_history_schedule_save (history);
 
 	/* save last value */
@@ -884,12 +2468,14 @@ up_history_class_init (UpHistoryClass *klass)
 static void
 up_history_init (UpHistory *history)
 {
+	UpHistoryType type;
+
 	history->priv = UP_HISTORY_GET_PRIVATE (history);
-	history->priv->data_rate = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
-	history->priv->data_charge = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
-	history->priv->data_time_full = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
-	history->priv->data_time_empty = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
 	history->priv->max_data_age = UP_HISTORY_DEFAULT_MAX_DATA_AGE;
+	up_history_profile_reset (&history->priv->profile);
+	for (type = UP_HISTORY_TYPE_CHARGE; type < UP_HISTORY_TYPE_UNKNOWN; type++)
+		history->priv->filter[type].max_gap = G_MAXUINT;
+	up_history_set_max_data_size (history, UP_HISTORY_DEFAULT_MAX_DATA_SIZE);
 
 	up_history_set_directory (history, HISTORY_DIR);
 }
@@ -902,6 +2488,7 @@ static void
 up_history_finalize (GObject *object)
 {
 	UpHistory *history;
+	UpHistoryType type;
 
 	g_return_if_fail (UP_IS_HISTORY (object));
 
@@ -910,13 +2497,16 @@ up_history_finalize (GObject *object)
 	/* save */
 	if (history->priv->save_id > 0)
 		g_source_remove (history->priv->save_id);
-	if (history->priv->id != NULL)
-		up_history_save_data (history);
+	if (history->priv->id != NULL) {
+		for (type = UP_HISTORY_TYPE_CHARGE; type < UP_HISTORY_TYPE_UNKNOWN; type++)
+			up_history_filter_flush (history, type);
+		up_history_save_data_full (history, TRUE);
+	}
 
-	g_ptr_array_unref (history->priv->data_rate);
-	g_ptr_array_unref (history->priv->data_charge);
-	g_ptr_array_unref (history->priv->data_time_full);
-	g_ptr_array_unref (history->priv->data_time_empty);
+	up_history_series_clear (&history->priv->data_rate);
+	up_history_series_clear (&history->priv->data_charge);
+	up_history_series_clear (&history->priv->data_time_full);
+	up_history_series_clear (&history->priv->data_time_empty);
 
 	g_free (history->priv->id);
 	g_free (history->priv->dir);
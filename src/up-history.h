@@ -58,6 +58,12 @@ typedef enum {
 	UP_HISTORY_TYPE_UNKNOWN
 } UpHistoryType;
 
+typedef enum {
+	UP_HISTORY_COMPRESSION_NONE,
+	UP_HISTORY_COMPRESSION_DEADBAND,
+	UP_HISTORY_COMPRESSION_SWINGING_DOOR
+} UpHistoryCompression;
+
 
 GType		 up_history_get_type			(void);
 UpHistory	*up_history_new				(void);
@@ -68,6 +74,13 @@ GPtrArray	*up_history_get_data			(UpHistory		*history,
 							 guint			 resolution);
 GPtrArray	*up_history_get_profile_data		(UpHistory		*history,
 							 gboolean		 charging);
+GArray		*up_history_query			(UpHistory		*history,
+							 UpHistoryType		 type,
+							 guint			 start,
+							 guint			 end,
+							 guint			 bucket_seconds,
+							 gchar			**aggregates,
+							 GError			**error);
 gboolean	 up_history_set_id			(UpHistory		*history,
 							 const gchar		*id);
 gboolean	 up_history_set_state			(UpHistory		*history,
@@ -82,6 +95,22 @@ gboolean	 up_history_set_time_empty_data		(UpHistory		*history,
 							 gint64			 time);
 void		 up_history_set_max_data_age		(UpHistory		*history,
 							 guint			 max_data_age);
+void		 up_history_set_max_data_size		(UpHistory		*history,
+							 gsize			 max_data_size);
+void		 up_history_get_size			(UpHistory		*history,
+							 UpHistoryType		 type,
+							 guint			*samples,
+							 gsize			*bytes);
+void		 up_history_set_compression		(UpHistory		*history,
+							 UpHistoryType		 type,
+							 UpHistoryCompression	 compression,
+							 gdouble		 tolerance_abs,
+							 gdouble		 tolerance_rel,
+							 guint			 max_gap);
+void		 up_history_get_compression_stats	(UpHistory		*history,
+							 UpHistoryType		 type,
+							 guint			*offered,
+							 guint			*stored);
 gboolean	 up_history_save_data			(UpHistory		*history);
 
 void		 up_history_set_directory		(UpHistory		*history,
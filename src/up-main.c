@@ -39,6 +39,7 @@
 #include <dbus/dbus-glib-lowlevel.h>
 
 #include "up-daemon.h"
+#include "up-history-writer.h"
 #include "up-kbd-backlight.h"
 #include "up-wakeups.h"
 
@@ -100,6 +101,29 @@ up_main_sigint_cb (gpointer user_data)
 	return FALSE;
 }
 
+/**
+ * up_main_print_stats:
+ **/
+static void
+up_main_print_stats (UpDaemon *daemon)
+{
+	UpDaemonPollStats poll;
+	UpDaemonPropsStats props;
+
+	up_daemon_get_poll_stats (daemon, &poll);
+	g_debug ("polled %i times, refreshing %i devices, at most %i and %"G_GINT64_FORMAT"us at once",
+		 poll.ticks, poll.refreshes, poll.max_batch_size, poll.max_dispatch_time);
+	if (poll.predictions > 0) {
+		g_debug ("%i predicted crossings, off by %"G_GINT64_FORMAT"s on average and %"G_GINT64_FORMAT"s at most",
+			 poll.predictions, poll.prediction_error_total / poll.predictions,
+			 poll.max_prediction_error);
+	}
+
+	up_daemon_get_props_stats (daemon, &props);
+	g_debug ("sent %i PropertiesChanged, merging %i more, and %i to subscribers",
+		 props.sent, props.suppressed, props.targeted);
+}
+
 /**
  * up_main_timed_exit_cb:
  *
@@ -278,6 +302,7 @@ main (gint argc, gchar **argv)
 
 	/* wait for input or timeout */
 	g_main_loop_run (loop);
+	up_main_print_stats (daemon);
 	retval = 0;
 out:
 	if (kbd_backlight != NULL)
@@ -288,6 +313,9 @@ out:
 		g_object_unref (daemon);
 	if (loop != NULL)
 		g_main_loop_unref (loop);
+
+	/* the devices have queued their final history saves */
+	up_history_writer_sync ();
 	return retval;
 }
 
@@ -23,7 +23,9 @@
 
 #include <glib-object.h>
 #include <glib/gstdio.h>
+#include <gio/gio.h>
 #include <up-history-item.h>
+#include <up-stats-item.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
@@ -32,6 +34,7 @@
 #include "up-device.h"
 #include "up-device-list.h"
 #include "up-history.h"
+#include "up-history-writer.h"
 #include "up-native.h"
 #include "up-wakeups.h"
 
@@ -72,6 +75,150 @@ up_test_daemon_func (void)
 	g_object_unref (daemon);
 }
 
+static void
+up_test_daemon_properties_changed_func (void)
+{
+	UpDaemon *daemon;
+	gint64 now;
+	guint delay;
+	guint i;
+	struct {
+		gint64		 ago;		/* s before now, or -1 for never */
+		gboolean	 urgent;
+		guint		 min;		/* ms */
+		guint		 max;		/* ms */
+	} tests[] = {
+		{ -1, FALSE,	0,	0 },	/* first signal */
+		{ 20, FALSE,	0,	0 },	/* window long gone */
+		{ 10, FALSE,	0,	0 },	/* window just over */
+		{ 4, FALSE,	5000,	6000 },
+		{ 0, FALSE,	9000,	10000 },
+		{ 0, TRUE,	0,	0 },	/* urgent goes straight out */
+		{ 4, TRUE,	0,	0 },
+	};
+
+	/* PropertiesChangedInterval=10 in the test config */
+	daemon = up_daemon_new ();
+	now = g_get_monotonic_time ();
+	for (i = 0; i < G_N_ELEMENTS (tests); i++) {
+		delay = up_daemon_get_properties_changed_delay (daemon,
+								tests[i].ago < 0 ? 0 : now - tests[i].ago * G_USEC_PER_SEC,
+								tests[i].urgent);
+		g_assert_cmpint (delay, >=, tests[i].min);
+		g_assert_cmpint (delay, <=, tests[i].max);
+	}
+	g_object_unref (daemon);
+}
+
+static void
+up_test_daemon_poll_timeout_func (void)
+{
+	UpDaemon *daemon;
+	guint timeout;
+	guint i;
+	struct {
+		gboolean	 on_battery;
+		guint		 timeout;	/* s */
+		gboolean	 reliable;
+		gdouble		 delta;
+		UpDeviceState	 state;
+		gdouble		 percentage;
+		gdouble		 energy_rate;	/* W, with 50 Wh full */
+		gint64		 crossing;	/* s */
+		guint		 expected;	/* s */
+	} tests[] = {
+		/* adaptive backoff */
+		{ FALSE, 60,	FALSE,	0.0,	UP_DEVICE_STATE_CHARGING,	50,	0,	-1,	120 },
+		{ FALSE, 200,	FALSE,	0.0,	UP_DEVICE_STATE_FULLY_CHARGED,	100,	0,	-1,	300 },
+		{ TRUE, 60,	FALSE,	1.0,	UP_DEVICE_STATE_DISCHARGING,	50,	0,	-1,	30 },
+		{ TRUE, 60,	FALSE,	0.0,	UP_DEVICE_STATE_DISCHARGING,	50,	0,	-1,	60 },
+		{ TRUE, 60,	FALSE,	0.0,	UP_DEVICE_STATE_DISCHARGING,	15,	0,	-1,	5 },
+		/* never more than 1% between two polls */
+		{ TRUE, 200,	FALSE,	0.0,	UP_DEVICE_STATE_DISCHARGING,	50,	10,	1000,	180 },
+		/* just before the next warning level */
+		{ TRUE, 60,	FALSE,	0.0,	UP_DEVICE_STATE_DISCHARGING,	50,	0,	1000,	120 },
+		{ TRUE, 60,	FALSE,	0.0,	UP_DEVICE_STATE_DISCHARGING,	50,	0,	100,	95 },
+		{ TRUE, 60,	FALSE,	0.0,	UP_DEVICE_STATE_DISCHARGING,	50,	0,	2,	5 },
+		/* uevents make polling a watchdog, but keep both clamps */
+		{ FALSE, 60,	TRUE,	0.0,	UP_DEVICE_STATE_FULLY_CHARGED,	100,	0,	-1,	600 },
+		{ TRUE, 60,	TRUE,	0.0,	UP_DEVICE_STATE_DISCHARGING,	50,	0,	-1,	600 },
+		{ TRUE, 60,	TRUE,	0.0,	UP_DEVICE_STATE_DISCHARGING,	50,	10,	-1,	180 },
+		{ TRUE, 60,	TRUE,	0.0,	UP_DEVICE_STATE_DISCHARGING,	50,	0,	100,	95 },
+		{ TRUE, 60,	TRUE,	0.0,	UP_DEVICE_STATE_DISCHARGING,	50,	0,	2,	5 },
+	};
+
+	/* PollIntervalMax=300, PollWatchdogInterval=600 and PercentageLow=10
+	 * in the test config */
+	daemon = up_daemon_new ();
+	for (i = 0; i < G_N_ELEMENTS (tests); i++) {
+		up_daemon_set_on_battery (daemon, tests[i].on_battery);
+		timeout = up_daemon_get_poll_timeout (daemon,
+						      tests[i].timeout,
+						      tests[i].reliable,
+						      tests[i].delta,
+						      tests[i].state,
+						      tests[i].percentage,
+						      50.0f,
+						      tests[i].energy_rate,
+						      tests[i].crossing);
+		g_assert_cmpint (timeout, ==, tests[i].expected);
+	}
+	g_object_unref (daemon);
+}
+
+static void
+up_test_daemon_filter_func (void)
+{
+	UpDaemonFilter filter;
+	GVariant *last;
+	GVariant *value;
+	guint i;
+	struct {
+		UpDaemonFilterKind	 kind;
+		gdouble			 threshold;
+		const gchar		*last;		/* GVariant text, or NULL */
+		const gchar		*value;
+		gboolean		 matches;
+	} tests[] = {
+		/* nothing sent yet */
+		{ UP_DAEMON_FILTER_ANY,		0,	NULL,		"50.0",		TRUE },
+		{ UP_DAEMON_FILTER_DELTA,	5,	NULL,		"50.0",		TRUE },
+		{ UP_DAEMON_FILTER_CROSSING,	10,	NULL,		"50.0",		TRUE },
+		{ UP_DAEMON_FILTER_ANY,		0,	"50.0",		"50.0",		FALSE },
+		{ UP_DAEMON_FILTER_ANY,		0,	"50.0",		"50.5",		TRUE },
+		{ UP_DAEMON_FILTER_DELTA,	5,	"50.0",		"53.0",		FALSE },
+		{ UP_DAEMON_FILTER_DELTA,	5,	"50.0",		"55.0",		TRUE },
+		{ UP_DAEMON_FILTER_DELTA,	5,	"50.0",		"44.0",		TRUE },
+		{ UP_DAEMON_FILTER_DELTA,	1,	"uint32 1",	"uint32 2",	TRUE },
+		/* crossing down and up, at the threshold counts as above */
+		{ UP_DAEMON_FILTER_CROSSING,	10,	"12.0",		"11.0",		FALSE },
+		{ UP_DAEMON_FILTER_CROSSING,	10,	"11.0",		"9.0",		TRUE },
+		{ UP_DAEMON_FILTER_CROSSING,	10,	"9.0",		"8.0",		FALSE },
+		{ UP_DAEMON_FILTER_CROSSING,	10,	"9.0",		"10.0",		TRUE },
+		{ UP_DAEMON_FILTER_CROSSING,	600,	"int64 700",	"int64 500",	TRUE },
+		{ UP_DAEMON_FILTER_CROSSING,	600,	"int64 500",	"int64 700",	TRUE },
+		/* not a number, so any change */
+		{ UP_DAEMON_FILTER_DELTA,	5,	"'battery-full'", "'battery-good'", TRUE },
+		{ UP_DAEMON_FILTER_CROSSING,	5,	"'battery-full'", "'battery-full'", FALSE },
+		{ UP_DAEMON_FILTER_DELTA,	5,	"true",		"false",	TRUE },
+	};
+
+	filter.property = NULL;
+	for (i = 0; i < G_N_ELEMENTS (tests); i++) {
+		filter.kind = tests[i].kind;
+		filter.threshold = tests[i].threshold;
+		last = NULL;
+		if (tests[i].last != NULL)
+			last = g_variant_parse (NULL, tests[i].last, NULL, NULL, NULL);
+		value = g_variant_parse (NULL, tests[i].value, NULL, NULL, NULL);
+		g_assert (value != NULL);
+		g_assert_cmpint (up_daemon_filter_matches (&filter, last, value), ==, tests[i].matches);
+		if (last != NULL)
+			g_variant_unref (last);
+		g_variant_unref (value);
+	}
+}
+
 static void
 up_test_device_func (void)
 {
@@ -118,21 +265,30 @@ up_test_device_list_func (void)
 }
 
 static void
-up_test_history_remove_temp_files (void)
+up_test_history_remove_temp_files (const gchar *id)
 {
+	const gchar *types[] = { "time-full", "time-empty", "charge", "rate", NULL };
+	gchar *basename;
 	gchar *filename;
-	filename = g_build_filename (history_dir, "history-time-full-test.dat", NULL);
-	g_unlink (filename);
-	g_free (filename);
-	filename = g_build_filename (history_dir, "history-time-empty-test.dat", NULL);
-	g_unlink (filename);
-	g_free (filename);
-	filename = g_build_filename (history_dir, "history-charge-test.dat", NULL);
-	g_unlink (filename);
-	g_free (filename);
-	filename = g_build_filename (history_dir, "history-rate-test.dat", NULL);
+	guint i;
+
+	for (i = 0; types[i] != NULL; i++) {
+		basename = g_strdup_printf ("history-%s-%s.dat", types[i], id);
+		filename = g_build_filename (history_dir, basename, NULL);
+		g_unlink (filename);
+		g_free (filename);
+		g_free (basename);
+		basename = g_strdup_printf ("history-%s-%s.journal", types[i], id);
+		filename = g_build_filename (history_dir, basename, NULL);
+		g_unlink (filename);
+		g_free (filename);
+		g_free (basename);
+	}
+	basename = g_strdup_printf ("history-profile-%s.bin", id);
+	filename = g_build_filename (history_dir, basename, NULL);
 	g_unlink (filename);
 	g_free (filename);
+	g_free (basename);
 }
 
 static void
@@ -143,6 +299,18 @@ up_test_history_func (void)
 	GPtrArray *array;
 	gchar *filename;
 	UpHistoryItem *item, *item2, *item3;
+	guint samples;
+	gsize bytes;
+	guint i;
+	guint offered, stored;
+	gchar *data;
+	GString *string;
+	gint64 now;
+	UpHistoryWriterStats stats;
+	GArray *rows;
+	GError *error = NULL;
+	const gchar *aggregates[] = { "max", "count", NULL };
+	const gchar *aggregates_invalid[] = { "max", "mode", NULL };
 
 	history = up_history_new ();
 	g_assert (history != NULL);
@@ -154,7 +322,9 @@ up_test_history_func (void)
 	up_history_set_directory (history, history_dir);
 
 	/* remove previous test files */
-	up_test_history_remove_temp_files ();
+	up_test_history_remove_temp_files ("test");
+	up_test_history_remove_temp_files ("migrate");
+	up_test_history_remove_temp_files ("profile");
 
 	/* setup fresh environment */
 	ret = up_history_set_id (history, "test");
@@ -185,6 +355,11 @@ up_test_history_func (void)
 	up_history_set_time_empty_data (history, 12344);
 	up_history_set_time_full_data (history, 54320);
 
+	/* the marker and the three points are held in memory */
+	up_history_get_size (history, UP_HISTORY_TYPE_CHARGE, &samples, &bytes);
+	g_assert_cmpint (samples, ==, 4);
+	g_assert_cmpint (bytes, >, 0);
+
 	/* get data for last 10 seconds */
 	array = up_history_get_data (history, UP_HISTORY_TYPE_CHARGE, 10, 100);
 	g_assert (array != NULL);
@@ -232,9 +407,13 @@ up_test_history_func (void)
 	ret = up_history_save_data (history);
 	g_assert (ret);
 	g_object_unref (history);
+	up_history_writer_sync ();
+	up_history_writer_get_stats (&stats);
+	g_assert_cmpint (stats.flushes, >, 0);
+	g_assert_cmpint (stats.queue_depth, ==, 0);
 
 	/* ensure the file was created */
-	filename = g_build_filename (history_dir, "history-charge-test.dat", NULL);
+	filename = g_build_filename (history_dir, "history-charge-test.journal", NULL);
 	g_assert (g_file_test (filename, G_FILE_TEST_EXISTS));
 	g_free (filename);
 
@@ -257,21 +436,112 @@ up_test_history_func (void)
 	up_history_set_max_data_age (history, 2);
 	g_usleep (1100 * G_USEC_PER_SEC / 1000);
 	g_object_unref (history);
+	up_history_writer_sync ();
 
-	/* ensure only 2 points are returned */
+	/* ensure only the newest point and the two markers after it are returned */
 	history = up_history_new ();
 	up_history_set_directory (history, history_dir);
 	up_history_set_id (history, "test");
 	array = up_history_get_data (history, UP_HISTORY_TYPE_CHARGE, 10, 100);
 	g_assert (array != NULL);
-	g_assert_cmpint (array->len, ==, 2);
+	g_assert_cmpint (array->len, ==, 3);
+	item = g_ptr_array_index (array, 2);
+	g_assert_cmpint (up_history_item_get_value (item), ==, 95);
 	g_ptr_array_unref (array);
 
+	/* ensure the memory used stays bounded */
+	up_history_set_max_data_size (history, 0);
+	up_history_set_state (history, UP_DEVICE_STATE_CHARGING);
+	for (i = 0; i < 1000; i++)
+		up_history_set_charge_data (history, i % 100);
+	up_history_get_size (history, UP_HISTORY_TYPE_CHARGE, &samples, &bytes);
+	g_assert_cmpint (samples, <=, 64);
+	g_assert_cmpint (samples, >, 0);
+
+	/* ensure windows are reduced in the daemon */
+	rows = up_history_query (history, UP_HISTORY_TYPE_CHARGE,
+				 (guint) (g_get_real_time () / G_USEC_PER_SEC) - 60, 0, 0,
+				 (gchar **) aggregates, &error);
+	g_assert_no_error (error);
+	g_assert (rows != NULL);
+	g_assert_cmpint (rows->len, ==, 3);
+	g_assert_cmpfloat (g_array_index (rows, gdouble, 1), ==, 99.0f);
+	g_assert_cmpfloat (g_array_index (rows, gdouble, 2), >, 0.0f);
+	g_array_unref (rows);
+	rows = up_history_query (history, UP_HISTORY_TYPE_CHARGE, 0, 0, 60,
+				 (gchar **) aggregates_invalid, &error);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT);
+	g_assert (rows == NULL);
+	g_clear_error (&error);
+
+	/* ensure small changes are dropped */
+	up_history_set_compression (history, UP_HISTORY_TYPE_RATE,
+				    UP_HISTORY_COMPRESSION_DEADBAND, 1.0f, 0.0f, 0);
+	up_history_set_rate_data (history, 10.0f);
+	up_history_set_rate_data (history, 10.2f);
+	up_history_set_rate_data (history, 10.4f);
+	up_history_set_rate_data (history, 12.0f);
+	up_history_get_compression_stats (history, UP_HISTORY_TYPE_RATE, &offered, &stored);
+	g_assert_cmpint (offered, ==, 4);
+	g_assert_cmpint (stored, ==, 2);
+
 	/* unref */
 	g_object_unref (history);
 
+	/* ensure the old text format is migrated */
+	filename = g_build_filename (history_dir, "history-charge-migrate.dat", NULL);
+	data = g_strdup_printf ("%i\t85.000\tcharging\n%i\t90.000\tcharging\n",
+				(gint) (g_get_real_time () / G_USEC_PER_SEC) - 2,
+				(gint) (g_get_real_time () / G_USEC_PER_SEC) - 1);
+	ret = g_file_set_contents (filename, data, -1, NULL);
+	g_assert (ret);
+	g_free (data);
+	history = up_history_new ();
+	up_history_set_directory (history, history_dir);
+	up_history_set_id (history, "migrate");
+	array = up_history_get_data (history, UP_HISTORY_TYPE_CHARGE, 10, 100);
+	g_assert (array != NULL);
+	g_assert_cmpint (array->len, ==, 2);
+	item = g_ptr_array_index (array, 1);
+	g_assert_cmpint (up_history_item_get_value (item), ==, 90);
+	g_ptr_array_unref (array);
+	up_history_writer_sync ();
+	g_assert (!g_file_test (filename, G_FILE_TEST_EXISTS));
+	g_free (filename);
+	g_object_unref (history);
+	up_history_writer_sync ();
+
+	/* ensure the profile only counts samples we would keep */
+	filename = g_build_filename (history_dir, "history-charge-profile.dat", NULL);
+	now = g_get_real_time () / G_USEC_PER_SEC;
+	string = g_string_new ("");
+	for (i = 0; i < 20; i++)
+		g_string_append_printf (string, "%i\t%i.000\tdischarging\n",
+					(gint) now - 3600 + i * 60, 80 - i);
+	ret = g_file_set_contents (filename, string->str, -1, NULL);
+	g_assert (ret);
+	g_string_free (string, TRUE);
+	g_free (filename);
+	history = up_history_new ();
+	up_history_set_directory (history, history_dir);
+	up_history_set_id (history, "profile");
+	array = up_history_get_profile_data (history, FALSE);
+	g_ptr_array_set_free_func (array, (GDestroyNotify) g_object_unref);
+	g_assert_cmpint (array->len, ==, 101);
+	g_assert_cmpfloat (up_stats_item_get_accuracy (g_ptr_array_index (array, 70)), ==, 20.0f);
+	g_ptr_array_unref (array);
+	up_history_set_max_data_age (history, 60);
+	array = up_history_get_profile_data (history, FALSE);
+	g_ptr_array_set_free_func (array, (GDestroyNotify) g_object_unref);
+	g_assert_cmpfloat (up_stats_item_get_accuracy (g_ptr_array_index (array, 70)), ==, 0.0f);
+	g_ptr_array_unref (array);
+	g_object_unref (history);
+	up_history_writer_sync ();
+
 	/* remove these test files */
-	up_test_history_remove_temp_files ();
+	up_test_history_remove_temp_files ("test");
+	up_test_history_remove_temp_files ("migrate");
+	up_test_history_remove_temp_files ("profile");
 	rmdir (history_dir);
 }
 
@@ -309,6 +579,9 @@ main (int argc, char **argv)
 	g_test_add_func ("/power/native", up_test_native_func);
 	g_test_add_func ("/power/wakeups", up_test_wakeups_func);
 	g_test_add_func ("/power/daemon", up_test_daemon_func);
+	g_test_add_func ("/power/daemon_properties_changed", up_test_daemon_properties_changed_func);
+	g_test_add_func ("/power/daemon_filter", up_test_daemon_filter_func);
+	g_test_add_func ("/power/daemon_poll_timeout", up_test_daemon_poll_timeout_func);
 
 	return g_test_run ();
 }